@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+"""Generate synthetic modules and selective instrumentation files.
+
+The modules are textual LLVM IR with one C++ member function of a deeply
+nested class template per function, e.g.
+
+    ns3::Kernel12<ns1::Box2<ns0::Box4<int, 1>, 7> >::run1234(int)
+
+spread over header files through their debug information, so that the file
+filters apply per function. The functions are small straight-line code,
+loops, and calls to the previous function.
+
+The lists have a given number of entries of one kind: exact names, `#`
+wildcards, file `*`/`?` globs, or a mix of all of them. About half of the
+entries of each kind match functions of the module, the others match none.
+"""
+
+import argparse
+import os
+
+NAMESPACES = 16
+KERNELS = 97
+FILE_DIRS = 8
+
+
+def source_name(name):
+    return "%d%s" % (len(name), name)
+
+
+def template_arg(depth, seed):
+    """Mangled and demangled forms of a nested template argument."""
+    if depth == 0:
+        return "i", "int"
+    inner_mangled, inner = template_arg(depth - 1, seed // 3 + depth)
+    ns, box, value = "ns%d" % (seed % 7), "Box%d" % (seed % 5), seed % 10
+    mangled = "N%s%sI%sLi%dEEE" % (source_name(ns), source_name(box),
+                                   inner_mangled, value)
+    return mangled, "%s::%s<%s, %d>" % (ns, box, inner, value)
+
+
+def function_names(index, depth):
+    """Mangled and demangled names of the index-th function."""
+    ns, kernel = "ns%d" % (index % NAMESPACES), "Kernel%d" % (index % KERNELS)
+    method = "run%d" % index
+    arg_mangled, arg = template_arg(depth, index)
+    mangled = "_ZN%s%sI%sE%sEi" % (source_name(ns), source_name(kernel),
+                                   arg_mangled, source_name(method))
+    # __cxa_demangle separates the closing brackets of nested lists
+    close = " >" if arg.endswith(">") else ">"
+    return mangled, "%s::%s<%s%s::%s(int)" % (ns, kernel, arg, close, method)
+
+
+def file_name(index, files):
+    number = index % files
+    return "include/dir%d/file%d.h" % (number % FILE_DIRS, number)
+
+
+def write_module(path, functions, depth, files, debug=True):
+    """Write a module of the given number of functions."""
+    names = [function_names(i, depth)[0] for i in range(functions)]
+    files = max(1, min(files, functions))
+    # Metadata: !0-!4 are shared, then the files, then a subprogram and a
+    # location per function
+    first_sp = 5 + files
+
+    with open(path, "w") as out:
+        out.write("; Synthetic module: %d functions, template depth %d\n"
+                  % (functions, depth))
+        out.write('source_filename = "bench.cpp"\n\n')
+        for i, name in enumerate(names):
+            dbg = " !dbg !%d" % (first_sp + 2 * i) if debug else ""
+            loc = ", !dbg !%d" % (first_sp + 2 * i + 1) if debug else ""
+            out.write("define i32 @%s(i32 %%x)%s {\n" % (name, dbg))
+            out.write("entry:\n")
+            out.write("  %%a = mul i32 %%x, %d\n" % (i % 13 + 2))
+            out.write("  %%b = add i32 %%a, %d\n" % i)
+            shape = i % 4
+            call = "call i32 @%s(i32 %%%s)%s" if i > 0 else None
+            if shape in (0, 1) or i == 0:
+                if shape == 1 and i > 0:
+                    out.write("  %c = " + call % (names[i - 1], "b", loc)
+                              + "\n")
+                    out.write("  ret i32 %c\n")
+                else:
+                    out.write("  ret i32 %b\n")
+            else:
+                # shape 2: a loop, shape 3: a loop calling the previous one
+                out.write("  br label %loop\n")
+                out.write("loop:\n")
+                out.write("  %i = phi i32 [ 0, %entry ], [ %next, %loop ]\n")
+                out.write("  %s = phi i32 [ %b, %entry ], [ %t, %loop ]\n")
+                if shape == 3:
+                    out.write("  %u = " + call % (names[i - 1], "s", loc)
+                              + "\n")
+                    out.write("  %t = add i32 %u, %i\n")
+                else:
+                    out.write("  %t = add i32 %s, %i\n")
+                out.write("  %next = add i32 %i, 1\n")
+                out.write("  %done = icmp sge i32 %next, %x\n")
+                out.write("  br i1 %done, label %exit, label %loop\n")
+                out.write("exit:\n")
+                out.write("  ret i32 %t\n")
+            out.write("}\n\n")
+
+        if not debug:
+            return
+        out.write("!llvm.dbg.cu = !{!0}\n")
+        out.write("!llvm.module.flags = !{!2}\n\n")
+        out.write('!0 = distinct !DICompileUnit(language: DW_LANG_C_plus_plus, '
+                  'file: !1, producer: "tau-bench", isOptimized: false, '
+                  'runtimeVersion: 0, emissionKind: FullDebug)\n')
+        out.write('!1 = !DIFile(filename: "bench.cpp", directory: "/bench")\n')
+        out.write('!2 = !{i32 2, !"Debug Info Version", i32 3}\n')
+        out.write("!3 = !DISubroutineType(types: !4)\n")
+        out.write("!4 = !{}\n")
+        for f in range(files):
+            out.write('!%d = !DIFile(filename: "%s", directory: "/bench")\n'
+                      % (5 + f, file_name(f, files)))
+        for i, name in enumerate(names):
+            sp, scope = first_sp + 2 * i, 5 + i % files
+            out.write('!%d = distinct !DISubprogram(name: "run%d", '
+                      'linkageName: "%s", scope: !%d, file: !%d, line: 1, '
+                      'type: !3, scopeLine: 1, spFlags: DISPFlagDefinition, '
+                      'unit: !0)\n' % (sp, i, name, scope, scope))
+            out.write("!%d = !DILocation(line: 2, column: 3, scope: !%d)\n"
+                      % (sp + 1, sp))
+
+
+def exact_entries(count, functions, depth):
+    """Half the names of existing functions, spread evenly, half misses."""
+    hits = min(count - count // 2, functions)
+    step = max(1, functions // max(1, hits))
+    entries = [function_names(i * step % functions, depth)[1]
+               for i in range(hits)]
+    for i in range(count - hits):
+        _, name = function_names(functions + i, depth)
+        entries.append(name.replace("::Kernel", "::Missing", 1))
+    return entries
+
+
+def wildcard_entries(count):
+    """Wildcards on a namespace and a class, half of them matching none."""
+    entries = []
+    for i in range(count):
+        ns, kernel = i % NAMESPACES, (i // NAMESPACES) % KERNELS
+        if i % 2:
+            entries.append("ns%d::Absent%d<#>::run%d#" % (ns, kernel, i))
+        elif i < 2 * NAMESPACES * KERNELS:
+            entries.append("ns%d::Kernel%d<#>::run#" % (ns, kernel))
+        else:
+            # Narrower and narrower on the method number
+            entries.append("ns%d::Kernel%d<#>::run%d#" % (ns, kernel, i))
+    return entries
+
+
+def file_entries(count, files):
+    """Globs on the header files, half of them matching none."""
+    entries = []
+    for i in range(count):
+        number = i % max(1, files)
+        if i % 2:
+            entries.append("src/other%d/*.h" % i)
+        elif i % 4 == 0:
+            entries.append("include/dir?/file%d.h" % number)
+        else:
+            entries.append("include/dir*/file%d?.h" % number)
+    return entries
+
+
+def write_list(path, kind, count, functions, depth, files):
+    """Write a list of the given kind with about count entries."""
+    sections = []
+    if kind == "exact":
+        sections.append(("INCLUDE_LIST", exact_entries(count, functions,
+                                                       depth)))
+    elif kind == "wildcard":
+        sections.append(("INCLUDE_LIST", wildcard_entries(count)))
+    elif kind == "files":
+        # The file filters only apply to the functions that are selected
+        sections.append(("INCLUDE_LIST", ["#"]))
+        sections.append(("FILE_INCLUDE_LIST", file_entries(count, files)))
+    elif kind == "mixed":
+        sections.append(("INCLUDE_LIST",
+                         exact_entries(count // 2, functions, depth)
+                         + wildcard_entries(count // 4)))
+        sections.append(("EXCLUDE_LIST",
+                         ["ns%d::Kernel%d<#>::run#" % (i % NAMESPACES, i)
+                          for i in range(max(1, count // 8))]))
+        sections.append(("FILE_EXCLUDE_LIST",
+                         file_entries(max(1, count // 8), files)))
+    else:
+        raise ValueError("unknown list kind " + kind)
+
+    with open(path, "w") as out:
+        for section, entries in sections:
+            out.write("BEGIN_%s\n" % section)
+            for entry in entries:
+                out.write(entry + "\n")
+            out.write("END_%s\n" % section)
+
+
+LIST_KINDS = ("exact", "wildcard", "files", "mixed")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("-o", "--output-dir", default=".")
+    parser.add_argument("--functions", type=int, default=1000)
+    parser.add_argument("--depth", type=int, default=4,
+                        help="nesting depth of the template arguments")
+    parser.add_argument("--files", type=int, default=200,
+                        help="number of header files")
+    parser.add_argument("--no-debug", action="store_true",
+                        help="no debug information: the file filters apply "
+                             "to the whole module")
+    parser.add_argument("--list-kind", choices=LIST_KINDS, action="append")
+    parser.add_argument("--list-size", type=int, action="append")
+    args = parser.parse_args()
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    write_module(os.path.join(args.output_dir,
+                              "module_%d.ll" % args.functions),
+                 args.functions, args.depth, args.files, not args.no_debug)
+    for kind in args.list_kind or LIST_KINDS:
+        for size in args.list_size or (10, 1000):
+            write_list(os.path.join(args.output_dir,
+                                    "%s_%d_%d.txt" % (kind, size,
+                                                      args.functions)),
+                       kind, size, args.functions, args.depth, args.files)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""Measure what the instrumentation plugin costs the build.
+
+Runs `opt -passes='default<O0>'` with the C++ plugin over synthetic modules
+of increasing size (see generate.py), for each kind and size of list, which
+adds the instrumentation where clang would, and reports for each run:
+
+  - the time per function: the wall time of the run, less the time of the
+    same pipeline without the plugin, divided by the number of functions
+    (the best of --repeat runs);
+  - the peak memory of the run, and its difference with the baseline;
+  - the time spent in each step of the plugin, from -tau-time-report.
+
+Each variant of the plugin options (--variant) is measured separately, to
+compare the matching strategies. With --json, the results are also written
+to a file; with --compare, they are checked against such a file and the
+script fails if a run got slower by more than --threshold percent.
+"""
+
+import argparse
+import json
+import os
+import re
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import generate
+
+# Descriptions of the timers of -tau-time-report, in the order of the table
+STEPS = (
+    ("load-list", "Read the input file or the list cache"),
+    ("demangle", "Demangle the function names"),
+    ("match", "Look up the names and files in the lists"),
+    ("regex", "Match -tau-regex and -tau-iregex"),
+    ("cost", "Static cost for -tau-min-cost"),
+    ("instrument", "Insert the probes"),
+)
+
+# The last column before the description is the wall time
+TIMER_LINE = re.compile(r"([\d.]+) \(\s*[\d.]+%\)\s+([^\d\s].*?)\s*$")
+
+
+def run(command, timeout):
+    """Run a command, returning its wall time and peak memory (in MB)."""
+    with tempfile.TemporaryFile() as stderr:
+        start = time.perf_counter()
+        process = subprocess.Popen(command, stdout=subprocess.DEVNULL,
+                                   stderr=stderr)
+        killer = threading.Timer(timeout, process.kill)
+        killer.start()
+        # Unlike Popen.wait(), wait4() reports the usage of this very process
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        killer.cancel()
+        process.returncode = os.waitstatus_to_exitcode(status)
+
+        if process.returncode == -signal.SIGKILL:
+            return None
+        if process.returncode:
+            stderr.seek(0)
+            sys.exit("failed: %s\n%s" % (" ".join(command),
+                                         stderr.read().decode()))
+    # ru_maxrss is in KB on Linux
+    return wall, usage.ru_maxrss / 1024.0
+
+
+def measure(command, repeat, timeout, report=None):
+    """Best wall time and peak memory over several runs."""
+    best = None
+    for _ in range(repeat):
+        # -info-output-file appends to the file
+        if report and os.path.exists(report):
+            os.remove(report)
+        result = run(command, timeout)
+        if result is None:
+            return None
+        if best is None or result[0] < best[0]:
+            best = result
+    return best
+
+
+def read_timers(path):
+    """Wall time of each step in a -tau-time-report report."""
+    steps = {description: name for name, description in STEPS}
+    times = {}
+    with open(path) as report:
+        for line in report:
+            match = TIMER_LINE.search(line)
+            if match and match.group(2) in steps:
+                step = steps[match.group(2)]
+                times[step] = times.get(step, 0) + float(match.group(1))
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--opt", default="opt", help="opt binary")
+    parser.add_argument("--plugin", required=True,
+                        help="TAU_Profiling_CXX plugin")
+    parser.add_argument("--work-dir",
+                        help="where to generate the inputs (default: a "
+                             "temporary directory)")
+    parser.add_argument("--functions", type=int, action="append",
+                        help="module sizes (default: 1000 10000 100000)")
+    parser.add_argument("--list-size", type=int, action="append",
+                        help="list sizes (default: 10 1000 50000)")
+    parser.add_argument("--list-kind", choices=generate.LIST_KINDS,
+                        action="append", help="list kinds (default: all)")
+    parser.add_argument("--depth", type=int, default=4,
+                        help="nesting depth of the template arguments")
+    parser.add_argument("--variant", action="append", metavar="NAME=OPTIONS",
+                        help="plugin options to compare (default: "
+                             "default= mangled=-tau-mangled-lookup)")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--timeout", type=float, default=600,
+                        help="seconds before a run is abandoned")
+    parser.add_argument("--json", help="write the results to this file")
+    parser.add_argument("--compare",
+                        help="results of a previous run to compare with")
+    parser.add_argument("--threshold", type=float, default=10,
+                        help="slowdown reported as a regression, in percent")
+    args = parser.parse_args()
+
+    sizes = args.functions or [1000, 10000, 100000]
+    list_sizes = args.list_size or [10, 1000, 50000]
+    kinds = args.list_kind or generate.LIST_KINDS
+    variants = [v.partition("=")[::2] for v in
+                args.variant or ["default=", "mangled=-tau-mangled-lookup"]]
+
+    work_dir = args.work_dir or tempfile.mkdtemp(prefix="tau-bench-")
+    os.makedirs(work_dir, exist_ok=True)
+    report = os.path.join(work_dir, "timers.txt")
+
+    header = "%-8s %-8s %7s %7s %9s %8s %8s" % (
+        "variant", "list", "entries", "funcs", "us/func", "peak MB",
+        "+MB") + "".join(" %10s" % name for name, _ in STEPS)
+    print(header)
+    print("-" * len(header))
+
+    results = []
+    for functions in sizes:
+        module = os.path.join(work_dir, "module_%d.ll" % functions)
+        generate.write_module(module, functions, args.depth, 200)
+        baseline = measure([args.opt, "-passes=default<O0>",
+                            "-disable-output", module], args.repeat,
+                           args.timeout)
+
+        for kind in kinds:
+            for list_size in list_sizes:
+                input_file = os.path.join(
+                    work_dir, "%s_%d_%d.txt" % (kind, list_size, functions))
+                generate.write_list(input_file, kind, list_size, functions,
+                                    args.depth, 200)
+
+                for name, options in variants:
+                    command = [args.opt, "-load=" + args.plugin,
+                               "-load-pass-plugin=" + args.plugin,
+                               "-passes=default<O0>",
+                               "-tau-input-file=" + input_file,
+                               "-tau-time-report",
+                               "-info-output-file=" + report,
+                               "-disable-output", module] + options.split()
+                    result = measure(command, args.repeat, args.timeout,
+                                     report)
+                    line = "%-8s %-8s %7d %7d" % (name, kind, list_size,
+                                                  functions)
+                    if result is None:
+                        print(line + " timeout")
+                        continue
+                    wall, rss = result
+                    steps = read_timers(report)
+                    per_function = max(0.0, wall - baseline[0]) / functions
+                    print(line + " %9.2f %8.1f %8.1f" % (
+                        per_function * 1e6, rss, rss - baseline[1])
+                        + "".join(" %10.4f" % steps.get(step, 0)
+                                  for step, _ in STEPS))
+                    sys.stdout.flush()
+                    results.append({
+                        "variant": name, "list": kind,
+                        "entries": list_size, "functions": functions,
+                        "us_per_function": per_function * 1e6,
+                        "peak_mb": rss, "extra_mb": rss - baseline[1],
+                        "steps": steps})
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(results, out, indent=2)
+
+    if args.compare:
+        with open(args.compare) as previous_file:
+            previous = {(r["variant"], r["list"], r["entries"],
+                         r["functions"]): r for r in json.load(previous_file)}
+        regressions = 0
+        for result in results:
+            key = (result["variant"], result["list"], result["entries"],
+                   result["functions"])
+            before = previous.get(key)
+            if not before or not before["us_per_function"]:
+                continue
+            change = 100 * (result["us_per_function"] /
+                            before["us_per_function"] - 1)
+            if change > args.threshold:
+                regressions += 1
+                print("regression: %s %s %d entries, %d functions: "
+                      "%.2f -> %.2f us/function (+%.0f%%)" % (
+                          key + (before["us_per_function"],
+                                 result["us_per_function"], change)))
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
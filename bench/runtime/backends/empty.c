@@ -0,0 +1,28 @@
+/*
+ * Probes doing nothing, in their own translation unit: what is left is the
+ * cost of the calls themselves, and of the code the plugin adds around them.
+ */
+
+#include <stddef.h>
+
+void bench_start(const char *name) { (void)name; }
+
+void bench_stop(const char *name) { (void)name; }
+
+/* Handle-based probes, for -tau-probe-handles */
+
+struct handle_slot {
+  void **slot;
+  const char *name;
+};
+
+void *bench_get_handle(const char *name) { return (void *)name; }
+
+void bench_register_handles(struct handle_slot *slots, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    *slots[i].slot = (void *)slots[i].name;
+}
+
+void bench_start_handle(void *handle) { (void)handle; }
+
+void bench_stop_handle(void *handle) { (void)handle; }
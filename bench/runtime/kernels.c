@@ -0,0 +1,127 @@
+/*
+ * Calibrated kernels for the probe overhead benchmark.
+ *
+ *   kernels <leaf|recursive> <threads> [min-seconds]
+ *
+ * Each thread calls the kernel until it has run for at least min-seconds
+ * (0.2 by default), doubling the number of calls each time, and the program
+ * prints the cost of a call of the instrumented function, averaged over the
+ * threads:
+ *
+ *   kernel=leaf threads=4 calls=33554432 cycles_per_call=6.12 ns_per_call=2.04
+ *
+ * Only bench_leaf and bench_fib are meant to be instrumented (see
+ * kernels.txt): the difference with an uninstrumented build is the cost of
+ * the probes. Cycles are read from the time stamp counter on x86, and are
+ * nanoseconds elsewhere.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles() __rdtsc()
+#else
+#define bench_cycles() bench_ns()
+#endif
+
+/* Empty, but still a call: the compiler must not see through it */
+__attribute__((noinline)) void bench_leaf(void) { __asm__ volatile(""); }
+
+__attribute__((noinline)) unsigned bench_fib(unsigned n) {
+  return n < 2 ? n : bench_fib(n - 1) + bench_fib(n - 2);
+}
+
+/* Depth of the recursive kernel: 21891 calls of bench_fib per run */
+#define FIB_DEPTH 20
+#define FIB_CALLS 21891
+
+static uint64_t bench_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+struct bench_thread {
+  pthread_t thread;
+  int recursive;
+  double min_seconds;
+  uint64_t calls;
+  uint64_t cycles;
+  uint64_t ns;
+  volatile unsigned sink;
+};
+
+/* Run the kernel so that the function is called n times */
+static void bench_run(struct bench_thread *t, uint64_t n) {
+  if (t->recursive) {
+    for (uint64_t i = 0; i < n / FIB_CALLS; ++i)
+      t->sink += bench_fib(FIB_DEPTH);
+  } else {
+    for (uint64_t i = 0; i < n; ++i)
+      bench_leaf();
+  }
+}
+
+static void *bench_thread_main(void *arg) {
+  struct bench_thread *t = arg;
+  uint64_t n = t->recursive ? FIB_CALLS : 1024;
+
+  bench_run(t, n); /* warm up */
+  for (;;) {
+    uint64_t start_ns = bench_ns();
+    uint64_t start = bench_cycles();
+    bench_run(t, n);
+    uint64_t cycles = bench_cycles() - start;
+    uint64_t ns = bench_ns() - start_ns;
+    if (ns >= t->min_seconds * 1e9) {
+      t->calls = n;
+      t->cycles = cycles;
+      t->ns = ns;
+      return NULL;
+    }
+    n *= 2;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || (strcmp(argv[1], "leaf") && strcmp(argv[1], "recursive"))) {
+    fprintf(stderr, "usage: %s <leaf|recursive> <threads> [min-seconds]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  int threads = atoi(argv[2]);
+  double min_seconds = argc > 3 ? atof(argv[3]) : 0.2;
+  if (threads < 1)
+    threads = 1;
+
+  struct bench_thread *t = calloc(threads, sizeof(*t));
+  for (int i = 0; i < threads; ++i) {
+    t[i].recursive = !strcmp(argv[1], "recursive");
+    t[i].min_seconds = min_seconds;
+    if (pthread_create(&t[i].thread, NULL, bench_thread_main, &t[i])) {
+      perror("pthread_create");
+      return EXIT_FAILURE;
+    }
+  }
+
+  double cycles = 0, ns = 0;
+  uint64_t calls = 0;
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(t[i].thread, NULL);
+    cycles += (double)t[i].cycles / t[i].calls;
+    ns += (double)t[i].ns / t[i].calls;
+    calls += t[i].calls;
+  }
+  printf("kernel=%s threads=%d calls=%llu cycles_per_call=%.3f "
+         "ns_per_call=%.3f\n",
+         argv[1], threads, (unsigned long long)calls, cycles / threads,
+         ns / threads);
+  free(t);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+#!/usr/bin/env python3
+"""Measure what the probes cost at run time.
+
+Builds the kernels of kernels.c and the sandbox workloads through the
+plugin, once per runtime backend: the front end (clang) emits the IR, and
+opt and llc of the same LLVM run the plugin and build the objects. It
+reports:
+
+  - for the kernels (an empty leaf function, a recursive function), the
+    cycles per call of the instrumented function and, against the build
+    without instrumentation, the cycles per probe, for each number of
+    threads (--threads);
+  - for the workloads (sandbox/mm matrix multiplication, sandbox/hh
+    Householder decomposition), the run time and the slowdown against the
+    build without instrumentation, with the list of the sandbox and with
+    every function instrumented.
+
+Each backend is a set of plugin options and the runtime it is linked with:
+
+  none           no instrumentation, the reference
+  empty          probes doing nothing (backends/empty.c): the call overhead
+  empty-handles  the same, with -tau-probe-handles=ctor
+  rtlib          sandbox/rtlib.c (its output is discarded)
+  rtlib-handles  the same, with -tau-probe-handles=ctor
+  builtin        the runtime of runtime/TAURuntime.c
+  builtin-handles  the same, with -tau-probe-handles=ctor
+  builtin-ids    the runtime, given stable 64-bit ids
+                 (-tau-probe-backend=tau-ids)
+  builtin-sampled  builtin-handles, timing one call in 64 (-tau-sample-period)
+  builtin-throttled  builtin-handles, with -tau-throttle and the default
+                 throttle of the runtime
+  builtin-inline  the runtime, given the counters kept inline
+                 (-tau-probe-backend=inline-counters)
+  tau            Tau_start/Tau_stop from the TAU library of --tau-lib
+
+With --json, the results are also written to a file.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SANDBOX = os.path.join(HERE, os.pardir, os.pardir, "sandbox")
+RUNTIME = [os.path.join(HERE, os.pardir, os.pardir, "runtime", source)
+           for source in ("TAURuntime.c", "TAURuntimeTrace.c")]
+
+
+# name -> (plugin options, runtime sources), None for no instrumentation
+BACKENDS = {
+    "none": None,
+    "empty": (["-tau-start-func=bench_start", "-tau-stop-func=bench_stop"],
+              [os.path.join(HERE, "backends", "empty.c")]),
+    "empty-handles": (["-tau-probe-handles=ctor",
+                       "-tau-handle-start-func=bench_start_handle",
+                       "-tau-handle-stop-func=bench_stop_handle",
+                       "-tau-handle-get-func=bench_get_handle",
+                       "-tau-handle-register-func=bench_register_handles"],
+                      [os.path.join(HERE, "backends", "empty.c")]),
+    "rtlib": (["-tau-probe-backend=rtlib"],
+              [os.path.join(SANDBOX, "rtlib.c")]),
+    "rtlib-handles": (["-tau-probe-backend=rtlib", "-tau-probe-handles=ctor"],
+                      [os.path.join(SANDBOX, "rtlib.c")]),
+    "builtin": ([], RUNTIME),
+    "builtin-handles": (["-tau-probe-handles=ctor"], RUNTIME),
+    "builtin-ids": (["-tau-probe-backend=tau-ids"], RUNTIME),
+    "builtin-sampled": (["-tau-probe-handles=ctor", "-tau-sample-period=64"],
+                        RUNTIME),
+    "builtin-throttled": (["-tau-probe-handles=ctor", "-tau-throttle"],
+                          RUNTIME),
+    "builtin-inline": (["-tau-probe-backend=inline-counters"], RUNTIME),
+    "tau": ([], []),
+}
+
+# name -> (C++?, sources, list, compile flags, arguments)
+WORKLOADS = {
+    "mm": (True, [os.path.join(SANDBOX, "mm", "matmult.cpp"),
+                  os.path.join(SANDBOX, "mm", "matmult_initialize.cpp")],
+           os.path.join(SANDBOX, "mm", "functions_CXX_mm.txt"),
+           ["-DMATRIX_SIZE=256", "-I" + os.path.join(SANDBOX, "mm")], []),
+    "hh": (False, [os.path.join(SANDBOX, "hh", "householder.c")],
+           os.path.join(SANDBOX, "hh", "functions_hh.txt"), ["-lm"],
+           ["300", "300"]),
+}
+
+KERNEL_LINE = re.compile(r"cycles_per_call=([\d.]+) ns_per_call=([\d.]+)")
+
+
+class Builder:
+    def __init__(self, args, work_dir):
+        self.args = args
+        self.work_dir = work_dir
+        self.all_list = os.path.join(work_dir, "all.txt")
+        with open(self.all_list, "w") as out:
+            out.write("BEGIN_INCLUDE_LIST\n#\nEND_INCLUDE_LIST\n")
+
+    def compile(self, source, cxx, function_list, options, flags):
+        """Compile a source through the plugin, returning the object.
+
+        The front end only emits the IR: the plugin is run by opt, as in the
+        tests, with the optimizations of -O2, and the object is built by
+        llc. IR sources (.ll) go straight to opt.
+        """
+        args = self.args
+        base = os.path.join(self.work_dir, os.path.basename(source))
+        if source.endswith(".ll"):
+            bitcode = source
+        else:
+            bitcode = base + ".bc"
+            subprocess.check_call(
+                [args.cxx if cxx else args.cc, "-O2", "-g", "-w", "-pthread",
+                 "-Xclang", "-disable-llvm-passes", "-emit-llvm", "-c",
+                 source, "-o", bitcode]
+                + [flag for flag in flags if not flag.startswith("-l")])
+        plugin = args.plugin_cxx if cxx else args.plugin_c
+        # -load registers the options, -load-pass-plugin adds the pass
+        subprocess.check_call(
+            [args.opt, "-load=" + plugin, "-load-pass-plugin=" + plugin,
+             "-passes=default<O2>", "-tau-input-file=" + function_list]
+            + options + [bitcode, "-o", base + ".opt.bc"])
+        obj = base + ".o"
+        subprocess.check_call([args.llc, "-O2", "-filetype=obj",
+                               "-relocation-model=pic", base + ".opt.bc",
+                               "-o", obj])
+        return obj
+
+    def build(self, name, backend, sources, cxx, function_list, flags=()):
+        """Compile sources with the backend, returning the executable."""
+        args = self.args
+        output = os.path.join(self.work_dir, "%s.%s" % (name, backend))
+        command = [args.cxx if cxx else args.cc, "-O2", "-g", "-w",
+                   "-pthread"]
+        options = BACKENDS[backend]
+        if options is None:
+            command += list(sources) + list(flags) + ["-o", output]
+            subprocess.check_call(command)
+            return output
+
+        objects = [self.compile(source, cxx, function_list,
+                                options[0] + args.plugin_option, flags)
+                   for source in sources]
+        # The runtimes are C, built without the plugin
+        runtime = []
+        for source in options[1]:
+            obj = os.path.join(self.work_dir, os.path.basename(source) + ".o")
+            if not os.path.exists(obj):
+                # As runtime/CMakeLists.txt builds them
+                subprocess.check_call([args.cc, "-std=gnu11", "-O2",
+                                       "-pthread", "-c", source, "-o", obj])
+            runtime.append(obj)
+        if backend == "tau":
+            runtime += ["-L" + args.tau_lib, "-lTAU", "-ldl",
+                        "-Wl,-rpath," + args.tau_lib]
+        command += objects + runtime + list(flags) + ["-o", output]
+        subprocess.check_call(command)
+        return output
+
+
+def run_kernel(executable, kernel, threads, min_seconds, cwd):
+    output = subprocess.check_output(
+        [executable, kernel, str(threads), str(min_seconds)], cwd=cwd,
+        stderr=subprocess.DEVNULL, universal_newlines=True)
+    match = KERNEL_LINE.search(output)
+    if not match:
+        sys.exit("unexpected output of %s: %s" % (executable, output))
+    return float(match.group(1)), float(match.group(2))
+
+
+def run_workload(executable, arguments, repeat, cwd):
+    """Best wall time over several runs."""
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        subprocess.check_call([executable] + arguments, cwd=cwd,
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+        wall = time.perf_counter() - start
+        best = wall if best is None else min(best, wall)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--cc", default="clang")
+    parser.add_argument("--cxx", default="clang++")
+    parser.add_argument("--opt", default="opt")
+    parser.add_argument("--llc", default="llc")
+    parser.add_argument("--plugin-c", required=True,
+                        help="TAU_Profiling plugin")
+    parser.add_argument("--plugin-cxx", required=True,
+                        help="TAU_Profiling_CXX plugin")
+    parser.add_argument("--plugin-option", action="append", default=[],
+                        help="extra option of the plugin, for all the "
+                             "instrumented builds")
+    parser.add_argument("--backend", action="append",
+                        choices=sorted(BACKENDS),
+                        help="backends to measure (default: all but tau, "
+                             "and tau with --tau-lib)")
+    parser.add_argument("--tau-lib", help="directory of libTAU.so")
+    parser.add_argument("--threads", type=int, action="append",
+                        help="thread counts of the kernels (default: 1 2 4 "
+                             "and the number of CPUs)")
+    parser.add_argument("--min-seconds", type=float, default=0.2,
+                        help="minimum run time of each kernel measure")
+    parser.add_argument("--workload", action="append",
+                        choices=sorted(WORKLOADS),
+                        help="workloads to run (default: all)")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="runs of each workload, the best is kept")
+    parser.add_argument("--work-dir",
+                        help="where to build (default: a temporary "
+                             "directory)")
+    parser.add_argument("--json", help="write the results to this file")
+    args = parser.parse_args()
+
+    backends = args.backend or [b for b in BACKENDS
+                                if b != "tau" or args.tau_lib]
+    if "tau" in backends and not args.tau_lib:
+        sys.exit("the tau backend needs --tau-lib")
+    if "none" not in backends:
+        backends.insert(0, "none")
+    threads = args.threads or sorted({1, 2, 4, os.cpu_count() or 1})
+    workloads = args.workload or sorted(WORKLOADS)
+
+    work_dir = args.work_dir or tempfile.mkdtemp(prefix="tau-bench-")
+    os.makedirs(work_dir, exist_ok=True)
+    builder = Builder(args, work_dir)
+    results = {"kernels": [], "workloads": []}
+
+    print("%-14s %-10s %7s %12s %12s %12s" % (
+        "backend", "kernel", "threads", "cycles/call", "ns/call",
+        "cycles/probe"))
+    reference = {}
+    for backend in backends:
+        executable = builder.build("kernels", backend,
+                                   [os.path.join(HERE, "kernels.c")], False,
+                                   os.path.join(HERE, "kernels.txt"))
+        for kernel in ("leaf", "recursive"):
+            for count in threads:
+                cycles, ns = run_kernel(executable, kernel, count,
+                                        args.min_seconds, work_dir)
+                if backend == "none":
+                    reference[kernel, count] = cycles
+                # A start and a stop per call
+                per_probe = (cycles - reference[kernel, count]) / 2
+                print("%-14s %-10s %7d %12.2f %12.2f %12s" % (
+                    backend, kernel, count, cycles, ns,
+                    "-" if backend == "none" else "%.2f" % per_probe))
+                sys.stdout.flush()
+                results["kernels"].append({
+                    "backend": backend, "kernel": kernel, "threads": count,
+                    "cycles_per_call": cycles, "ns_per_call": ns,
+                    "cycles_per_probe": per_probe})
+
+    print()
+    print("%-14s %-10s %-8s %10s %9s" % ("backend", "workload", "list",
+                                         "seconds", "slowdown"))
+    for workload in workloads:
+        cxx, sources, function_list, flags, arguments = WORKLOADS[workload]
+        reference = None
+        for backend in backends:
+            for list_name, path in (("sandbox", function_list),
+                                    ("all", builder.all_list)):
+                if backend == "none" and list_name == "all":
+                    continue
+                executable = builder.build(
+                    "%s-%s" % (workload, list_name), backend, sources, cxx,
+                    path, flags)
+                seconds = run_workload(executable, arguments, args.repeat,
+                                       work_dir)
+                if backend == "none":
+                    reference = seconds
+                    list_name = "-"
+                print("%-14s %-10s %-8s %10.3f %9.2f" % (
+                    backend, workload, list_name, seconds,
+                    seconds / reference))
+                sys.stdout.flush()
+                results["workloads"].append({
+                    "backend": backend, "workload": workload,
+                    "list": list_name, "seconds": seconds,
+                    "slowdown": seconds / reference})
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(results, out, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,30 @@
+//===- TAUBinaryIO.h - Helpers for the binary list cache --------*- C++ -*-===//
+//
+// Little-endian words, as stored in the binary list cache.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TAU_BINARYIO_H
+#define TAU_BINARYIO_H
+
+#include <cstdint>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/raw_ostream.h"
+
+inline void writeU32(llvm::raw_ostream &os, uint32_t value) {
+  for (unsigned i = 0; i < 4; ++i)
+    os << static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+/// Read a word at the start of \p data and drop it. False if too short.
+inline bool readU32(llvm::StringRef &data, uint32_t &value) {
+  if (data.size() < 4)
+    return false;
+  value = llvm::support::endian::read32le(data.data());
+  data = data.drop_front(4);
+  return true;
+}
+
+#endif // TAU_BINARYIO_H
@@ -0,0 +1,202 @@
+//===- TAUGlobMatcher.cpp - Combined wildcard matcher ---------------------===//
+//
+// This file implements the lazily-built DFA used to match function and file
+// names against the wildcard entries of the selective instrumentation file.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+
+#include "TAUBinaryIO.h"
+#include "TAUGlobMatcher.h"
+
+using namespace llvm;
+
+void TAUGlobMatcher::addPattern(StringRef pattern, unsigned tag, char star,
+                                char ques) {
+  starts.push_back(tokens.size());
+  for (char c : pattern) {
+    if (c == star) {
+      /* Consecutive stars are equivalent to a single one */
+      if (tokens.size() == starts.back() || tokens.back().kind != Star)
+        tokens.push_back({Star, 0, 0});
+    } else if (ques && c == ques) {
+      tokens.push_back({Ques, 0, 0});
+    } else {
+      tokens.push_back({Literal, static_cast<unsigned char>(c), 0});
+    }
+  }
+  tokens.push_back({End, 0, tag});
+  allTags |= tag;
+
+  /* The start state depends on all the patterns: drop the cached DFA */
+  states.clear();
+  stateIds.clear();
+}
+
+/*!
+ * Add to the set the positions reachable without consuming any character,
+ * then sort it so that it can be used as a key.
+ */
+void TAUGlobMatcher::closure(std::vector<unsigned> &positions) const {
+  for (size_t i = 0; i < positions.size(); ++i) {
+    TokenKind kind = tokens[positions[i]].kind;
+    if (kind == Star || kind == Ques)
+      positions.push_back(positions[i] + 1);
+  }
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()),
+                  positions.end());
+}
+
+void TAUGlobMatcher::advance(const std::vector<unsigned> &from,
+                             unsigned char c,
+                             std::vector<unsigned> &to) const {
+  to.clear();
+  for (unsigned p : from) {
+    const Token &t = tokens[p];
+    switch (t.kind) {
+    case Literal:
+      if (t.c == c)
+        to.push_back(p + 1);
+      break;
+    case Star:
+      to.push_back(p);
+      break;
+    case Ques:
+      to.push_back(p + 1);
+      break;
+    case End:
+      break;
+    }
+  }
+  closure(to);
+}
+
+unsigned
+TAUGlobMatcher::acceptTag(const std::vector<unsigned> &positions) const {
+  unsigned tag = 0;
+  for (unsigned p : positions)
+    if (tokens[p].kind == End)
+      tag |= tokens[p].tag;
+  return tag;
+}
+
+/*!
+ * Return the DFA state for the given set of positions, creating it if needed.
+ * Returns -1 if the DFA is full.
+ */
+int TAUGlobMatcher::intern(std::vector<unsigned> &&positions) {
+  auto it = stateIds.find(positions);
+  if (it != stateIds.end())
+    return it->second;
+  if (states.size() >= MaxStates)
+    return -1;
+
+  unsigned id = states.size();
+  states.push_back({positions, acceptTag(positions), {}});
+  states.back().next.fill(-1);
+  stateIds.emplace(std::move(positions), id);
+  return id;
+}
+
+void TAUGlobMatcher::reset() {
+  states.clear();
+  stateIds.clear();
+  std::vector<unsigned> start(starts.begin(), starts.end());
+  closure(start);
+  intern(std::move(start));        // StartState
+  intern(std::vector<unsigned>()); // DeadState
+}
+
+int TAUGlobMatcher::step(unsigned state, unsigned char c) {
+  std::vector<unsigned> to;
+  advance(states[state].positions, c, to);
+  int next = intern(std::move(to));
+  if (next < 0) {
+    /* Start over with an empty cache for the next names */
+    reset();
+    return -1;
+  }
+  states[state].next[c] = next;
+  return next;
+}
+
+/*!
+ * Plain NFA simulation, used when a single name needs more states than the
+ * cache can hold.
+ */
+unsigned TAUGlobMatcher::matchSlow(StringRef name) const {
+  std::vector<unsigned> current(starts.begin(), starts.end()), next;
+  closure(current);
+  for (unsigned char c : name) {
+    advance(current, c, next);
+    std::swap(current, next);
+    if (current.empty())
+      return 0;
+  }
+  return acceptTag(current);
+}
+
+unsigned TAUGlobMatcher::match(StringRef name) {
+  if (tokens.empty())
+    return 0;
+  if (states.empty())
+    reset();
+
+  unsigned state = StartState;
+  for (unsigned char c : name) {
+    int next = states[state].next[c];
+    if (next < 0) {
+      next = step(state, c);
+      if (next < 0)
+        return matchSlow(name);
+    }
+    if (next == DeadState)
+      return 0;
+    state = next;
+  }
+  return states[state].tag;
+}
+
+/*
+ * Layout: u32 number of tokens, then one u32 per token holding its kind and
+ * character, followed by the tag for End tokens.
+ */
+void TAUGlobMatcher::write(raw_ostream &os) const {
+  writeU32(os, tokens.size());
+  for (const Token &t : tokens) {
+    writeU32(os, t.kind | t.c << 8);
+    if (t.kind == End)
+      writeU32(os, t.tag);
+  }
+}
+
+bool TAUGlobMatcher::read(StringRef &data) {
+  uint32_t count, word;
+  if (!readU32(data, count))
+    return false;
+
+  bool startOfPattern = true;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t tag = 0;
+    if (!readU32(data, word))
+      return false;
+    TokenKind kind = static_cast<TokenKind>(word & 0xff);
+    if (kind > End)
+      return false;
+    if (kind == End && !readU32(data, tag))
+      return false;
+
+    if (startOfPattern)
+      starts.push_back(tokens.size());
+    tokens.push_back({kind, static_cast<unsigned char>(word >> 8), tag});
+    startOfPattern = kind == End;
+    if (kind == End)
+      allTags |= tag;
+  }
+
+  states.clear();
+  stateIds.clear();
+  return startOfPattern;
+}
@@ -0,0 +1,91 @@
+//===- TAUGlobMatcher.h - Combined wildcard matcher -------------*- C++ -*-===//
+//
+// Matches a name against all the wildcard entries of the selective
+// instrumentation file at once. The entries are compiled into a single NFA
+// whose subset construction is built lazily and cached, so that after a short
+// warm-up every name is checked in one linear pass over its characters
+// without allocating.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TAU_GLOBMATCHER_H
+#define TAU_GLOBMATCHER_H
+
+#include <array>
+#include <map>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+class TAUGlobMatcher {
+public:
+  /*!
+   * Add a pattern to the matcher. In the pattern, \p star matches any
+   * sequence of characters and \p ques (if not 0) matches at most one
+   * character; every other character is taken literally.
+   *
+   * \param tag Or-ed into the result of match() when the pattern matches
+   */
+  void addPattern(llvm::StringRef pattern, unsigned tag, char star,
+                  char ques = 0);
+
+  /*!
+   * Return the union of the tags of all the patterns matching the whole
+   * \p name, or 0 if none does.
+   */
+  unsigned match(llvm::StringRef name);
+
+  /// Union of the tags of all the patterns added so far.
+  unsigned tags() const { return allTags; }
+
+  bool empty() const { return tokens.empty(); }
+
+  /// Append the compiled patterns to \p os, for the binary list cache.
+  void write(llvm::raw_ostream &os) const;
+
+  /*!
+   * Add the patterns written by write() at the start of \p data, and drop
+   * them from \p data. Returns false if they are malformed.
+   */
+  bool read(llvm::StringRef &data);
+
+private:
+  enum TokenKind : unsigned char { Literal, Star, Ques, End };
+
+  struct Token {
+    TokenKind kind;
+    unsigned char c; // only for Literal
+    unsigned tag;    // only for End
+  };
+
+  // A DFA state is a set of positions in `tokens`. Transitions are filled in
+  // on first use; -1 means "not computed yet".
+  struct State {
+    std::vector<unsigned> positions;
+    unsigned tag;
+    std::array<int, 256> next;
+  };
+
+  static const unsigned StartState = 0;
+  static const unsigned DeadState = 1;
+  // Bound on the memory used by the cached DFA (1KB per state)
+  static const unsigned MaxStates = 4096;
+
+  std::vector<Token> tokens; // all the patterns, each one closed by End
+  std::vector<unsigned> starts;
+  std::vector<State> states;
+  std::map<std::vector<unsigned>, unsigned> stateIds;
+  unsigned allTags = 0;
+
+  void closure(std::vector<unsigned> &positions) const;
+  void advance(const std::vector<unsigned> &from, unsigned char c,
+               std::vector<unsigned> &to) const;
+  unsigned acceptTag(const std::vector<unsigned> &positions) const;
+  int intern(std::vector<unsigned> &&positions);
+  void reset();
+  int step(unsigned state, unsigned char c);
+  unsigned matchSlow(llvm::StringRef name) const;
+};
+
+#endif // TAU_GLOBMATCHER_H
@@ -12,20 +12,37 @@
 //
 //===----------------------------------------------------------------------===//
 
-#include <fstream>
 #include <regex>
+#include <sstream>
 
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
 
 #include <clang/Basic/SourceManager.h>
 #include <llvm/IR/DebugInfoMetadata.h>
@@ -35,7 +52,9 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
+#include "TAUBinaryIO.h"
 #include "TAUInstrument.h"
+#include "TAUMangler.h"
 
 #ifdef TAU_PROF_CXX
 #include <cxxabi.h>
@@ -57,6 +76,20 @@
 #define TAU_BEGIN_FILE_EXCLUDE_LIST_NAME "BEGIN_FILE_EXCLUDE_LIST"
 #define TAU_END_FILE_EXCLUDE_LIST_NAME "END_FILE_EXCLUDE_LIST"
 
+#define TAU_LIST_CACHE_MAGIC "TAUL"
+#define TAU_LIST_CACHE_VERSION 1
+
+/* Fill the handles (and register the throttle flags and the ids) before the
+ * constructors of the program with the default priority run, since they may
+ * call instrumented functions. Priorities up to
+ * 100 are reserved to the implementation. */
+#define TAU_HANDLES_CTOR_PRIORITY 101
+
+/* Section describing the functions given ids, with -tau-probe-backend=tau-ids.
+ * A valid C identifier, so that the linker defines __start_ and __stop_
+ * symbols around it. */
+#define TAU_FUNCTIONS_SECTION "tau_functions"
+
 #define TAU_REGEX_STAR '#'
 #define TAU_REGEX_FILE_STAR '*'
 #define TAU_REGEX_FILE_QUES '?'
@@ -69,17 +102,53 @@ using namespace llvm;
 
 namespace {
 
+/*!
+ *  Where the progress messages go: the standard error with -tau-verbose,
+ *  nowhere otherwise.
+ */
+static raw_ostream &verbose() { return TauVerbose ? errs() : nulls(); }
+
+/*!
+ *  Timers of the steps of the instrumentation, printed at exit with
+ *  -tau-time-report (to the file of -info-output-file, if given). The steps
+ *  do not overlap.
+ */
+struct TAUTimers {
+  TimerGroup group{"tau-profile", "TAU instrumentation"};
+  Timer loadList{"load-list", "Read the input file or the list cache",
+                 group};
+  Timer demangle{"demangle", "Demangle the function names", group};
+  Timer match{"match", "Look up the names and files in the lists", group};
+  Timer regex{"regex", "Match -tau-regex and -tau-iregex", group};
+  Timer cost{"cost", "Static cost for -tau-min-cost", group};
+  Timer instrument{"instrument", "Insert the probes", group};
+  Timer loopProbes{"loop-probes", "Drop or hoist the probes in loops", group};
+};
+
+static ManagedStatic<TAUTimers> Timers;
+
+/*!
+ *  The given timer, for a TimeRegion, or nullptr if the timers are off.
+ */
+static Timer *timer(Timer TAUTimers::*which) {
+  return TauTimeReport ? &(*Timers.*which) : nullptr;
+}
+
 // Demangling technique borrowed/modified from
 // https://github.com/eklitzke/demangle/blob/master/src/demangle.cc
-static StringRef normalize_name(StringRef mangled_name) {
+// The demangled name is copied in the given allocator and the buffer returned
+// by the demangler is released.
+static StringRef normalize_name(StringRef mangled_name,
+                                BumpPtrAllocator &alloc) {
 #ifdef TAU_PROF_CXX
   int status = 0;
 
-  const char *str = abi::__cxa_demangle(mangled_name.begin(), 0, 0, &status);
-  StringRef realname{str};
+  char *str = abi::__cxa_demangle(mangled_name.begin(), 0, 0, &status);
+  StringRef realname{};
 
   switch (status) {
   case 0:
+    realname = StringRef(str).copy(alloc);
     break;
   case -1:
     // errs() << "FAIL: failed to allocate memory while demangling "
@@ -95,12 +164,286 @@ static StringRef normalize_name(StringRef mangled_name) {
     break;
   }
 
+  free(str);
   return realname;
 #else
   return mangled_name;
 #endif
 }
 
+/* How a profiling function uses its pointer argument */
+enum class ProbeArg {
+  Name,     // reads the name it is passed, and does not keep it
+  KeptName, // reads the name, and may keep it (to build a handle)
+  Handle,   // an opaque handle pointing to the runtime's own memory
+  Id        // an integer identifying the function
+};
+
+/*!
+ *  Add the attributes of the -tau-probe-attrs profile to the declaration of
+ *  a profiling function.
+ */
+static void setProbeAttributes(TAUInstrument::ProbeCallee probe,
+                               ProbeArg arg) {
+#if (LLVM_VERSION_MAJOR <= 8)
+  Value *callee = probe;
+#else
+  Value *callee = probe.getCallee();
+#endif
+  // A declaration of another type already existed
+  auto *func = dyn_cast<Function>(callee->stripPointerCasts());
+  if (!func || TauProbeAttrs == ProbeAttrs::None)
+    return;
+
+  func->setDoesNotThrow();
+  if (TauProbeAttrs == ProbeAttrs::NoUnwind)
+    return;
+
+#if (LLVM_VERSION_MAJOR >= 11)
+  func->setWillReturn();
+#endif
+#if (LLVM_VERSION_MAJOR >= 14)
+  func->addFnAttr(Attribute::NoCallback);
+#endif
+  if (arg == ProbeArg::Handle || arg == ProbeArg::Id) {
+    func->setOnlyAccessesInaccessibleMemory();
+  } else {
+    func->setOnlyAccessesInaccessibleMemOrArgMem();
+    func->addParamAttr(0, Attribute::ReadOnly);
+    if (arg == ProbeArg::Name)
+      func->addParamAttr(0, Attribute::NoCapture);
+  }
+}
+
+/*!
+ *  The first instruction of the entry block of the given function that is
+ *  not an alloca. The entry block can be split there without turning its
+ *  allocas into dynamic ones.
+ */
+static Instruction *firstNonAlloca(Function &func) {
+  BasicBlock::iterator it = func.getEntryBlock().begin();
+  while (isa<AllocaInst>(*it))
+    ++it;
+  return &*it;
+}
+
+/*!
+ *  The name of a rule in the reports.
+ */
+static const char *ruleName(Rule rule) {
+  switch (rule) {
+  case Rule::NotListed:
+    return "not-listed";
+  case Rule::NoName:
+    return "no-name";
+  case Rule::FileFilter:
+    return "file-filter";
+  case Rule::ExactInclude:
+    return "exact-include";
+  case Rule::WildcardInclude:
+    return "wildcard-include";
+  case Rule::Regex:
+    return "regex";
+  case Rule::ExactExclude:
+    return "exact-exclude";
+  case Rule::WildcardExclude:
+    return "wildcard-exclude";
+  case Rule::MinCost:
+    return "min-cost";
+  }
+  llvm_unreachable("unknown rule");
+}
+
+/*!
+ *  Fill the remark reporting a decision.
+ */
+template <typename RemarkT>
+static RemarkT &describeDecision(RemarkT &remark, StringRef name,
+                                 StringRef mangled, StringRef file,
+                                 const Decision &decision) {
+  remark << ore::NV("Name", name)
+         << (decision.instrument ? " instrumented" : " not instrumented")
+         << " (" << ore::NV("Rule", ruleName(decision.rule));
+  if (!decision.reason.empty())
+    remark << ": " << ore::NV("Reason", decision.reason);
+  remark << ")" << ore::setExtraArgs() << ore::NV("Mangled", mangled)
+         << ore::NV("File", file);
+  return remark;
+}
+
+/*!
+ *  Static estimate of the work done by one call of the given function, in
+ *  instructions: the instructions of its body, plus -tau-call-cost for each
+ *  call and -tau-loop-cost for each loop (back edge) it contains. This is
+ *  measured on the IR at the extension point of the pass.
+ */
+static unsigned staticCost(Function &func) {
+  unsigned cost = 0;
+  for (Instruction &inst : instructions(func)) {
+    if (isa<DbgInfoIntrinsic>(inst))
+      continue;
+    ++cost;
+    if ((isa<CallInst>(inst) || isa<InvokeInst>(inst)) &&
+        !isa<IntrinsicInst>(inst))
+      cost += TauCallCost;
+  }
+
+  SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 8> backedges;
+  FindFunctionBackedges(func, backedges);
+  return cost + TauLoopCost * backedges.size();
+}
+
+/*!
+ *  The state the guards of the probes are computed from. The globals holding
+ *  it are marked with `!tau.guard !{!"<kind>"}`, so that the loop pass tells
+ *  them from the globals of the program.
+ */
+enum class GuardState { None, EnableFlag, Countdown, ThrottleFlag, Depth };
+
+static const char *const GuardStateKind = "tau.guard";
+
+static void markGuardState(GlobalVariable &global, GuardState state) {
+  StringRef kind;
+  switch (state) {
+  case GuardState::EnableFlag:
+    kind = "enable";
+    break;
+  case GuardState::Countdown:
+    kind = "countdown";
+    break;
+  case GuardState::ThrottleFlag:
+    kind = "throttle";
+    break;
+  case GuardState::Depth:
+    kind = "depth";
+    break;
+  case GuardState::None:
+    return;
+  }
+  auto &context = global.getContext();
+  global.setMetadata(GuardStateKind,
+                     MDNode::get(context, MDString::get(context, kind)));
+}
+
+/*!
+ *  The guard state held by the given global, if it is one marked by
+ *  markGuardState().
+ */
+static GuardState guardStateOf(Value *ptr) {
+  auto *global = dyn_cast<GlobalVariable>(ptr->stripPointerCasts());
+  MDNode *mark = global ? global->getMetadata(GuardStateKind) : nullptr;
+  auto *kind = mark && mark->getNumOperands() == 1
+                   ? dyn_cast<MDString>(mark->getOperand(0))
+                   : nullptr;
+  if (!kind)
+    return GuardState::None;
+  return StringSwitch<GuardState>(kind->getString())
+      .Case("enable", GuardState::EnableFlag)
+      .Case("countdown", GuardState::Countdown)
+      .Case("throttle", GuardState::ThrottleFlag)
+      .Case("depth", GuardState::Depth)
+      .Default(GuardState::None);
+}
+
+/*!
+ *  Load the enable flag at the given point, declaring it the first time. The
+ *  module gets a weak definition of the flag, initially 0, which the
+ *  definition from the runtime or the program takes precedence over.
+ *
+ * \return Whether the flag is set
+ */
+static Value *loadEnableFlag(Module &module, Instruction *insertPt) {
+  auto *flagTy = Type::getInt8Ty(module.getContext());
+  GlobalVariable *enableFlag = module.getGlobalVariable(TauEnableFlag);
+  if (!enableFlag) {
+    enableFlag = new GlobalVariable(module, flagTy, /*isConstant=*/false,
+                                    GlobalValue::WeakAnyLinkage,
+                                    ConstantInt::get(flagTy, 0), TauEnableFlag);
+  }
+  markGuardState(*enableFlag, GuardState::EnableFlag);
+
+  // The flag may be changed by another thread: a relaxed atomic load is as
+  // cheap as a plain one, but is not assumed to be loop invariant
+  IRBuilder<> builder(insertPt);
+  LoadInst *flag = builder.CreateLoad(flagTy, enableFlag);
+  flag->setAtomic(AtomicOrdering::Monotonic);
+  flag->setAlignment(Align(1));
+  return builder.CreateIsNotNull(flag);
+}
+
+/*!
+ *  Count the calls of the given function down in a thread-local counter, and
+ *  tell whether this one is sampled: the first one, then one in
+ *  -tau-sample-period. The counter is 0 until the first call.
+ *
+ *    %n = load i32, i32* @f.tau_countdown
+ *    %sampled = icmp ult i32 %n, 2
+ *    %dec = add i32 %n, -1
+ *    %next = select i1 %sampled, i32 <period>, i32 %dec
+ *    store i32 %next, i32* @f.tau_countdown
+ *
+ * \param count Set to the value of the counter, 0 on the first call
+ * \return Whether the call is sampled
+ */
+static Value *countDownSample(Function &func, Instruction *insertPt,
+                              Value *&count) {
+  auto *countTy = Type::getInt32Ty(func.getContext());
+  auto *countdown = new GlobalVariable(
+      *func.getParent(), countTy, /*isConstant=*/false,
+      GlobalValue::PrivateLinkage, ConstantInt::get(countTy, 0),
+      func.getName() + ".tau_countdown", /*InsertBefore=*/nullptr,
+      GlobalValue::GeneralDynamicTLSModel);
+  markGuardState(*countdown, GuardState::Countdown);
+
+  IRBuilder<> builder(insertPt);
+  count = builder.CreateLoad(countTy, countdown);
+  Value *sampled = builder.CreateICmpULT(count, ConstantInt::get(countTy, 2));
+  Value *next = builder.CreateSelect(
+      sampled, ConstantInt::get(countTy, TauSamplePeriod),
+      builder.CreateAdd(count, ConstantInt::getAllOnesValue(countTy)));
+  builder.CreateStore(next, countdown);
+  return sampled;
+}
+
+/*!
+ *  Count the running activations of the given function in a thread-local
+ *  counter. Each return must store the value it had on entry back, which
+ *  also repairs it after activations left without returning (longjmp,
+ *  exceptions):
+ *
+ *    %depth = load i32, i32* @f.tau_depth
+ *    %inc = add i32 %depth, 1
+ *    store i32 %inc, i32* @f.tau_depth
+ *    ...
+ *    store i32 %depth, i32* @f.tau_depth
+ *    ret
+ *
+ * \return The number of activations running before this one
+ */
+static LoadInst *enterActivation(Function &func, Instruction *insertPt) {
+  auto *depthTy = Type::getInt32Ty(func.getContext());
+  auto *counter = new GlobalVariable(
+      *func.getParent(), depthTy, /*isConstant=*/false,
+      GlobalValue::PrivateLinkage, ConstantInt::get(depthTy, 0),
+      func.getName() + ".tau_depth", /*InsertBefore=*/nullptr,
+      GlobalValue::GeneralDynamicTLSModel);
+  markGuardState(*counter, GuardState::Depth);
+
+  IRBuilder<> builder(insertPt);
+  LoadInst *depth = builder.CreateLoad(depthTy, counter);
+  builder.CreateStore(builder.CreateAdd(depth, ConstantInt::get(depthTy, 1)),
+                      counter);
+  return depth;
+}
+
+/*!
+ *  Branch weights for the unlikely side of a branch, such as the calls that
+ *  only happen once or while profiling is disabled.
+ */
+static MDNode *coldBranchWeights(LLVMContext &context) {
+  return MDBuilder(context).createBranchWeights(1, 1 << 20);
+}
+
 /*!
  *  Find/declare a function taking a single `i8*` argument with a void return
  *  type suitable for making a call to in IR. This is used to get references
@@ -130,24 +473,181 @@ static FunctionCallee getVoidFunc(StringRef funcname, LLVMContext &context,
   FunctionType *funcTy = FunctionType::get(retTy, paramTys, false);
   return module->getOrInsertFunction(funcname, funcTy);
 }
+
+/*!
+ *  Return the demangled name of the given symbol, demangling it only the
+ *  first time it is seen. An empty name is returned for symbols that cannot
+ *  be demangled.
+ */
+StringRef DemangleCache::get(StringRef mangled) {
+#ifdef TAU_PROF_CXX
+  auto it = names.find(mangled);
+  if (it != names.end())
+    return it->second;
+
+  TimeRegion region(timer(&TAUTimers::demangle));
+  StringRef realname = normalize_name(mangled, names.getAllocator());
+  names.try_emplace(mangled, realname);
+  return realname;
+#else
+  /* C names are used as they are: nothing to cache */
+  return normalize_name(mangled, names.getAllocator());
+#endif
+}
+
+void DemangleCache::clear() {
+  names.clear();
+  names.getAllocator().Reset();
+}
+
+/*!
+ *  Lay out the table of the given names and add it to the module. Sorted by
+ *  their reversed characters, the names ending another one come just
+ *  before a name they end, and are laid out after it.
+ */
+void ProbeNameTable::build(Module &module, ArrayRef<StringRef> names) {
+  SmallVector<StringRef, 32> sorted;
+  for (StringRef name : names)
+    if (offsets.try_emplace(name, 0).second)
+      sorted.push_back(name);
+  if (sorted.empty())
+    return;
+  llvm::sort(sorted, [](StringRef a, StringRef b) {
+    return std::lexicographical_compare(
+        std::make_reverse_iterator(a.end()),
+        std::make_reverse_iterator(a.begin()),
+        std::make_reverse_iterator(b.end()),
+        std::make_reverse_iterator(b.begin()));
+  });
+
+  std::string packed;
+  for (size_t i = sorted.size(); i-- > 0;) {
+    StringRef name = sorted[i];
+    if (i + 1 < sorted.size() && sorted[i + 1].endswith(name)) {
+      StringRef longer = sorted[i + 1];
+      offsets[name] = offsets[longer] + longer.size() - name.size();
+      continue;
+    }
+    offsets[name] = packed.size();
+    packed += name;
+    packed += '\0';
+  }
+
+  auto *array = ConstantDataArray::getString(module.getContext(), packed,
+                                             /*AddNull=*/false);
+  table = new GlobalVariable(module, array->getType(), /*isConstant=*/true,
+                             GlobalValue::PrivateLinkage, array, "tau.names");
+  table->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  table->setAlignment(Align(1));
+}
+
+/*!
+ *  The given name in the table:
+ *
+ *    getelementptr inbounds ([N x i8], [N x i8]* @tau.names, i64 0, i64 off)
+ *
+ * \return The address of the name, or nullptr if it is not in the table
+ */
+Constant *ProbeNameTable::get(StringRef name) const {
+  auto it = offsets.find(name);
+  if (!table || it == offsets.end())
+    return nullptr;
+  auto *offsetTy = Type::getInt64Ty(table->getContext());
+  Constant *indices[] = {ConstantInt::get(offsetTy, 0),
+                         ConstantInt::get(offsetTy, it->second)};
+  return ConstantExpr::getInBoundsGetElementPtr(table->getValueType(), table,
+                                                indices);
+}
+
+void ProbeNameTable::clear() {
+  table = nullptr;
+  offsets.clear();
+}
 } // namespace
 
+/*!
+ *  Start working on the given module, unless it is the current one already.
+ */
+void TAUInstrument::enterModule(Module &module) {
+  if (&module == currentModule)
+    return;
+  leaveModule();
+  currentModule = &module;
+}
+
+/*!
+ *  Release everything that was only valid for the current module.
+ */
+void TAUInstrument::leaveModule() {
+  demangled.clear();
+  fileDecisions.clear();
+  probeNames.clear();
+  probes->leaveModule();
+  registerThrottle = false;
+  throttleFlags.clear();
+  chosenFunctions.clear();
+  currentModule = nullptr;
+}
+
+/*!
+ *  The demangled name of the given function, which must belong to the
+ *  current module.
+ */
+StringRef TAUInstrument::prettyName(Function &func) {
+  return demangled.get(func.getName());
+}
+
+/*!
+ *  Whether any function at all may be instrumented.
+ */
+bool TAUInstrument::mayInstrument() const {
+  return exactNames.count(FuncInclude) || (funcsPatterns.tags() & IncludeTag) ||
+         !TauRegex.empty() || !TauIRegex.empty();
+}
+
+/*!
+ *  Whether the backend or the throttle flags, registered per module, need
+ *  the module pass, which is then reported as an error from the function
+ *  pass.
+ */
+bool TAUInstrument::needsModulePass(Function &func) {
+  const char *option = probes->needsModulePass()
+                           ? "-tau-probe-backend=inline-counters"
+                           : TauThrottle ? "-tau-throttle" : nullptr;
+  if (!option)
+    return false;
+  func.getContext().emitError(
+      Twine(option) +
+      " needs the module pass: run tau-prof on modules, not on functions");
+  return true;
+}
+
+/*!
+ *  Whether sampling is asked for with a backend whose calls cannot be
+ *  sampled, which is reported as an error rather than ignored.
+ */
+bool TAUInstrument::cannotSample(LLVMContext &context) {
+  if (TauSamplePeriod <= 1 || probes->canSample())
+    return false;
+  context.emitError("-tau-sample-period needs the sampled start probes of "
+                    "-tau-probe-backend=tau-names or tau-handles");
+  return true;
+}
+
 /*!
  *  The FunctionPass interface method, called on each function produced from
  *  the original source.
  */
 bool TAUInstrument::runOnFunction(Function &func) {
-  errs() << "runonfunction started\n";
   bool modified = false;
 
+  if (cannotSample(func.getContext()) || needsModulePass(func))
+    return false;
+
+  enterModule(*func.getParent());
   bool instru = maybeSaveForProfiling(func);
 
   if (TauDryRun) {
-    // TODO: Fix this.
-    // getName() doesn't seem to give a properly mangled name
-    /*  auto pretty_name = normalize_name(func.getName());
-    if(pretty_name.empty()) pretty_name = func.getName();
-    errs() << pretty_name << " would be instrumented\n";*/
     return false; // Dry run does not modify anything
   }
   if (instru) {
@@ -157,89 +657,351 @@ bool TAUInstrument::runOnFunction(Function &func) {
 }
 
 /*!
- *  Inspect the given CallInst and, if it should be profiled, add it
- *  and its recognized name the given vector.
+ *  Choose the functions of the module to instrument, and prepare the module
+ *  for their probes: the table of their names, and what the backend needs.
+ *  Modules in which nothing can be instrumented return before looking at
+ *  their functions.
+ *
+ * \return Whether any function was chosen
+ */
+bool TAUInstrument::prepareModule(Module &module,
+                                  SmallVectorImpl<Function *> &chosen) {
+  if (!mayInstrument() || cannotSample(module.getContext()))
+    return false;
+
+  /* Without debug information, all the functions are attributed to the main
+   * source file: if it is excluded, so is the whole module. With debug
+   * information, functions defined in headers may still be included. */
+  if (module.debug_compile_units().empty() &&
+      !fileFits(module.getSourceFileName())) {
+    verbose() << "Skip the module of " << module.getSourceFileName()
+              << ": file excluded\n";
+    return false;
+  }
+
+  registerThrottle = TauThrottle;
+
+  // The functions are chosen first, so that the backend can size its tables
+  for (Function &func : module) {
+    if (func.isDeclaration())
+      continue;
+    if (maybeSaveForProfiling(func) && !TauDryRun)
+      chosen.push_back(&func);
+  }
+  if (chosen.empty())
+    return false;
+
+  SmallVector<StringRef, 32> names;
+  for (Function *func : chosen)
+    names.push_back(prettyName(*func));
+  probeNames.build(module, names);
+
+  probes->prepareModule(module, chosen.size());
+  return true;
+}
+
+/*!
+ *  Add the tables and constructors of the instrumented functions.
+ */
+void TAUInstrument::finishModule(Module &module) {
+  probes->finishModule(module);
+  addThrottleConstructor(module);
+}
+
+/*!
+ *  The ModulePass interface method.
+ */
+bool TAUInstrument::runOnModule(Module &module) {
+  bool modified = false;
+
+  enterModule(module);
+  SmallVector<Function *, 32> chosen;
+  if (prepareModule(module, chosen)) {
+    for (Function *func : chosen)
+      modified |= addInstrumentation(*func);
+    finishModule(module);
+  }
+  leaveModule();
+  return modified;
+}
+
+/*!
+ *  Prepare the module for the function pass run after inlining, as the
+ *  module pass does, and keep the names of the functions chosen.
+ *
+ * \return Whether any function was chosen
+ */
+bool TAUInstrument::prepareAfterInlining(Module &module) {
+  leaveModule();
+  enterModule(module);
+  SmallVector<Function *, 32> chosen;
+  if (!prepareModule(module, chosen))
+    return false;
+  for (Function *func : chosen)
+    chosenFunctions.insert(func->getName());
+  probes->finishLater();
+  return true;
+}
+
+/*!
+ *  The function pass run after inlining, on the functions chosen by
+ *  prepareAfterInlining(). The module is finished by finishAfterInlining()
+ *  once all of them are instrumented.
  *
- * \param call The CallInst to inspect
- * \param calls Vector to add to, if the CallInst should be profiled
+ *  Before LLVM 15, no module extension point runs the prepare pass before
+ *  VectorizerStart: the module is then prepared on its first function. This
+ *  only adds globals and declarations, which the adaptor running the pass
+ *  does not visit.
+ */
+bool TAUInstrument::runAfterInlining(Function &func) {
+  Module &module = *func.getParent();
+  if (&module != currentModule)
+    prepareAfterInlining(module);
+  return chosenFunctions.count(func.getName()) && addInstrumentation(func);
+}
+
+/*!
+ *  Finish the module the function pass instrumented after inlining. The
+ *  optimizer may have deleted functions and globals in between: the
+ *  backends and the throttle flags skip them.
+ */
+void TAUInstrument::finishAfterInlining(Module &module) {
+  if (&module == currentModule && !chosenFunctions.empty())
+    finishModule(module);
+  leaveModule();
+}
+
+/*!
+ *  Inspect the given function and tell whether it should be profiled.
+ *
+ * \param call The function to inspect
  */
 bool TAUInstrument::maybeSaveForProfiling(Function &call) {
-  StringRef callName = call.getName();
-  std::string filename;
-
-  auto pi = inst_begin(&call);
-  Instruction *instruction = &*pi;
-  const llvm::DebugLoc &debugInfo = instruction->getDebugLoc();
-  if (NULL != debugInfo) { /* if compiled with -g */
-    filename = debugInfo->getFilename().str();
+  Decision decision = functionFileFits(call)
+                          ? functionFits(call)
+                          : Decision{false, Rule::FileFilter, ""};
+  reportDecision(call, decision);
+  return decision.instrument;
+}
+
+/*!
+ *  Report the decision taken for a function as an optimization remark of
+ *  tau-profile, with the demangled and mangled names, the file, the rule and
+ *  its details as arguments. The remarks can be saved in a file with
+ *  -fsave-optimization-record (-pass-remarks-output with opt) and merged with
+ *  tau-decisions. They are only built if remarks are enabled.
+ *
+ *  The functions that are instrumented or explicitly skipped are also
+ *  printed with -tau-dry-run, and all of them with -tau-verbose.
+ */
+void TAUInstrument::reportDecision(Function &func, const Decision &decision) {
+  bool print = TauVerbose || (TauDryRun && decision.rule != Rule::NotListed);
+  if (!print &&
+      !OptimizationRemarkEmitter::allowExtraAnalysis(func, DEBUG_TYPE))
+    return;
+
+  StringRef name = decision.rule == Rule::NoName ? func.getName()
+                                                 : prettyName(func);
+  StringRef file = func.getParent()->getSourceFileName();
+  if (DISubprogram *subprogram = func.getSubprogram())
+    file = subprogram->getFilename();
+
+  if (print) {
+    errs() << file << ": " << name << ": "
+           << (decision.instrument ? "instrument" : "skip") << " ("
+           << ruleName(decision.rule);
+    if (!decision.reason.empty())
+      errs() << ", " << decision.reason;
+    errs() << ")\n";
+  }
+
+  OptimizationRemarkEmitter remarks(&func);
+  if (decision.instrument) {
+    OptimizationRemark remark(DEBUG_TYPE, "Instrumented", &func);
+    remarks.emit(describeDecision(remark, name, func.getName(), file,
+                                  decision));
+  } else if (decision.rule == Rule::NotListed) {
+    OptimizationRemarkAnalysis remark(DEBUG_TYPE, "NotSelected", &func);
+    remarks.emit(describeDecision(remark, name, func.getName(), file,
+                                  decision));
   } else {
-    filename = call.getParent()->getSourceFileName();
+    OptimizationRemarkMissed remark(DEBUG_TYPE, "NotInstrumented", &func);
+    remarks.emit(describeDecision(remark, name, func.getName(), file,
+                                  decision));
   }
+}
 
-  StringRef prettycallName = normalize_name(callName);
+/*!
+ *  Apply the file filters to the file the function is defined in. This is
+ *  the file of its debug information if compiled with -g, the main source
+ *  file of the module otherwise. The decision is computed once per file.
+ */
+bool TAUInstrument::functionFileFits(Function &func) {
+  const DIFile *file = nullptr;
+  if (DISubprogram *subprogram = func.getSubprogram())
+    file = subprogram->getFile();
+
+  auto it = fileDecisions.try_emplace(file, false);
+  if (it.second) {
+    it.first->second =
+        fileFits(file ? file->getFilename()
+                      : StringRef(func.getParent()->getSourceFileName()));
+  }
+  return it.first->second;
+}
 
+/*!
+ *  Apply the file filters to the given file name.
+ */
+bool TAUInstrument::fileFits(StringRef filename) {
+  TimeRegion region(timer(&TAUTimers::match));
   /* This big test was explanded for readability */
   bool instrumentHere = false;
-  // errs() << "Name " << prettycallName << " full " << callName << "\n";
-
-  if (prettycallName == "")
-    return false;
 
   /* Are we including or excluding some files? */
-  if ((filesIncl.size() + filesInclRegex.size() + filesExcl.size() +
-           filesExclRegex.size() ==
-       0)) {
+  if ((exactNames.count(FileInclude) + exactNames.count(FileExclude) == 0) &&
+      filesPatterns.empty()) {
     instrumentHere = true;
   } else {
     /* Yes: are we in a file where we are instrumenting? */
-    if (((filesIncl.size() + filesInclRegex.size() ==
-          0) // do not specify a list of files to instrument -> instrument them
-             // all, except the excluded ones
-         || (filesIncl.count(filename) > 0 ||
-             regexFits(filename, filesInclRegex))) &&
-        !(filesExcl.count(filename) || regexFits(filename, filesExclRegex))) {
+    unsigned fileKinds = exactNames.lookup(filename);
+    unsigned fileTags = filesPatterns.match(filename);
+    bool inclList = exactNames.count(FileInclude) > 0 ||
+                    (filesPatterns.tags() & IncludeTag);
+    if ((!inclList // do not specify a list of files to instrument -> instrument
+                   // them all, except the excluded ones
+         || ((fileKinds & FileInclude) || (fileTags & IncludeTag))) &&
+        !((fileKinds & FileExclude) || (fileTags & ExcludeTag))) {
       instrumentHere = true;
     }
   }
-  if (instrumentHere &&
-      (funcsOfInterest.count(prettycallName) > 0 ||
-       regexFits(prettycallName, funcsOfInterestRegex, true)
-       //	      || funcsOfInterest.count(calleeAndParent) > 0
-       ) &&
-      !(funcsExcl.count(prettycallName) ||
-        regexFits(prettycallName, funcsExclRegex, true))) {
-    errs() << "Instrument " << prettycallName << "\n";
+  return instrumentHere;
+}
+
+/*!
+ *  Apply the function lists and the regular expressions to the given
+ *  function. Exclusions take precedence over inclusions.
+ */
+Decision TAUInstrument::functionFits(Function &call) {
+  /* Most functions can be rejected without being demangled */
+  Rule rejection;
+  if (mangledLookupRejects(call, rejection))
+    return {false, rejection, "mangled name"};
+
+  StringRef prettycallName = prettyName(call);
+  // errs() << "Name " << prettycallName << " full " << call.getName()
+  //        << "\n";
+
+  if (prettycallName == "")
+    return {false, Rule::NoName, ""};
+
+  /* A single pass over the name checks it against all the wildcard entries */
+  unsigned funcKinds, funcTags;
+  {
+    TimeRegion region(timer(&TAUTimers::match));
+    funcKinds = exactNames.lookup(prettycallName);
+    funcTags = funcsPatterns.match(prettycallName);
+  }
+  if (funcKinds & FuncExclude)
+    return {false, Rule::ExactExclude, ""};
+  if (funcTags & ExcludeTag)
+    return {false, Rule::WildcardExclude, ""};
+
+  Rule rule;
+  if (funcKinds & FuncInclude)
+    rule = Rule::ExactInclude;
+  else if (funcTags & IncludeTag)
+    rule = Rule::WildcardInclude;
+  else if (cliRegexFits(prettycallName))
+    rule = Rule::Regex;
+  else
+    return {false, Rule::NotListed, ""};
+
+  /* Functions matched by a wildcard or a regex may be too small for the
+   * probes to be worth it. Exact names are always instrumented. */
+  if (TauMinCost && rule != Rule::ExactInclude) {
+    unsigned cost;
+    {
+      TimeRegion region(timer(&TAUTimers::cost));
+      cost = staticCost(call);
+    }
+    if (cost < TauMinCost) {
+      return {false, Rule::MinCost,
+              "static cost " + std::to_string(cost) + " below " +
+                  std::to_string(TauMinCost)};
+    }
+  }
+  return {true, rule, ""};
+}
+
+/*!
+ * With -tau-mangled-lookup, tell from the mangled name alone whether the
+ * function is certainly not instrumented: it is explicitly excluded, or the
+ * include list only has exact names and none of them is this function. The
+ * other functions still go through the demangled name, as do the functions
+ * with local linkage: the entries are mangled as external functions, while
+ * theirs have a local prefix (_ZL) or a suffix added by the optimizations.
+ */
+bool TAUInstrument::mangledLookupRejects(Function &func, Rule &rule) {
+#ifdef TAU_PROF_CXX
+  if (!TauMangledLookup)
+    return false;
+
+  TimeRegion region(timer(&TAUTimers::match));
+  unsigned kinds = exactNames.lookup(func.getName());
+  if (kinds & FuncExcludeMangled) {
+    rule = Rule::ExactExclude;
     return true;
   }
+
+  bool onlyExactIncludes = funcsOfInterestUnmangled == 0 &&
+                           !(funcsPatterns.tags() & IncludeTag) &&
+                           TauRegex.empty() && TauIRegex.empty();
+  rule = Rule::NotListed;
+  return onlyExactIncludes && !func.hasLocalLinkage() &&
+         !(kinds & FuncIncludeMangled);
+#else
   return false;
+#endif
+}
+
+/*!
+ * Add the mangled form of an exact function name of the input file to the
+ * index of the given list. The mangled name is only trusted if it demangles
+ * back to the very same name.
+ */
+void TAUInstrument::addMangledName(StringRef funcName, unsigned tag) {
+#ifdef TAU_PROF_CXX
+  unsigned kind = tag == IncludeTag ? FuncIncludeMangled : FuncExcludeMangled;
+  unsigned &unmangled =
+      tag == IncludeTag ? funcsOfInterestUnmangled : funcsExclUnmangled;
+
+  std::string mangled = mangleFunctionPrototype(funcName);
+  BumpPtrAllocator alloc;
+  if (!mangled.empty() && normalize_name(mangled, alloc) == funcName) {
+    exactNames.insert(mangled, kind);
+  } else {
+    ++unmangled;
+  }
+#endif
 }
 
 /*!
  * This function determines if the current function name (parameter name)
- * matches a regular expression. Regular expressions can be passed either
- * on the command-line (historical behavior) or in the input file. The latter
- * use a specific wildcard.
- */
-bool TAUInstrument::regexFits(const StringRef &name,
-                              std::vector<std::regex> &regexList,
-                              bool cli /*= false*/) {
-  /* Regex coming from the command-line */
-  bool match = false, imatch = false;
-  if (cli) {
-    if (!TauRegex.empty())
-      match = std::regex_search(name.str(), rex);
-    if (!TauIRegex.empty())
-      imatch = std::regex_search(name.str(), irex);
-  }
-
-  if (match || imatch)
-    return true;
+ * matches one of the regular expressions passed on the command line
+ * (historical behavior). The wildcard entries of the input file are handled
+ * by the combined matchers instead.
+ */
+bool TAUInstrument::cliRegexFits(StringRef name) {
+  if (TauRegex.empty() && TauIRegex.empty())
+    return false;
 
-  for (auto &r : regexList) {
-    match = std::regex_match(name.str(), r);
-    if (match)
-      return true;
-  }
+  TimeRegion region(timer(&TAUTimers::regex));
+  /* Search the name in place rather than in a copy */
+  if (!TauRegex.empty() && std::regex_search(name.begin(), name.end(), rex))
+    return true;
+  if (!TauIRegex.empty() && std::regex_search(name.begin(), name.end(), irex))
+    return true;
 
   return false;
 }
@@ -253,56 +1015,870 @@ bool TAUInstrument::regexFits(const StringRef &name,
  * \return False if no new instructions were added (only when calls is empty),
  *  True otherwise
  */
-bool TAUInstrument::addInstrumentation(Function &func) {
+bool TAUInstrument::addInstrumentation(Function &func) {
+  TimeRegion region(timer(&TAUTimers::instrument));
+
+  auto &context = func.getContext();
+  auto *module = func.getParent();
+  StringRef prettyname = prettyName(func);
+  bool sampling = TauSamplePeriod > 1;
+  // The throttle flags must be registered by a module constructor
+  bool throttle = registerThrottle;
+
+  verbose() << "Adding instrumentation in " << prettyname << '\n';
+
+  // Insert instrumentation before the first instruction
+  auto pi = inst_begin(&func);
+  Instruction *i = &*pi;
+
+  // The entry block is split after its allocas, which must stay there
+  if (!TauEnableFlag.empty() || sampling || throttle || TauMaxDepth ||
+      probes->splitsBlocks())
+    i = firstNonAlloca(func);
+
+  // The module pass put the names in its table. Otherwise, this is the
+  // recommended way of creating a string constant (to be used as an
+  // argument to runtime functions)
+  Constant *name = probeNames.get(prettyname);
+  if (!name)
+    name = IRBuilder<>(i).CreateGlobalStringPtr(prettyname);
+
+  // With an enable flag, the probes are only called if it was set when the
+  // function was entered, with sampling, for one call in the period, with
+  // throttling, until the function is throttled, and with a maximum depth,
+  // for the outermost activations. The returns reuse that decision so that
+  // the probes stay balanced when a flag changes in between. Only the first
+  // two make the probes unlikely
+  Value *enabled = nullptr;
+  Value *count = nullptr;
+  LoadInst *depth = nullptr;
+  if (!TauEnableFlag.empty())
+    enabled = loadEnableFlag(*module, i);
+  if (sampling) {
+    Value *sampled = countDownSample(func, i, count);
+    enabled = enabled ? IRBuilder<>(i).CreateAnd(enabled, sampled) : sampled;
+  }
+  MDNode *weights = enabled ? coldBranchWeights(context) : nullptr;
+  if (throttle) {
+    Value *running = loadThrottleFlag(func, name, i);
+    enabled = enabled ? IRBuilder<>(i).CreateAnd(enabled, running) : running;
+  }
+  if (TauMaxDepth) {
+    depth = enterActivation(func, i);
+    Value *outer = IRBuilder<>(i).CreateICmpULT(
+        depth, ConstantInt::get(depth->getType(), TauMaxDepth));
+    enabled = enabled ? IRBuilder<>(i).CreateAnd(enabled, outer) : outer;
+  }
+  if (enabled)
+    i = SplitBlockAndInsertIfThen(enabled, i, /*Unreachable=*/false, weights);
+
+  // We need to find all the exit points for this function
+
+  SmallVector<ReturnInst *, 4> returns;
+  for (inst_iterator I = inst_begin(func), E = inst_end(func); I != E; ++I) {
+    if (auto *ret = dyn_cast<ReturnInst>(&*I))
+      returns.push_back(ret);
+  }
+  if (depth)
+    for (ReturnInst *ret : returns)
+      new StoreInst(depth, depth->getPointerOperand(), ret);
+
+  // A sampled call stands for the calls since the previous one
+  Value *weight = nullptr;
+  if (sampling) {
+    IRBuilder<> before(i);
+    weight = before.CreateSelect(
+        before.CreateIsNull(count), ConstantInt::get(count->getType(), 1),
+        ConstantInt::get(count->getType(), TauSamplePeriod));
+  }
+  probes->enterFunction(func, name, i, weight, enabled != nullptr);
+
+  for (ReturnInst *ret : returns) {
+    Instruction *e = ret;
+    if (enabled)
+      e = SplitBlockAndInsertIfThen(enabled, ret, /*Unreachable=*/false,
+                                    weights);
+    probes->exitFunction(e);
+  }
+  probes->finishFunction(func);
+  return true;
+}
+
+/*!
+ *  Load the throttle flag of the given function, which the runtime sets to
+ *  stop its probes once it is throttled, and register it for the module
+ *  constructor:
+ *
+ *    %t = load atomic i8, i8* @f.tau_disabled monotonic
+ *    %running = icmp eq i8 %t, 0
+ *
+ * \return Whether the function is not throttled
+ */
+Value *TAUInstrument::loadThrottleFlag(Function &func, Constant *name,
+                                       Instruction *insertPt) {
+  auto *flagTy = Type::getInt8Ty(func.getContext());
+  auto *disabled = new GlobalVariable(
+      *func.getParent(), flagTy, /*isConstant=*/false,
+      GlobalValue::PrivateLinkage, ConstantInt::get(flagTy, 0),
+      func.getName() + ".tau_disabled");
+  markGuardState(*disabled, GuardState::ThrottleFlag);
+  throttleFlags.emplace_back(disabled, name);
+
+  // Set by the runtime from any thread, as the enable flag
+  IRBuilder<> builder(insertPt);
+  LoadInst *flag = builder.CreateLoad(flagTy, disabled);
+  flag->setAtomic(AtomicOrdering::Monotonic);
+  flag->setAlignment(Align(1));
+  return builder.CreateIsNull(flag);
+}
+
+/*!
+ *  Add a constructor to the module, passing a table of globals to the
+ *  runtime at once along with the names of their functions:
+ *  `void <registerFunc>(struct { <global type> *global; const char *name; } *,
+ *  size_t count)`. The table is `tau.<what>`, the constructor
+ *  `tau.register_<what>`.
+ */
+static void addRegisterConstructor(Module &module,
+                                   ArrayRef<RegisteredGlobal> globals,
+                                   StringRef registerFuncName,
+                                   StringRef what) {
+  auto &context = module.getContext();
+  auto *ptrTy = Type::getInt8PtrTy(context);
+  auto *sizeTy = module.getDataLayout().getIntPtrType(context);
+
+  // The globals deleted after inlining, with their functions, are skipped
+  StructType *entryTy = nullptr;
+  SmallVector<Constant *, 16> entries;
+  for (auto &globalAndName : globals) {
+    auto *global = dyn_cast_or_null<GlobalVariable>(globalAndName.first);
+    auto *name = dyn_cast_or_null<Constant>(globalAndName.second);
+    if (!global || !name)
+      continue;
+    if (!entryTy)
+      entryTy = StructType::get(context, {global->getType(), ptrTy});
+    entries.push_back(ConstantStruct::get(entryTy, global, name));
+  }
+  if (entries.empty())
+    return;
+  auto *tableTy = ArrayType::get(entryTy, entries.size());
+
+  auto *table = new GlobalVariable(module, tableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(tableTy, entries),
+                                   "tau." + what);
+
+  auto registerFunc =
+      module.getOrInsertFunction(registerFuncName, Type::getVoidTy(context),
+                                 ptrTy, sizeTy);
+  auto *ctor = Function::Create(FunctionType::get(Type::getVoidTy(context),
+                                                  false),
+                                GlobalValue::InternalLinkage,
+                                "tau.register_" + what, &module);
+  IRBuilder<> builder(BasicBlock::Create(context, "", ctor));
+  builder.CreateCall(registerFunc,
+                     {builder.CreatePointerCast(table, ptrTy),
+                      ConstantInt::get(sizeTy, entries.size())});
+  builder.CreateRetVoid();
+  appendToGlobalCtors(module, ctor, TAU_HANDLES_CTOR_PRIORITY);
+}
+
+/*!
+ *  Add a constructor to the module, passing all the throttle flags to the
+ *  runtime at once along with the names of their functions:
+ *  `void Tau_register_throttle(struct { char *flag; const char *name; } *,
+ *  size_t count)`. A flag may be set at any time afterwards.
+ */
+void TAUInstrument::addThrottleConstructor(Module &module) {
+  addRegisterConstructor(module, throttleFlags, TauThrottleRegisterFunc,
+                         "throttle");
+}
+
+namespace {
+
+/* The profiling functions called by the probes of -tau-probe-backend */
+struct ProbeFuncs {
+  StringRef start;
+  StringRef stop;
+  StringRef sampledStart; // empty if the calls cannot be sampled
+  // Given the calls of the probes hoisted out of a loop
+  StringRef loopCalls;
+  // With handles
+  StringRef getHandle;
+  // Given the table of the module (with handles or ids)
+  StringRef registerTable;
+  ProbeArg arg;
+};
+
+/*!
+ *  The value of a function name option, or the default of the backend if
+ *  it was not given.
+ */
+static StringRef optionOr(const cl::opt<std::string> &option,
+                          StringRef fallback) {
+  return option.getNumOccurrences() ? StringRef(option) : fallback;
+}
+
+/*!
+ *  The profiling functions of the chosen backend, also used to recognize
+ *  the probes in the loop probes pass, with the kind of their argument.
+ *  -tau-probe-handles makes the name backends use handles.
+ */
+static ProbeFuncs probeFuncs() {
+  if (TauProbeBackend == ProbeBackendKind::TauIds)
+    return {TauIdStartFunc,
+            TauIdStopFunc,
+            "",
+            optionOr(TauLoopCallsFunc, "Tau_loop_calls_id"),
+            "",
+            TauIdRegisterFunc,
+            ProbeArg::Id};
+  bool handles = TauProbeBackend == ProbeBackendKind::TauHandles ||
+                 TauProbeHandles != ProbeHandles::None;
+  if (TauProbeBackend == ProbeBackendKind::Rtlib) {
+    if (handles)
+      return {optionOr(TauHandleStartFunc, "tau_prof_handle_call"),
+              optionOr(TauHandleStopFunc, "tau_prof_handle_ret"),
+              "",
+              optionOr(TauLoopCallsFunc, "tau_prof_handle_loop_calls"),
+              optionOr(TauHandleGetFunc, "tau_prof_get_handle"),
+              optionOr(TauHandleRegisterFunc, "tau_prof_register_handles"),
+              ProbeArg::Handle};
+    return {optionOr(TauStartFunc, "tau_prof_func_call"),
+            optionOr(TauStopFunc, "tau_prof_func_ret"),
+            "",
+            optionOr(TauLoopCallsFunc, "tau_prof_loop_calls"),
+            "",
+            "",
+            ProbeArg::Name};
+  }
+  if (handles)
+    return {TauHandleStartFunc,
+            TauHandleStopFunc,
+            TauHandleSampledStartFunc,
+            optionOr(TauLoopCallsFunc, "Tau_loop_calls_handle"),
+            TauHandleGetFunc,
+            TauHandleRegisterFunc,
+            ProbeArg::Handle};
+  return {TauStartFunc,     TauStopFunc, TauSampledStartFunc,
+          TauLoopCallsFunc, "",          "",
+          ProbeArg::Name};
+}
+
+/*!
+ *  Probes passing the name of the function to the runtime:
+ *  `void start(const char *name)` (`void sampled_start(const char *name,
+ *  uint32_t calls)` for the sampled calls) and `void stop(const char *name)`.
+ */
+class NameProbes : public ProbeBackend {
+public:
+  explicit NameProbes(const ProbeFuncs &funcs) : funcs(funcs) {}
+
+  bool canSample() const override { return !funcs.sampledStart.empty(); }
+
+  void enterFunction(Function &func, Constant *name, Instruction *&insertPt,
+                     Value *weight, bool guarded) override {
+    declareProbes(*func.getParent(), weight != nullptr, ProbeArg::Name);
+    arg = name;
+    callStart(insertPt, weight);
+  }
+
+  void exitFunction(Instruction *insertPt) override {
+    IRBuilder<>(insertPt).CreateCall(onRetFunc, {arg});
+  }
+
+  void leaveModule() override {
+    onCallFunc = nullptr;
+    onRetFunc = nullptr;
+  }
+
+protected:
+  /*!
+   *  Declare the probes, once per module.
+   */
+  void declareProbes(Module &module, bool sampled, ProbeArg probeArg) {
+    if (onCallFunc)
+      return;
+    auto &context = module.getContext();
+    if (sampled)
+      onCallFunc = module.getOrInsertFunction(
+          funcs.sampledStart, Type::getVoidTy(context),
+          Type::getInt8PtrTy(context), Type::getInt32Ty(context));
+    else
+      onCallFunc = getVoidFunc(funcs.start, context, &module);
+    onRetFunc = getVoidFunc(funcs.stop, context, &module);
+    setProbeAttributes(onCallFunc, probeArg);
+    setProbeAttributes(onRetFunc, probeArg);
+  }
+
+  void callStart(Instruction *insertPt, Value *weight) {
+    SmallVector<Value *, 2> startArgs{arg};
+    if (weight)
+      startArgs.push_back(weight);
+    IRBuilder<>(insertPt).CreateCall(onCallFunc, startArgs);
+  }
+
+  ProbeFuncs funcs;
+  // Declared on first use
+  TAUInstrument::ProbeCallee onCallFunc = nullptr;
+  TAUInstrument::ProbeCallee onRetFunc = nullptr;
+  // Of the current function
+  Value *arg = nullptr;
+};
+
+/*!
+ *  Probes passing a per-function timer handle to the runtime, filled from
+ *  `void *get_handle(const char *name)` on the first call of the function,
+ *  or with -tau-probe-handles=ctor, by a module constructor.
+ */
+class HandleProbes : public NameProbes {
+public:
+  HandleProbes(const ProbeFuncs &funcs, bool ctor)
+      : NameProbes(funcs), ctor(ctor) {}
+
+  bool splitsBlocks() const override { return true; }
+
+  void prepareModule(Module &module, unsigned functions) override {
+    registerHandles = ctor;
+  }
+
+  void enterFunction(Function &func, Constant *name, Instruction *&insertPt,
+                     Value *weight, bool guarded) override {
+    declareProbes(*func.getParent(), weight != nullptr, ProbeArg::Handle);
+    slot = createHandleSlot(func);
+    arg = loadHandle(func, name, insertPt);
+    reloadHandle = guarded;
+    callStart(insertPt, weight);
+  }
+
+  void exitFunction(Instruction *insertPt) override {
+    // The handle loaded at entry does not dominate a guarded return, but it
+    // is in the slot by now
+    IRBuilder<> builder(insertPt);
+    Value *retArg =
+        reloadHandle ? builder.CreateLoad(slot->getValueType(), slot) : arg;
+    builder.CreateCall(onRetFunc, {retArg});
+  }
+
+  void finishModule(Module &module) override {
+    addRegisterConstructor(module, handleSlots, funcs.registerTable,
+                           "handles");
+  }
+
+  void leaveModule() override {
+    NameProbes::leaveModule();
+    getHandleFunc = nullptr;
+    registerHandles = false;
+    handleSlots.clear();
+  }
+
+private:
+  GlobalVariable *createHandleSlot(Function &func);
+  Value *loadHandle(Function &func, Constant *name, Instruction *&insertPt);
+
+  bool ctor;
+  TAUInstrument::ProbeCallee getHandleFunc = nullptr;
+  // Whether the handles are filled by a module constructor (only from the
+  // module pass), and the slots to fill with the names of their functions
+  bool registerHandles = false;
+  SmallVector<RegisteredGlobal, 16> handleSlots;
+  // Of the current function
+  GlobalVariable *slot = nullptr;
+  bool reloadHandle = false;
+};
+
+/*!
+ *  Create the slot holding the handle of the given function.
+ */
+GlobalVariable *HandleProbes::createHandleSlot(Function &func) {
+  auto *handleTy = Type::getInt8PtrTy(func.getContext());
+  return new GlobalVariable(*func.getParent(), handleTy, /*isConstant=*/false,
+                            GlobalValue::PrivateLinkage,
+                            ConstantPointerNull::get(handleTy),
+                            func.getName() + ".tau_handle");
+}
+
+/*!
+ *  Load the handle of the given function from its slot. Unless a module
+ *  constructor fills the slots, the handle is requested from the runtime on
+ *  the first call only:
+ *
+ *    %h = load i8*, i8** @slot
+ *    br (%h == null), label %get (cold), label %tail
+ *  get:
+ *    %new = call i8* @Tau_get_handle(i8* "name")
+ *    store %new, @slot
+ *
+ * \param insertPt Where to insert the code, updated to where the entry probe
+ *                 should go
+ * \return The handle, available after insertPt
+ */
+Value *HandleProbes::loadHandle(Function &func, Constant *name,
+                                Instruction *&insertPt) {
+  auto *module = func.getParent();
+  auto *handleTy = slot->getValueType();
+
+  IRBuilder<> builder(insertPt);
+  if (registerHandles) {
+    handleSlots.emplace_back(slot, name);
+    return builder.CreateLoad(handleTy, slot);
+  }
+
+  if (!getHandleFunc) {
+    getHandleFunc =
+        module->getOrInsertFunction(funcs.getHandle, handleTy, handleTy);
+    setProbeAttributes(getHandleFunc, ProbeArg::KeptName);
+  }
+
+  LoadInst *handle = builder.CreateLoad(handleTy, slot);
+  Value *isNull = builder.CreateIsNull(handle);
+  Instruction *getTerm =
+      SplitBlockAndInsertIfThen(isNull, insertPt, /*Unreachable=*/false,
+                                coldBranchWeights(func.getContext()));
+
+  builder.SetInsertPoint(getTerm);
+  Value *newHandle = builder.CreateCall(getHandleFunc, {name});
+  builder.CreateStore(newHandle, slot);
+
+  builder.SetInsertPoint(insertPt);
+  PHINode *phi = builder.CreatePHI(handleTy, 2);
+  phi->addIncoming(handle, handle->getParent());
+  phi->addIncoming(newHandle, getTerm->getParent());
+  return phi;
+}
+
+/*!
+ *  The id of the given function, the same in every build: the xxHash64 of
+ *  its mangled name, never 0. The linker gives a single definition to a
+ *  name that is not local to its module, so the name alone identifies it
+ *  in every object, whatever the build directory. The functions local to
+ *  their module are also told apart by the path of their file: the
+ *  directory and the name of their debug info file, or the source file of
+ *  the module without it. The file and line reported are those of the
+ *  debug info.
+ */
+static uint64_t functionId(Function &func, StringRef &file, unsigned &line) {
+  line = 0;
+  SmallString<256> path;
+  if (DISubprogram *subprogram = func.getSubprogram()) {
+    file = subprogram->getFilename();
+    line = subprogram->getLine();
+    if (!sys::path::is_absolute(file))
+      path = subprogram->getDirectory();
+    sys::path::append(path, file);
+  } else {
+    file = func.isWeakForLinker() ? StringRef()
+                                  : func.getParent()->getSourceFileName();
+    path = file;
+  }
+
+  SmallString<256> key(func.getName());
+  if (func.hasLocalLinkage()) {
+    key.push_back('\0');
+    key += path;
+  }
+  uint64_t id = xxHash64(key);
+  return id ? id : 1;
+}
+
+/*!
+ *  Probes passing a stable 64-bit id of the function to the runtime:
+ *  `void start(uint64_t id)` and `void stop(uint64_t id)`. Each function is
+ *  described in the `tau_functions` section of the object by an entry
+ *  `{ uint64_t id; const char *name; const char *file; uint32_t line;
+ *  uint32_t reserved; }`, put in the comdat of the function if it has one so
+ *  that the linker keeps a single entry with the function. The linker
+ *  concatenates the sections of all the objects: runtimes and tools can
+ *  record the ids and find the names there afterwards. With the module
+ *  pass, a constructor also gives the whole section of the program (or
+ *  library) to the runtime: `void Tau_register_ids(const struct entry
+ *  *begin, const struct entry *end)`.
+ */
+class IdProbes : public ProbeBackend {
+public:
+  explicit IdProbes(const ProbeFuncs &funcs) : funcs(funcs) {}
+
+  void prepareModule(Module &module, unsigned functions) override {
+    registerIds = true;
+  }
+
+  void finishLater() override { keepEntries = true; }
+
+  void enterFunction(Function &func, Constant *name, Instruction *&insertPt,
+                     Value *weight, bool guarded) override;
+
+  void exitFunction(Instruction *insertPt) override {
+    IRBuilder<>(insertPt).CreateCall(onRetFunc, {id});
+  }
+
+  void finishModule(Module &module) override;
+
+  void leaveModule() override {
+    onCallFunc = nullptr;
+    onRetFunc = nullptr;
+    registerIds = false;
+    keepEntries = false;
+    entries.clear();
+    files.clear();
+  }
+
+private:
+  Constant *fileName(Module &module, StringRef file);
+
+  ProbeFuncs funcs;
+  // Declared on first use
+  TAUInstrument::ProbeCallee onCallFunc = nullptr;
+  TAUInstrument::ProbeCallee onRetFunc = nullptr;
+  // Whether the section is given to the runtime by a constructor (only
+  // from the module pass), and the entries of the module, kept until then.
+  // After inlining, the optimizer runs before the module is finished: each
+  // entry is kept as soon as it is created.
+  bool registerIds = false;
+  bool keepEntries = false;
+  SmallVector<GlobalValue *, 16> entries;
+  StringMap<Constant *> files;
+  // Of the current function
+  Constant *id = nullptr;
+};
+
+void IdProbes::enterFunction(Function &func, Constant *name,
+                             Instruction *&insertPt, Value *weight,
+                             bool guarded) {
+  auto *module = func.getParent();
+  auto &context = func.getContext();
+  auto *idTy = Type::getInt64Ty(context);
+  auto *lineTy = Type::getInt32Ty(context);
+  if (!onCallFunc) {
+    auto *voidTy = Type::getVoidTy(context);
+    onCallFunc = module->getOrInsertFunction(funcs.start, voidTy, idTy);
+    onRetFunc = module->getOrInsertFunction(funcs.stop, voidTy, idTy);
+    setProbeAttributes(onCallFunc, ProbeArg::Id);
+    setProbeAttributes(onRetFunc, ProbeArg::Id);
+  }
+
+  StringRef file;
+  unsigned line;
+  id = ConstantInt::get(idTy, functionId(func, file, line));
+  verbose() << "  id " << format_hex(cast<ConstantInt>(id)->getZExtValue(), 18)
+            << '\n';
+
+  auto *ptrTy = Type::getInt8PtrTy(context);
+  auto *entryTy =
+      StructType::get(context, {idTy, ptrTy, ptrTy, lineTy, lineTy});
+  auto *entry = new GlobalVariable(
+      *module, entryTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+      ConstantStruct::get(entryTy, id, name, fileName(*module, file),
+                          ConstantInt::get(lineTy, line),
+                          ConstantInt::get(lineTy, 0)),
+      func.getName() + ".tau_function");
+  entry->setSection(TAU_FUNCTIONS_SECTION);
+  entry->setAlignment(Align(8));
+  if (Comdat *comdat = func.getComdat())
+    entry->setComdat(comdat);
+  // Nothing refers to the entries: keep them from being removed
+  if (registerIds)
+    entries.push_back(entry);
+  if (!registerIds || keepEntries)
+    appendToCompilerUsed(*module, {entry});
+
+  IRBuilder<>(insertPt).CreateCall(onCallFunc, {id});
+}
+
+/*!
+ *  The name of a source file, shared by the entries of its functions.
+ */
+Constant *IdProbes::fileName(Module &module, StringRef file) {
+  Constant *&string = files[file];
+  if (!string) {
+    auto *array = ConstantDataArray::getString(module.getContext(), file);
+    auto *global = new GlobalVariable(module, array->getType(),
+                                      /*isConstant=*/true,
+                                      GlobalValue::PrivateLinkage, array,
+                                      "tau.file");
+    global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(Align(1));
+    string = ConstantExpr::getPointerCast(
+        global, Type::getInt8PtrTy(module.getContext()));
+  }
+  return string;
+}
+
+/*!
+ *  Keep the entries, and add the constructor giving the section to the
+ *  runtime. Each module of a program passes the same bounds, set by the
+ *  linker: the runtime only reads them once.
+ */
+void IdProbes::finishModule(Module &module) {
+  if (entries.empty())
+    return;
+  if (!keepEntries)
+    appendToCompilerUsed(module, entries);
+
+  auto &context = module.getContext();
+  auto *ptrTy = Type::getInt8PtrTy(context);
+  auto bound = [&](StringRef name) {
+    auto *global = cast<GlobalVariable>(
+        module.getOrInsertGlobal(name, Type::getInt8Ty(context)));
+    global->setVisibility(GlobalValue::HiddenVisibility);
+    return ConstantExpr::getPointerCast(global, ptrTy);
+  };
+  Constant *begin = bound("__start_" TAU_FUNCTIONS_SECTION);
+  Constant *end = bound("__stop_" TAU_FUNCTIONS_SECTION);
+
+  auto registerFunc = module.getOrInsertFunction(
+      funcs.registerTable, Type::getVoidTy(context), ptrTy, ptrTy);
+  auto *ctor = Function::Create(
+      FunctionType::get(Type::getVoidTy(context), false),
+      GlobalValue::InternalLinkage, "tau.register_ids", &module);
+  IRBuilder<> builder(BasicBlock::Create(context, "", ctor));
+  builder.CreateCall(registerFunc, {begin, end});
+  builder.CreateRetVoid();
+  appendToGlobalCtors(module, ctor, TAU_HANDLES_CTOR_PRIORITY);
+}
+
+/*!
+ *  Counters of the calls and cycles of each function, kept inline in a
+ *  thread-local table of the module, with an entry `{ i64 calls,
+ *  i64 inclusive, i64 exclusive }` per instrumented function. The cycles of
+ *  the calls of other instrumented functions are summed in a thread-local
+ *  variable shared by all the modules, `tau_inline_children`, so that the
+ *  exclusive cycles can be counted as well. As in the runtime, the running
+ *  calls of each function are counted, in a thread-local `f.tau_active`, so
+ *  that the inclusive cycles of recursive calls are only counted once:
+ *
+ *  entry:
+ *    (call @tau.register_inline on the first call in the thread)
+ *    %children0 = load i64, i64* @tau_inline_children
+ *    store (load @f.tau_active) + 1, @f.tau_active
+ *    %start = call i64 @llvm.readcyclecounter()
+ *  return:
+ *    %elapsed = sub (call i64 @llvm.readcyclecounter()), %start
+ *    %active = sub (load @f.tau_active), 1
+ *    store %active, @f.tau_active
+ *    %children = sub (load @tau_inline_children), %children0
+ *    store (%children0 + %elapsed), @tau_inline_children
+ *    calls += 1; inclusive += (%active == 0 ? %elapsed : 0);
+ *    exclusive += %elapsed - %children
+ *
+ *  Each thread gives its table to the runtime with `void
+ *  Tau_inline_register(struct { uint64_t calls, inclusive, exclusive; }
+ *  *counters, const char **names, size_t count)`. The table is sized by the
+ *  module pass, so the function pass rejects this backend.
+ */
+class InlineCounterProbes : public ProbeBackend {
+public:
+  bool splitsBlocks() const override { return true; }
+  bool needsModulePass() const override { return true; }
+  void prepareModule(Module &module, unsigned functions) override;
+  void enterFunction(Function &func, Constant *name, Instruction *&insertPt,
+                     Value *weight, bool guarded) override;
+  void exitFunction(Instruction *insertPt) override;
+  void finishFunction(Function &func) override;
+  void finishModule(Module &module) override;
+  void leaveModule() override;
+
+private:
+  // The thread-local table of the counters, whether it was registered in the
+  // thread, the function registering it, and the names of the functions
+  // counted in it. After inlining, the optimizer may delete them before the
+  // module is finished, with the functions using them.
+  WeakTrackingVH counters;
+  WeakTrackingVH registered;
+  WeakTrackingVH registerFunc;
+  SmallVector<WeakTrackingVH, 16> names;
+  GlobalVariable *childrenSum = nullptr;
+  Function *readCycles = nullptr;
+  // Of the current function: its count of running calls, thread-local
+  GlobalVariable *activeCount = nullptr;
+  // Of the current function: the values of the entry are passed to the
+  // returns through allocas, promoted at the end, since the guarded blocks
+  // do not dominate each other
+  AllocaInst *startSlot = nullptr;
+  AllocaInst *childrenSlot = nullptr;
+};
+
+/*!
+ *  Create the table of the module and declare the function registering it,
+ *  defined once all the names are known.
+ */
+void InlineCounterProbes::prepareModule(Module &module, unsigned functions) {
+  auto &context = module.getContext();
+  auto *i64Ty = Type::getInt64Ty(context);
+  auto *flagTy = Type::getInt8Ty(context);
+  auto *tableTy = ArrayType::get(
+      StructType::get(context, {i64Ty, i64Ty, i64Ty}), functions);
+  counters = new GlobalVariable(
+      module, tableTy, /*isConstant=*/false, GlobalValue::PrivateLinkage,
+      ConstantAggregateZero::get(tableTy), "tau.inline_counters",
+      /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+  registered = new GlobalVariable(
+      module, flagTy, /*isConstant=*/false, GlobalValue::PrivateLinkage,
+      ConstantInt::get(flagTy, 0), "tau.inline_registered",
+      /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+  // Only declared until finishModule(), which makes it internal: the
+  // passes run in between cannot assume that the call does nothing
+  Function *declaration = Function::Create(
+      FunctionType::get(Type::getVoidTy(context), false),
+      GlobalValue::ExternalLinkage, "tau.register_inline", &module);
+  declaration->addFnAttr(Attribute::NoInline);
+  declaration->addFnAttr(Attribute::Cold);
+  registerFunc = declaration;
+
+  childrenSum = cast<GlobalVariable>(
+      module.getOrInsertGlobal("tau_inline_children", i64Ty, [&] {
+        return new GlobalVariable(
+            module, i64Ty, /*isConstant=*/false, GlobalValue::WeakAnyLinkage,
+            ConstantInt::get(i64Ty, 0), "tau_inline_children",
+            /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+      }));
+  readCycles = Intrinsic::getDeclaration(&module, Intrinsic::readcyclecounter);
+}
 
-  // Declare and get handles to the runtime profiling functions
+void InlineCounterProbes::enterFunction(Function &func, Constant *name,
+                                        Instruction *&insertPt, Value *weight,
+                                        bool guarded) {
   auto &context = func.getContext();
-  auto *module = func.getParent();
-  StringRef prettyname = normalize_name(func.getName());
-#if (LLVM_VERSION_MAJOR <= 8)
-  Constant *onCallFunc = getVoidFunc(TauStartFunc, context, module),
-           *onRetFunc = getVoidFunc(TauStopFunc, context, module);
-#else
-  FunctionCallee onCallFunc = getVoidFunc(TauStartFunc, context, module),
-                 onRetFunc = getVoidFunc(TauStopFunc, context, module);
-#endif // LLVM_VERSION_MAJOR <= 8
-
-  errs() << "Adding instrumentation in " << prettyname << '\n';
-
-  // Insert instrumentation before the first instruction
-  auto pi = inst_begin(&func);
-  Instruction *i = &*pi;
-  IRBuilder<> before(i);
+  auto *i64Ty = Type::getInt64Ty(context);
+  auto *i32Ty = Type::getInt32Ty(context);
+  names.push_back(name);
+  activeCount = new GlobalVariable(
+      *func.getParent(), i32Ty, /*isConstant=*/false,
+      GlobalValue::PrivateLinkage, ConstantInt::get(i32Ty, 0),
+      func.getName() + ".tau_active", /*InsertBefore=*/nullptr,
+      GlobalValue::GeneralDynamicTLSModel);
+
+  IRBuilder<> builder(&*func.getEntryBlock().getFirstInsertionPt());
+  startSlot = builder.CreateAlloca(i64Ty, nullptr, "tau.start");
+  childrenSlot = builder.CreateAlloca(i64Ty, nullptr, "tau.children");
+
+  builder.SetInsertPoint(insertPt);
+  Value *unregistered = builder.CreateIsNull(
+      builder.CreateLoad(Type::getInt8Ty(context), registered));
+  Instruction *registerTerm =
+      SplitBlockAndInsertIfThen(unregistered, insertPt, /*Unreachable=*/false,
+                                coldBranchWeights(context));
+  IRBuilder<>(registerTerm).CreateCall(cast<Function>(registerFunc));
+  builder.SetInsertPoint(insertPt);
+  builder.CreateStore(builder.CreateLoad(i64Ty, childrenSum), childrenSlot);
+  builder.CreateStore(
+      builder.CreateAdd(builder.CreateLoad(i32Ty, activeCount),
+                        ConstantInt::get(i32Ty, 1)),
+      activeCount);
+  builder.CreateStore(builder.CreateCall(readCycles), startSlot);
+}
 
-  bool mutated = false; // TODO
+void InlineCounterProbes::exitFunction(Instruction *insertPt) {
+  auto &context = insertPt->getContext();
+  auto *i64Ty = Type::getInt64Ty(context);
+  auto *i32Ty = Type::getInt32Ty(context);
+  unsigned index = names.size() - 1;
+  auto *table = cast<GlobalVariable>(counters);
+
+  IRBuilder<> builder(insertPt);
+  Value *elapsed = builder.CreateSub(builder.CreateCall(readCycles),
+                                     builder.CreateLoad(i64Ty, startSlot));
+  Value *active = builder.CreateSub(builder.CreateLoad(i32Ty, activeCount),
+                                    ConstantInt::get(i32Ty, 1));
+  builder.CreateStore(active, activeCount);
+  Value *children0 = builder.CreateLoad(i64Ty, childrenSlot);
+  Value *children =
+      builder.CreateSub(builder.CreateLoad(i64Ty, childrenSum), children0);
+  builder.CreateStore(builder.CreateAdd(children0, elapsed), childrenSum);
+
+  // The outermost of the running calls covers the others
+  Value *inclusive = builder.CreateSelect(builder.CreateIsNull(active),
+                                          elapsed, ConstantInt::get(i64Ty, 0));
+  Value *deltas[] = {ConstantInt::get(i64Ty, 1), inclusive,
+                     builder.CreateSub(elapsed, children)};
+  for (unsigned field = 0; field < 3; ++field) {
+    Value *counter = builder.CreateInBoundsGEP(
+        table->getValueType(), table,
+        {ConstantInt::get(i32Ty, 0), ConstantInt::get(i32Ty, index),
+         ConstantInt::get(i32Ty, field)});
+    builder.CreateStore(
+        builder.CreateAdd(builder.CreateLoad(i64Ty, counter), deltas[field]),
+        counter);
+  }
+}
 
-  // This is the recommended way of creating a string constant (to be used
-  // as an argument to runtime functions)
+void InlineCounterProbes::finishFunction(Function &func) {
+  DominatorTree domTree(func);
+  PromoteMemToReg({startSlot, childrenSlot}, domTree);
+}
 
-  Value *strArg = before.CreateGlobalStringPtr(prettyname);
-  SmallVector<Value *, 1> args{strArg};
-  before.CreateCall(onCallFunc, args);
-  mutated = true;
+/*!
+ *  Define the function registering the table in the current thread. If the
+ *  functions calling it were all deleted after inlining, so were the
+ *  function and the table; the names of the functions deleted are null.
+ */
+void InlineCounterProbes::finishModule(Module &module) {
+  auto *func = dyn_cast_or_null<Function>(registerFunc);
+  auto *table = dyn_cast_or_null<GlobalVariable>(counters);
+  auto *flag = dyn_cast_or_null<GlobalVariable>(registered);
+  if (!func || !table || !flag)
+    return;
+
+  auto &context = module.getContext();
+  auto *ptrTy = Type::getInt8PtrTy(context);
+  auto *sizeTy = module.getDataLayout().getIntPtrType(context);
+  auto *namesTy = ArrayType::get(ptrTy, names.size());
+  SmallVector<Constant *, 16> nameConstants;
+  for (Value *name : names) {
+    auto *constant = dyn_cast_or_null<Constant>(name);
+    nameConstants.push_back(constant ? constant
+                                     : ConstantPointerNull::get(ptrTy));
+  }
+  auto *namesTable = new GlobalVariable(
+      module, namesTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+      ConstantArray::get(namesTy, nameConstants), "tau.inline_names");
+
+  auto runtimeFunc = module.getOrInsertFunction(
+      TauInlineRegisterFunc, Type::getVoidTy(context), ptrTy, ptrTy, sizeTy);
+  IRBuilder<> builder(BasicBlock::Create(context, "", func));
+  builder.CreateStore(ConstantInt::get(Type::getInt8Ty(context), 1), flag);
+  builder.CreateCall(runtimeFunc,
+                     {builder.CreatePointerCast(table, ptrTy),
+                      builder.CreatePointerCast(namesTable, ptrTy),
+                      ConstantInt::get(sizeTy, names.size())});
+  builder.CreateRetVoid();
+  func->setLinkage(GlobalValue::InternalLinkage);
+}
 
-  // We need to find all the exit points for this function
+void InlineCounterProbes::leaveModule() {
+  counters = nullptr;
+  registered = nullptr;
+  registerFunc = nullptr;
+  names.clear();
+  childrenSum = nullptr;
+  readCycles = nullptr;
+  activeCount = nullptr;
+  startSlot = nullptr;
+  childrenSlot = nullptr;
+}
 
-  for (inst_iterator I = inst_begin(func), E = inst_end(func); I != E; ++I) {
-    Instruction *e = &*I;
-    if (isa<ReturnInst>(e)) {
-      IRBuilder<> final(e);
-      final.CreateCall(onRetFunc, args);
-    }
-  }
-  return mutated;
+/*!
+ *  The backend of -tau-probe-backend.
+ */
+std::unique_ptr<ProbeBackend> createProbeBackend() {
+  if (TauProbeBackend == ProbeBackendKind::InlineCounters)
+    return std::make_unique<InlineCounterProbes>();
+  ProbeFuncs funcs = probeFuncs();
+  if (funcs.arg == ProbeArg::Id)
+    return std::make_unique<IdProbes>(funcs);
+  if (funcs.arg == ProbeArg::Handle)
+    return std::make_unique<HandleProbes>(
+        funcs, TauProbeHandles != ProbeHandles::Lazy);
+  return std::make_unique<NameProbes>(funcs);
 }
+} // namespace
 
 /*!
- * Given an open file, a token and two vectors, read what is coming next and
- * put it in the vector or its regex counterpart until the token has been
- * reached.
+ * Given an open file, a token, a list of exact names and a matcher, read
+ * what is coming next and put it in the list, or in the matcher with the
+ * given tag if it contains a wildcard, until the token has been reached.
  */
-void TAUInstrument::readUntilToken(std::ifstream &file, StringSet<> &vec,
-                                   std::vector<std::regex> &vecReg,
+void TAUInstrument::readUntilToken(std::istream &file, unsigned kind,
+                                   TAUGlobMatcher &patterns, unsigned tag,
                                    const char *token) {
   std::string funcName;
   std::string s_token(token); // used by an errs()
@@ -317,9 +1893,9 @@ void TAUInstrument::readUntilToken(std::ifstream &file, StringSet<> &vec,
       }
 
       if (s_token.end() == std::find(s_token.begin(), s_token.end(), 'X')) {
-        errs() << "Include";
+        verbose() << "Include";
       } else {
-        errs() << "Exclude";
+        verbose() << "Exclude";
       }
       if (s_token.end() == std::find(s_token.begin(), s_token.end(), 'F')) {
         std::regex par_o(std::string("\\([\\s]"));
@@ -332,10 +1908,10 @@ void TAUInstrument::readUntilToken(std::ifstream &file, StringSet<> &vec,
         std::regex_replace(std::back_inserter(regex_1), regex_0.begin(),
                            regex_0.end(), par_c, s_c);
         funcName = std::string(regex_1);
-        errs() << " function: " << funcName;
+        verbose() << " function: " << funcName;
         /* TODO: trim whitespaces */
       } else {
-        errs() << " file " << funcName;
+        verbose() << " file " << funcName;
       }
 
       /* The regex wildcards are not the same for filenames and function names.
@@ -348,65 +1924,28 @@ void TAUInstrument::readUntilToken(std::ifstream &file, StringSet<> &vec,
             funcName.end() != std::find(funcName.begin(), funcName.end(),
                                         TAU_REGEX_FILE_QUES)) {
 
-          std::regex q(std::string("[*]"));
-          std::string q_reg(std::string("(.*)"));
-          std::string regex_1;
-
-          std::regex_replace(std::back_inserter(regex_1), funcName.begin(),
-                             funcName.end(), q, q_reg);
-
-          std::regex q2(std::string("[?]"));
-          std::string q2_reg(std::string("(.?)"));
-          std::string regex_2;
-
-          std::regex_replace(std::back_inserter(regex_2), regex_1.begin(),
-                             regex_1.end(), q2, q2_reg);
-
-          // errs()<< "regex filename: " << regex_2 << "\n";
-
-          vecReg.push_back(std::regex(regex_2));
-          errs() << " (regex)";
+          patterns.addPattern(funcName, tag, TAU_REGEX_FILE_STAR,
+                              TAU_REGEX_FILE_QUES);
+          verbose() << " (regex)";
 
         } else {
-          vec.insert(funcName);
+          exactNames.insert(funcName, kind);
         }
       } else {
         /* This is a function name */
         if (funcName.end() !=
             std::find(funcName.begin(), funcName.end(), TAU_REGEX_STAR)) {
-          /* We need to pre-process this regex: escape the parenthesis */
-          std::regex par_o(std::string("\\("));
-          std::regex par_c(std::string("\\)"));
-          std::string s_o(std::string("\\("));
-          std::string s_c(std::string("\\)"));
-          std::string regex_1, regex_0;
-          std::regex_replace(std::back_inserter(regex_0), funcName.begin(),
-                             funcName.end(), par_o, s_o);
-          std::regex_replace(std::back_inserter(regex_1), regex_0.begin(),
-                             regex_0.end(), par_c, s_c);
-
-          /* Escape the stars (pointers) */
-          std::regex r_s(std::string("[\*]"));
-          std::string star(std::string("\\*"));
-          std::string regex_2;
-          std::regex_replace(std::back_inserter(regex_2), regex_1.begin(),
-                             regex_1.end(), r_s, star);
-
-          /* Wildcard: replace the # by stars */
-          std::regex cross(std::string("[#]"));
-          std::string wildcard(std::string("(.*)"));
-          std::string regex_3;
-          std::regex_replace(std::back_inserter(regex_3), regex_2.begin(),
-                             regex_2.end(), cross, wildcard);
-
-          vecReg.push_back(std::regex(regex_3));
-          //	    errs()<< "regex function: " << regex_3 << " ";
-          errs() << " (regex)";
+          /* Everything but the wildcard is taken literally, including the
+           * parenthesis and the stars (pointers) */
+          patterns.addPattern(funcName, tag, TAU_REGEX_STAR);
+          verbose() << " (regex)";
         } else {
-          vec.insert(funcName);
+          exactNames.insert(funcName, kind);
+          if (TauMangledLookup)
+            addMangledName(funcName, tag);
         }
       }
-      errs() << "\n";
+      verbose() << "\n";
     }
   }
 
@@ -417,12 +1956,130 @@ void TAUInstrument::readUntilToken(std::ifstream &file, StringSet<> &vec,
   }
 }
 
+/*!
+ *  Load the selective instrumentation file, from the list cache if possible.
+ */
+void TAUInstrument::loadInputFile() {
+  TimeRegion region(timer(&TAUTimers::loadList));
+  auto buffer = MemoryBuffer::getFile(TauInputFile);
+  if (!buffer) {
+    errs() << "Could not read " << TauInputFile << ": "
+           << buffer.getError().message() << "\n";
+    return;
+  }
+
+  std::string cachePath;
+  if (!TauListCacheDir.empty()) {
+    cachePath = listCachePath((*buffer)->getBuffer());
+    if (loadListCache(cachePath)) {
+      verbose() << "functions were loaded from " << cachePath << "\n";
+      return;
+    }
+  }
+
+  std::istringstream ifile{(*buffer)->getBuffer().str()};
+  loadFunctionsFromFile(ifile);
+  verbose() << "functions were loaded from file \n";
+
+  if (!cachePath.empty())
+    saveListCache(cachePath);
+}
+
+/*!
+ *  The cache file of the given input file contents. The flavor of the
+ *  plugin is part of the name, since the C++ one also stores mangled names.
+ */
+std::string TAUInstrument::listCachePath(StringRef contents) {
+#ifdef TAU_PROF_CXX
+  const char *flavor = TauMangledLookup ? "cxx-mangled" : "cxx";
+#else
+  const char *flavor = "c";
+#endif
+  SmallString<128> path{TauListCacheDir};
+  sys::path::append(path, "tau-list-v" + Twine(TAU_LIST_CACHE_VERSION) + "-" +
+                              flavor + "-" + utohexstr(xxHash64(contents)) +
+                              ".bin");
+  return path.str().str();
+}
+
+/*!
+ *  Map the compiled lists from the cache. Layout of the file:
+ *  magic, u32 version, u32 number of unmangled included then excluded
+ *  functions, the function matcher, the file matcher, the exact names.
+ *  Returns false if there is no usable cache file.
+ */
+bool TAUInstrument::loadListCache(const std::string &path) {
+#if (LLVM_VERSION_MAJOR >= 13)
+  auto buffer = MemoryBuffer::getFile(path, /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+#else
+  auto buffer = MemoryBuffer::getFile(path, /*FileSize=*/-1,
+                                      /*RequiresNullTerminator=*/false);
+#endif
+  if (!buffer)
+    return false;
+
+  StringRef contents = (*buffer)->getBuffer();
+  StringRef data = contents;
+  uint32_t version, inclUnmangled, exclUnmangled;
+  if (!data.consume_front(TAU_LIST_CACHE_MAGIC) || !readU32(data, version) ||
+      version != TAU_LIST_CACHE_VERSION || !readU32(data, inclUnmangled) ||
+      !readU32(data, exclUnmangled))
+    return false;
+
+  TAUGlobMatcher funcs, files;
+  TAUNameTable names;
+  if (!funcs.read(data) || !files.read(data) ||
+      !names.map(contents, contents.size() - data.size()))
+    return false;
+
+  funcsOfInterestUnmangled = inclUnmangled;
+  funcsExclUnmangled = exclUnmangled;
+  funcsPatterns = std::move(funcs);
+  filesPatterns = std::move(files);
+  exactNames = std::move(names);
+  listCache = std::move(*buffer);
+  return true;
+}
+
+/*!
+ *  Write the compiled lists to the cache. The file is written under a
+ *  temporary name and renamed, so that concurrent compilations never see
+ *  it incomplete.
+ */
+void TAUInstrument::saveListCache(const std::string &path) {
+  SmallString<4096> contents;
+  raw_svector_ostream os(contents);
+  os << TAU_LIST_CACHE_MAGIC;
+  writeU32(os, TAU_LIST_CACHE_VERSION);
+  writeU32(os, funcsOfInterestUnmangled);
+  writeU32(os, funcsExclUnmangled);
+  funcsPatterns.write(os);
+  filesPatterns.write(os);
+  exactNames.write(os);
+
+  int fd;
+  SmallString<128> tmpPath;
+  if (std::error_code ec =
+          sys::fs::createUniqueFile(path + ".tmp-%%%%%%", fd, tmpPath)) {
+    errs() << "Could not create the list cache in " << TauListCacheDir
+           << ": " << ec.message() << "\n";
+    return;
+  }
+  {
+    raw_fd_ostream out(fd, /*shouldClose=*/true);
+    out << contents;
+  }
+  if (sys::fs::rename(tmpPath, path))
+    sys::fs::remove(tmpPath);
+}
+
 /*!
  *  Given an open file, read each line as the name of a function that should
- *  be instrumented.  This modifies the class member funcsOfInterest to hold
- *  strings from the file.
+ *  be instrumented.  This fills exactNames and the matchers with the strings
+ *  from the file.
  */
-void TAUInstrument::loadFunctionsFromFile(std::ifstream &file) {
+void TAUInstrument::loadFunctionsFromFile(std::istream &file) {
   std::string funcName;
 
   /* This will be necessary as long as we don't have pattern matching in C++ */
@@ -447,27 +2104,27 @@ void TAUInstrument::loadFunctionsFromFile(std::ifstream &file) {
 
       switch (s_mapTokenValues[funcName]) {
       case begin_func_include:
-        errs() << "Included functions: \n";
-        readUntilToken(file, funcsOfInterest, funcsOfInterestRegex,
+        verbose() << "Included functions: \n";
+        readUntilToken(file, FuncInclude, funcsPatterns, IncludeTag,
                        TAU_END_INCLUDE_LIST_NAME);
         break;
 
       case begin_func_exclude:
         //	    errs() << "Excluded functions: \n"<< s_mapTokenValues[
         // funcName ] << "\n";
-        readUntilToken(file, funcsExcl, funcsExclRegex,
+        readUntilToken(file, FuncExclude, funcsPatterns, ExcludeTag,
                        TAU_END_EXCLUDE_LIST_NAME);
         break;
 
       case begin_file_include:
-        errs() << "Included files: \n";
-        readUntilToken(file, filesIncl, filesInclRegex,
+        verbose() << "Included files: \n";
+        readUntilToken(file, FileInclude, filesPatterns, IncludeTag,
                        TAU_END_FILE_INCLUDE_LIST_NAME);
         break;
 
       case begin_file_exclude:
-        errs() << "Excluded files: \n";
-        readUntilToken(file, filesExcl, filesExclRegex,
+        verbose() << "Excluded files: \n";
+        readUntilToken(file, FileExclude, filesPatterns, ExcludeTag,
                        TAU_END_FILE_EXCLUDE_LIST_NAME);
         break;
 
@@ -485,46 +2142,821 @@ void TAUInstrument::loadFunctionsFromFile(std::ifstream &file) {
   }
 }
 
-PreservedAnalyses TAUInstrument::run(Function &F, FunctionAnalysisManager &) {
+/* Kinds of the calls seen by the loop probes pass */
+enum class ProbeCall { None, Start, Stop };
+
+/*!
+ *  Whether the given call is a start or stop probe of the current flavor.
+ *  The sampled starts of -tau-sample-period are starts as well: they take
+ *  the number of calls they stand for after the usual argument.
+ */
+static ProbeCall probeCallKind(CallInst &call) {
+  Function *callee = call.getCalledFunction();
+  if (!callee)
+    return ProbeCall::None;
+  ProbeFuncs funcs = probeFuncs();
+  StringRef name = callee->getName();
+  unsigned args = call.arg_size();
+  if ((name == funcs.start && args == 1) ||
+      (!funcs.sampledStart.empty() && name == funcs.sampledStart &&
+       args == 2))
+    return ProbeCall::Start;
+  if (name == funcs.stop && args == 1)
+    return ProbeCall::Stop;
+  return ProbeCall::None;
+}
+
+/*!
+ *  What identifies the instrumented function in the argument of a probe: the
+ *  name, the id, or the slot the handle was loaded from. The entry and exit
+ *  probes get the same key even when they load the handle separately.
+ */
+static Value *probeKey(Value *arg) {
+  arg = arg->stripPointerCasts();
+  if (auto *phi = dyn_cast<PHINode>(arg)) {
+    // The handle filled lazily on entry
+    for (Value *incoming : phi->incoming_values())
+      if (isa<LoadInst>(incoming))
+        return probeKey(incoming);
+  }
+  if (auto *load = dyn_cast<LoadInst>(arg))
+    if (auto *slot = dyn_cast<GlobalVariable>(load->getPointerOperand()))
+      return slot;
+  return arg;
+}
+
+/*!
+ *  The name of the instrumented function, for the remarks. The slot of a
+ *  handle is filled with the name it is requested with, or registered with
+ *  in the table of the constructor.
+ */
+static std::string probeName(Value *key) {
+  StringRef name;
+  if (getConstantStringInfo(key, name))
+    return name.str();
+  if (auto *slot = dyn_cast<GlobalVariable>(key)) {
+    for (User *user : slot->users()) {
+      Value *nameArg = nullptr;
+      if (auto *store = dyn_cast<StoreInst>(user)) {
+        auto *call = dyn_cast<CallInst>(store->getValueOperand());
+        if (call && call->arg_size() == 1)
+          nameArg = call->getArgOperand(0);
+      } else if (auto *entry = dyn_cast<ConstantStruct>(user)) {
+        if (entry->getNumOperands() == 2)
+          nameArg = entry->getOperand(1);
+      }
+      if (nameArg && getConstantStringInfo(nameArg, name))
+        return name.str();
+    }
+    return slot->getName().str();
+  }
+  if (auto *id = dyn_cast<ConstantInt>(key))
+    return "function 0x" + utohexstr(id->getZExtValue());
+  return "an instrumented function";
+}
+
+/*!
+ *  Whether the probes are guarded: by the enable flag, by sampling, by
+ *  throttling, or by a maximum depth.
+ */
+static bool probesGuarded() {
+  return !TauEnableFlag.empty() || TauSamplePeriod > 1 || TauThrottle ||
+         TauMaxDepth;
+}
+
+/*!
+ *  Whether the given global holds the state the guards of the probes are
+ *  computed from: the enable flag, a sampling countdown, a throttle flag,
+ *  or a depth counter, as marked by the instrumentation.
+ */
+static bool isGuardState(Value *ptr) {
+  return guardStateOf(ptr) != GuardState::None;
+}
+
+/*!
+ *  Whether the given instruction loads or stores the guard state.
+ */
+static bool isGuardAccess(Instruction &inst) {
+  if (auto *load = dyn_cast<LoadInst>(&inst))
+    return isGuardState(load->getPointerOperand());
+  if (auto *store = dyn_cast<StoreInst>(&inst))
+    return isGuardState(store->getPointerOperand());
+  return false;
+}
+
+/*!
+ *  Whether the given instruction may be part of the computation of a guard.
+ */
+static bool isGuardArithmetic(Instruction *inst) {
+  return isa<PHINode>(inst) || isa<SelectInst>(inst) ||
+         isa<BinaryOperator>(inst) || isa<CmpInst>(inst) || isa<CastInst>(inst);
+}
+
+/*!
+ *  Whether the given value is only computed from the guard state: loads of
+ *  it, and the arithmetic of the guards, including the phis the optimizer
+ *  adds when it promotes a countdown out of a loop.
+ */
+static bool isGuardValue(Value *value, SmallPtrSetImpl<Value *> &visited) {
+  if (isa<Constant>(value))
+    return true;
+  // Through a cycle of phis
+  if (!visited.insert(value).second)
+    return true;
+  if (auto *load = dyn_cast<LoadInst>(value))
+    return isGuardState(load->getPointerOperand());
+  auto *inst = dyn_cast<Instruction>(value);
+  if (!inst || !isGuardArithmetic(inst))
+    return false;
+  for (Value *operand : inst->operands())
+    if (!isGuardValue(operand, visited))
+      return false;
+  return true;
+}
+
+/*!
+ *  A handle filled lazily on entry (see HandleProbes::loadHandle()), from
+ *  the phi merging it:
+ *
+ *  entry:
+ *    %h = load i8*, i8** @slot
+ *    br (%h == null), label %get, label %tail
+ *  get:
+ *    %new = call i8* @Tau_get_handle(i8* "name")
+ *    store %new, @slot
+ *    br label %tail
+ *  tail:
+ *    %phi = phi [ %h, %entry ], [ %new, %get ]
+ */
+struct LazyFill {
+  PHINode *phi;
+  LoadInst *handle;
+  CallInst *getHandle;
+};
+
+static Optional<LazyFill> lazyFill(Value *value) {
+  auto *phi = dyn_cast<PHINode>(value);
+  if (!phi || phi->getNumIncomingValues() != 2)
+    return None;
+  LazyFill fill = {phi, nullptr, nullptr};
+  for (Value *incoming : phi->incoming_values()) {
+    if (auto *load = dyn_cast<LoadInst>(incoming))
+      fill.handle = load;
+    else if (auto *call = dyn_cast<CallInst>(incoming))
+      fill.getHandle = call;
+  }
+  if (!fill.handle || !fill.getHandle || !fill.handle->isSimple() ||
+      !isa<GlobalVariable>(fill.handle->getPointerOperand()))
+    return None;
+  Function *callee = fill.getHandle->getCalledFunction();
+  BasicBlock *entry = fill.handle->getParent();
+  BasicBlock *get = fill.getHandle->getParent();
+  if (!callee || callee->getName() != probeFuncs().getHandle ||
+      fill.getHandle->arg_size() != 1 || get->getSinglePredecessor() != entry ||
+      get->getSingleSuccessor() != phi->getParent() ||
+      !is_contained(predecessors(phi->getParent()), entry))
+    return None;
+  return fill;
+}
+
+/*!
+ *  The block a probe was put into by the instrumentation: the block of the
+ *  call, or with a handle filled lazily on entry, the block loading it.
+ */
+static BasicBlock *probeBlock(CallInst &call) {
+  for (PHINode &phi : call.getParent()->phis())
+    if (Optional<LazyFill> fill = lazyFill(&phi))
+      return fill->handle->getParent();
+  return call.getParent();
+}
+
+/*!
+ *  Remove a handle filled lazily in the loop once its probes are removed:
+ *  it is filled before the loop by the hoisted probes, and never used
+ *  otherwise. The block loading it is merged with the rest of the probes
+ *  block, for their guard to be removed.
+ */
+static void removeLazyFill(const LazyFill &fill, LoopInfo &loops,
+                           DomTreeUpdater &updater) {
+  BasicBlock *entry = fill.handle->getParent();
+  BasicBlock *get = fill.getHandle->getParent();
+  BasicBlock *tail = fill.phi->getParent();
+  auto *branch = dyn_cast<BranchInst>(entry->getTerminator());
+  if (!fill.phi->use_empty() || !branch || !branch->isConditional() ||
+      get->size() != 3 || fill.getHandle->getNumUses() != 2 ||
+      !isa<StoreInst>(fill.getHandle->getNextNode()))
+    return;
+
+  Value *cond = branch->getCondition();
+  fill.phi->eraseFromParent();
+  BranchInst::Create(tail, branch);
+  branch->eraseFromParent();
+  updater.applyUpdates({{DominatorTree::Delete, entry, get}});
+  loops.removeBlock(get);
+  DeleteDeadBlock(get, &updater);
+  RecursivelyDeleteTriviallyDeadInstructions(cond);
+  MergeBlockIntoPredecessor(tail, &updater, &loops);
+}
+
+/*!
+ *  The conditional branch guarding the given probe, if the probes are
+ *  guarded: the branch of the only predecessor of its block. Its condition
+ *  may not be a guard the pass understands (see isGuardValue()).
+ */
+static BranchInst *probeGuard(CallInst &call) {
+  if (!probesGuarded())
+    return nullptr;
+  BasicBlock *pred = probeBlock(call)->getSinglePredecessor();
+  auto *branch = pred ? dyn_cast<BranchInst>(pred->getTerminator()) : nullptr;
+  if (!branch || !branch->isConditional())
+    return nullptr;
+  return branch;
+}
+
+/*!
+ *  Whether the guards of all the probes of the group are understood, so
+ *  that they can be removed with the probes.
+ */
+static bool guardsUnderstood(ArrayRef<CallInst *> calls) {
+  for (CallInst *call : calls) {
+    SmallPtrSet<Value *, 8> visited;
+    BranchInst *guard = probeGuard(*call);
+    if (guard && !isGuardValue(guard->getCondition(), visited))
+      return false;
+  }
+  return true;
+}
+
+/*!
+ *  Erase the computation of a guard that no branch uses anymore, with the
+ *  state it updates (the stores of a sampling countdown, or the increment
+ *  of a depth counter and its restores on return): the loads of the flags,
+ *  atomic, would otherwise stay in the loop, and the countdown would keep
+ *  counting. Nothing is erased while any of it is used by something else.
+ */
+static void removeGuardCondition(Value *cond) {
+  auto *root = dyn_cast<Instruction>(cond);
+  if (!root)
+    return;
+  SmallSetVector<Instruction *, 16> computation;
+  SmallVector<Instruction *, 16> worklist{root};
+  while (!worklist.empty()) {
+    Instruction *inst = worklist.pop_back_val();
+    if (!computation.insert(inst) || isa<StoreInst>(inst))
+      continue;
+    if (!isa<LoadInst>(inst))
+      for (Value *operand : inst->operands())
+        if (auto *operandInst = dyn_cast<Instruction>(operand))
+          worklist.push_back(operandInst);
+    for (User *user : inst->users()) {
+      auto *userInst = cast<Instruction>(user);
+      auto *store = dyn_cast<StoreInst>(userInst);
+      if (store && store->getValueOperand() == inst &&
+          isGuardState(store->getPointerOperand()))
+        worklist.push_back(store);
+      else if (isGuardArithmetic(userInst))
+        worklist.push_back(userInst);
+      else
+        return;
+    }
+  }
+
+  SmallPtrSet<Value *, 16> visited;
+  for (Instruction *inst : computation)
+    if (!isa<StoreInst>(inst) && !isGuardValue(inst, visited))
+      return;
+  for (Instruction *inst : computation)
+    inst->dropAllReferences();
+  for (Instruction *inst : computation)
+    inst->eraseFromParent();
+}
+
+/*!
+ *  Remove the guard of a probe that was removed, if nothing else is left in
+ *  the guarded block, and the computation of its condition with its last
+ *  guard. The guarded block may still access the guard state, as the
+ *  restore of a depth counter merged into it, or the reloads of the state
+ *  after the probes, for the phis of the block it joins. It joins either
+ *  the block skipping it, or the successor of that block, which then has
+ *  its own restore:
+ *
+ *    br i1 %enabled, label %guarded, label %skip
+ *  guarded:
+ *    store i32 %depth, i32* @f.tau_depth
+ *    br label %join
+ *  skip:
+ *    store i32 %depth, i32* @f.tau_depth
+ *    br label %join
+ */
+static void removeProbeGuard(BranchInst *branch, BasicBlock *guarded,
+                             LoopInfo &loops, DomTreeUpdater &updater) {
+  BasicBlock *pred = branch->getParent();
+  BasicBlock *skip = branch->getSuccessor(branch->getSuccessor(0) == guarded);
+  BasicBlock *join = guarded->getSingleSuccessor();
+  if (!join || (join != skip && join != skip->getSingleSuccessor()))
+    return;
+  for (Instruction &inst : *guarded) {
+    if (inst.mayHaveSideEffects() && !isGuardAccess(inst))
+      return;
+    for (User *user : inst.users()) {
+      auto *userInst = cast<Instruction>(user);
+      if (userInst->getParent() != guarded &&
+          !(isa<PHINode>(userInst) && userInst->getParent() == join))
+        return;
+    }
+  }
+
+  Value *cond = branch->getCondition();
+  BranchInst::Create(skip, branch);
+  branch->eraseFromParent();
+  updater.applyUpdates({{DominatorTree::Delete, pred, guarded}});
+  loops.removeBlock(guarded);
+  DeleteDeadBlock(guarded, &updater);
+  removeGuardCondition(cond);
+}
+
+PreservedAnalyses TAULoopProbes::run(Function &func,
+                                     FunctionAnalysisManager &AM) {
+  bool Changed =
+      runOnFunction(func, AM.getResult<LoopAnalysis>(func),
+                    AM.getResult<DominatorTreeAnalysis>(func),
+                    AM.getResult<OptimizationRemarkEmitterAnalysis>(func));
+
+  return (Changed ? PreservedAnalyses::none() : PreservedAnalyses::all());
+}
+
+/*!
+ *  Handle the probes of each outermost loop: the probes found in inner
+ *  loops are dealt with at the level of the outermost one, so that they
+ *  are not just hoisted into another loop. With -tau-loop-probes=keep, as
+ *  when the pass is given in -passes without the option, nothing is done.
+ */
+bool TAULoopProbes::runOnFunction(Function &func, LoopInfo &loops,
+                                  DominatorTree &domTree,
+                                  OptimizationRemarkEmitter &remarks) {
+  if (TauLoopProbes == LoopProbes::Keep)
+    return false;
+  TimeRegion region(timer(&TAUTimers::loopProbes));
+  bool modified = false;
+  // Hoisting may add blocks to the function, not loops
+  SmallVector<Loop *, 8> outermost(loops.begin(), loops.end());
+  for (Loop *loop : outermost)
+    modified |= runOnLoop(*loop, loops, domTree, remarks);
+  return modified;
+}
+
+/*!
+ *  The argument to pass to the probes hoisted out of the loop, available
+ *  in its preheader, or nullptr if they cannot be hoisted. A handle that is
+ *  loaded in the loop is loaded again in the preheader, and one filled
+ *  lazily is filled there.
+ */
+Value *TAULoopProbes::hoistedArg(Loop &loop, ProbeGroup &group,
+                                 LoopInfo &loops, DominatorTree &domTree) {
+  BasicBlock *preheader = loop.getLoopPreheader();
+  if (!preheader || !loop.hasDedicatedExits())
+    return nullptr;
+
+  Value *arg = group.starts.front()->getArgOperand(0);
+  auto *argInst = dyn_cast<Instruction>(arg);
+  if (!argInst || domTree.dominates(argInst, preheader->getTerminator()))
+    return arg;
+
+  if (Optional<LazyFill> fill = lazyFill(argInst)) {
+    IRBuilder<> builder(preheader->getTerminator());
+    Instruction *handle = fill->handle->clone();
+    builder.Insert(handle);
+    Instruction *getTerm = SplitBlockAndInsertIfThen(
+        builder.CreateIsNull(handle), preheader->getTerminator(),
+        /*Unreachable=*/false, coldBranchWeights(preheader->getContext()),
+        &domTree, &loops);
+    Instruction *newHandle = fill->getHandle->clone();
+    newHandle->insertBefore(getTerm);
+    new StoreInst(newHandle, fill->handle->getPointerOperand(), getTerm);
+
+    builder.SetInsertPoint(loop.getLoopPreheader()->getTerminator());
+    PHINode *phi = builder.CreatePHI(handle->getType(), 2);
+    phi->addIncoming(handle, handle->getParent());
+    phi->addIncoming(newHandle, getTerm->getParent());
+    return phi;
+  }
+
+  auto *load = dyn_cast<LoadInst>(argInst);
+  if (!load || !load->isSimple() ||
+      !isa<GlobalVariable>(load->getPointerOperand()))
+    return nullptr;
+  Instruction *reload = load->clone();
+  reload->insertBefore(preheader->getTerminator());
+  return reload;
+}
+
+// A global to store a value back into, on the exits of a loop
+using RestoredGlobal = std::pair<GlobalVariable *, Value *>;
+
+/*!
+ *  Guard the probes hoisted before the loop as the given probes were
+ *  guarded in it: by the throttle flags of the function and by its depth,
+ *  the loop counting as a single activation. The depth counters are
+ *  incremented, their previous values to be stored back on each exit. The
+ *  sampling countdowns are left alone: the hoisted start is never sampled.
+ *
+ * \param enabled Whether the enable flag was set, nullptr without one
+ * \param restores Set to the depth counters with their previous values
+ * \return Whether the hoisted probes are called, nullptr if always
+ */
+static Value *hoistedGuard(ArrayRef<CallInst *> starts, Value *enabled,
+                           Instruction *insertPt,
+                           SmallVectorImpl<RestoredGlobal> &restores) {
+  SmallSetVector<GlobalVariable *, 4> state;
+  SmallPtrSet<Value *, 16> visited;
+  SmallVector<Value *, 16> worklist;
+  for (CallInst *start : starts)
+    if (BranchInst *guard = probeGuard(*start))
+      worklist.push_back(guard->getCondition());
+  while (!worklist.empty()) {
+    Value *value = worklist.pop_back_val();
+    if (!visited.insert(value).second)
+      continue;
+    if (auto *load = dyn_cast<LoadInst>(value)) {
+      GuardState kind = guardStateOf(load->getPointerOperand());
+      if (kind == GuardState::ThrottleFlag || kind == GuardState::Depth)
+        state.insert(cast<GlobalVariable>(
+            load->getPointerOperand()->stripPointerCasts()));
+      continue;
+    }
+    auto *inst = dyn_cast<Instruction>(value);
+    if (inst && isGuardArithmetic(inst))
+      append_range(worklist, inst->operands());
+  }
+
+  IRBuilder<> builder(insertPt);
+  for (GlobalVariable *global : state) {
+    LoadInst *value = builder.CreateLoad(global->getValueType(), global);
+    Value *cond;
+    if (guardStateOf(global) == GuardState::ThrottleFlag) {
+      value->setAtomic(AtomicOrdering::Monotonic);
+      value->setAlignment(Align(1));
+      cond = builder.CreateIsNull(value);
+    } else {
+      builder.CreateStore(
+          builder.CreateAdd(value, ConstantInt::get(value->getType(), 1)),
+          global);
+      restores.emplace_back(global, value);
+      cond = builder.CreateICmpULT(
+          value, ConstantInt::get(value->getType(), TauMaxDepth));
+    }
+    enabled = enabled ? builder.CreateAnd(enabled, cond) : cond;
+  }
+  return enabled;
+}
+
+/*!
+ *  Drop or hoist the probes found in the given loop, grouped by function.
+ *  The hoisted probes are replaced with:
+ *
+ *  preheader:
+ *    call @Tau_start(arg)
+ *  loop:
+ *    ; each start probe becomes ++calls
+ *  each exit:
+ *    call @Tau_loop_calls(arg, calls)
+ *    call @Tau_stop(arg)
+ *
+ *  The hoisted calls are guarded by the enable flag, the throttle flag and
+ *  the depth of the function as they were when entering the loop (see
+ *  hoistedGuard()).
+ */
+bool TAULoopProbes::runOnLoop(Loop &loop, LoopInfo &loops,
+                              DominatorTree &domTree,
+                              OptimizationRemarkEmitter &remarks) {
+  MapVector<Value *, ProbeGroup> groups;
+  for (BasicBlock *block : loop.blocks()) {
+    for (Instruction &inst : *block) {
+      auto *call = dyn_cast<CallInst>(&inst);
+      if (!call)
+        continue;
+      switch (probeCallKind(*call)) {
+      case ProbeCall::Start:
+        groups[probeKey(call->getArgOperand(0))].starts.push_back(call);
+        break;
+      case ProbeCall::Stop:
+        groups[probeKey(call->getArgOperand(0))].stops.push_back(call);
+        break;
+      case ProbeCall::None:
+        break;
+      }
+    }
+  }
+  if (groups.empty())
+    return false;
+
+  Function &func = *loop.getHeader()->getParent();
+  Module &module = *func.getParent();
+  auto &context = func.getContext();
+  auto *countTy = Type::getInt64Ty(context);
+  bool modified = false;
+  // Keeps the dominator tree valid for the promotion of the counters
+  DomTreeUpdater updater(domTree, DomTreeUpdater::UpdateStrategy::Eager);
+
+  // The counters of the calls are kept in allocas, which are promoted once
+  // all the groups are done
+  SmallVector<AllocaInst *, 4> counters;
+  // The hoisted calls, moved into guarded blocks once all the groups are
+  // done, and the enable flag as it was entering the loop
+  SmallVector<HoistedProbes, 4> hoisted;
+  Value *enabled = nullptr;
+
+  for (auto &keyAndGroup : groups) {
+    ProbeGroup &group = keyAndGroup.second;
+    std::string name = probeName(keyAndGroup.first);
+
+    if (group.starts.empty() || group.stops.empty()) {
+      remarks.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "UnbalancedProbes",
+                                        loop.getStartLoc(), loop.getHeader())
+               << "probes of " << name
+               << " kept in the loop: they are not balanced in it";
+      });
+      continue;
+    }
+    if (!guardsUnderstood(group.starts) || !guardsUnderstood(group.stops)) {
+      remarks.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "GuardedProbes",
+                                        loop.getStartLoc(), loop.getHeader())
+               << "probes of " << name
+               << " kept in the loop: their guard is not understood";
+      });
+      continue;
+    }
+
+    Value *arg = nullptr;
+    if (TauLoopProbes == LoopProbes::Hoist) {
+      arg = hoistedArg(loop, group, loops, domTree);
+      if (!arg) {
+        remarks.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "ProbesNotHoisted",
+                                          loop.getStartLoc(),
+                                          loop.getHeader())
+                 << "probes of " << name
+                 << " cannot be hoisted out of the loop, dropped instead";
+        });
+      }
+    }
+
+    if (arg) {
+      BasicBlock *preheader = loop.getLoopPreheader();
+      IRBuilder<> builder(&*func.getEntryBlock().getFirstInsertionPt());
+      AllocaInst *counter = builder.CreateAlloca(countTy, nullptr, "tau.calls");
+      counters.push_back(counter);
+
+      if (!TauEnableFlag.empty() && !enabled)
+        enabled = loadEnableFlag(module, preheader->getTerminator());
+      SmallVector<RestoredGlobal, 2> restores;
+      HoistedProbes probes;
+      probes.enabled = hoistedGuard(group.starts, enabled,
+                                    preheader->getTerminator(), restores);
+
+      // The hoisted start is never sampled: the loop is timed once, and
+      // all its calls are counted
+      ProbeFuncs funcs = probeFuncs();
+      auto startFunc = module.getOrInsertFunction(
+          funcs.start, Type::getVoidTy(context), arg->getType());
+      setProbeAttributes(startFunc, funcs.arg);
+      builder.SetInsertPoint(preheader->getTerminator());
+      builder.CreateStore(ConstantInt::get(countTy, 0), counter);
+      probes.start = builder.CreateCall(startFunc, {arg});
+
+      // Guarded calls are counted even if they are not called: the count is
+      // only reported if the hoisted probes are
+      for (CallInst *start : group.starts) {
+        BranchInst *guard = probeGuard(*start);
+        builder.SetInsertPoint(guard ? static_cast<Instruction *>(guard)
+                                     : start);
+        Value *calls = builder.CreateLoad(countTy, counter);
+        builder.CreateStore(
+            builder.CreateAdd(calls, ConstantInt::get(countTy, 1)), counter);
+      }
+
+      auto callsFunc =
+          module.getOrInsertFunction(funcs.loopCalls, Type::getVoidTy(context),
+                                     arg->getType(), countTy);
+      setProbeAttributes(callsFunc, funcs.arg);
+      SmallVector<BasicBlock *, 4> exits;
+      loop.getUniqueExitBlocks(exits);
+      for (BasicBlock *exit : exits) {
+        builder.SetInsertPoint(&*exit->getFirstInsertionPt());
+        for (RestoredGlobal &restore : restores)
+          builder.CreateStore(restore.second, restore.first);
+        Value *calls = builder.CreateLoad(countTy, counter);
+        CallInst *callsCall = builder.CreateCall(callsFunc, {arg, calls});
+        CallInst *stop = builder.CreateCall(
+            group.stops.front()->getFunctionType(),
+            group.stops.front()->getCalledOperand(), {arg});
+        probes.stops.emplace_back(callsCall, stop);
+      }
+      hoisted.push_back(std::move(probes));
+
+      remarks.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "ProbesHoisted",
+                                  loop.getStartLoc(), loop.getHeader())
+               << "probes of " << name
+               << " hoisted out of the loop, with a count of the calls";
+      });
+    } else if (TauLoopProbes == LoopProbes::Drop) {
+      remarks.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "ProbesDropped",
+                                  loop.getStartLoc(), loop.getHeader())
+               << "probes of " << name << " dropped from the loop";
+      });
+    }
+
+    SmallSetVector<std::pair<BranchInst *, BasicBlock *>, 4> guards;
+    SmallSetVector<BasicBlock *, 4> blocks;
+    for (CallInst *call : concat<CallInst *>(group.starts, group.stops)) {
+      if (BranchInst *guard = probeGuard(*call))
+        guards.insert({guard, probeBlock(*call)});
+      blocks.insert(call->getParent());
+    }
+    SmallVector<LazyFill, 2> fills;
+    for (BasicBlock *block : blocks)
+      for (PHINode &phi : block->phis())
+        if (Optional<LazyFill> fill = lazyFill(&phi))
+          fills.push_back(*fill);
+    for (CallInst *call : concat<CallInst *>(group.starts, group.stops))
+      call->eraseFromParent();
+    for (LazyFill &fill : fills)
+      removeLazyFill(fill, loops, updater);
+    for (auto &guardAndBlock : guards)
+      removeProbeGuard(guardAndBlock.first, guardAndBlock.second, loops,
+                       updater);
+    modified = true;
+  }
+
+  if (!counters.empty())
+    PromoteMemToReg(counters, domTree);
+
+  // Move the hoisted calls into guarded blocks, unlikely with an enable flag
+  // as in the function
+  MDNode *weights =
+      TauEnableFlag.empty() ? nullptr : coldBranchWeights(context);
+  for (HoistedProbes &probes : hoisted) {
+    if (!probes.enabled)
+      continue;
+    Instruction *then = SplitBlockAndInsertIfThen(
+        probes.enabled, probes.start, /*Unreachable=*/false, weights, &domTree,
+        &loops);
+    probes.start->moveBefore(then);
+    for (auto &callsAndStop : probes.stops) {
+      Instruction *then = SplitBlockAndInsertIfThen(
+          probes.enabled, callsAndStop.first, /*Unreachable=*/false, weights,
+          &domTree, &loops);
+      callsAndStop.first->moveBefore(then);
+      callsAndStop.second->moveBefore(then);
+    }
+  }
+  return modified;
+}
 
-  errs() << "in Instrument run\n";
+PreservedAnalyses TAUInstrument::run(Function &F, FunctionAnalysisManager &) {
 
   bool Changed = runOnFunction(F);
 
   return (Changed ? PreservedAnalyses::none() : PreservedAnalyses::all());
 }
 
+PreservedAnalyses TAUInstrumentModule::run(Module &M, ModuleAnalysisManager &) {
+
+  bool Changed = Impl.runOnModule(M);
+
+  return (Changed ? PreservedAnalyses::none() : PreservedAnalyses::all());
+}
+
+#if (LLVM_VERSION_MAJOR >= 15)
+PreservedAnalyses TAUInstrumentPrepare::run(Module &M,
+                                            ModuleAnalysisManager &) {
+
+  bool Changed = Impl->prepareAfterInlining(M);
+
+  return (Changed ? PreservedAnalyses::none() : PreservedAnalyses::all());
+}
+#endif
+
+PreservedAnalyses TAUInstrumentAfterInlining::run(Function &F,
+                                                  FunctionAnalysisManager &) {
+
+  bool Changed = Impl->runAfterInlining(F);
+
+  return (Changed ? PreservedAnalyses::none() : PreservedAnalyses::all());
+}
+
+PreservedAnalyses TAUInstrumentFinish::run(Module &M, ModuleAnalysisManager &) {
+
+  Impl->finishAfterInlining(M);
+
+  return PreservedAnalyses::none();
+}
+
 bool LegacyTAUInstrument::runOnFunction(Function &func) {
-  errs() << "in legacy run on function\n";
   bool Changed = Impl.runOnFunction(func);
 
   return Changed;
 }
 
+bool LegacyTAUInstrumentModule::runOnModule(Module &module) {
+  return Impl.runOnModule(module);
+}
+
+void LegacyTAULoopProbes::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+}
+
+bool LegacyTAULoopProbes::runOnFunction(Function &func) {
+  return Impl.runOnFunction(
+      func, getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+      getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+      getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE());
+}
+
 #if (LLVM_VERSION_MAJOR > 11)
+#if (LLVM_VERSION_MAJOR >= 14)
+using TAUOptLevel = llvm::OptimizationLevel;
+#else
+using TAUOptLevel = llvm::PassBuilder::OptimizationLevel;
+#endif
+
 PassPluginLibraryInfo getTAUInstrumentPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "tau-prof", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
-            errs() << "in pass registrating block \n";
-            errs() << CodeGenOpt::Level() << "\n";
+            // After inlining, the instrumentation of the pipeline being
+            // built, until the pass finishing the module takes it
+            auto afterInlining =
+                std::make_shared<std::shared_ptr<TAUInstrument>>();
+            // The extension point is chosen when the pipeline is built,
+            // after the command line has been parsed
             PB.registerPipelineStartEPCallback(
-                [](llvm::ModulePassManager &MPM,
-                   llvm::PassBuilder::OptimizationLevel OptLevelO3) {
-                  errs() << "adding pass to -O \n";
-                  MPM.addPass(
-                      createModuleToFunctionPassAdaptor(TAUInstrument()));
-                }); // supposed to allow instrumentation in standard
-            // optimisationi pipeline O3 but crashes build on LLVM V < 13
-            /*PB.registerPipelineParsingCallback(
+                [](llvm::ModulePassManager &MPM, TAUOptLevel OptLevelO3) {
+                  if (TauExtensionPoint != ExtensionPoint::PipelineStart)
+                    return;
+                  MPM.addPass(TAUInstrumentModule());
+                });
+            // Inlining is done by the CGSCC walk, bottom-up: a function
+            // instrumented at its end could still be inlined into its
+            // callers. VectorizerStart is the first function-level point
+            // after the whole walk. The module is prepared just before it
+            // (see TAUInstrument::runAfterInlining() before LLVM 15), and
+            // finished at the end of the pipeline.
+#if (LLVM_VERSION_MAJOR >= 15)
+            PB.registerOptimizerEarlyEPCallback(
+                [afterInlining](llvm::ModulePassManager &MPM, TAUOptLevel) {
+                  if (TauExtensionPoint != ExtensionPoint::AfterInlining)
+                    return;
+                  *afterInlining = std::make_shared<TAUInstrument>();
+                  MPM.addPass(TAUInstrumentPrepare(*afterInlining));
+                });
+#endif
+            PB.registerVectorizerStartEPCallback(
+                [afterInlining](llvm::FunctionPassManager &FPM, TAUOptLevel) {
+                  if (TauLoopProbes != LoopProbes::Keep)
+                    FPM.addPass(TAULoopProbes());
+                  if (TauExtensionPoint == ExtensionPoint::AfterInlining) {
+                    if (!*afterInlining)
+                      *afterInlining = std::make_shared<TAUInstrument>();
+                    FPM.addPass(TAUInstrumentAfterInlining(*afterInlining));
+                  }
+                });
+            PB.registerOptimizerLastEPCallback(
+                [afterInlining](llvm::ModulePassManager &MPM, TAUOptLevel) {
+                  if (TauExtensionPoint == ExtensionPoint::AfterInlining &&
+                      *afterInlining)
+                    MPM.addPass(TAUInstrumentFinish(std::move(*afterInlining)));
+                  if (TauExtensionPoint != ExtensionPoint::OptimizerLast)
+                    return;
+                  MPM.addPass(TAUInstrumentModule());
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "tau-prof") {
+                    MPM.addPass(TAUInstrumentModule());
+                    return true;
+                  }
+                  return false;
+                });
+            PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
                   if (Name == "tau-prof") {
                     FPM.addPass(TAUInstrument());
-                    errs() << "pass added\n";
+                    return true;
+                  }
+                  if (Name == "tau-loop-probes") {
+                    FPM.addPass(TAULoopProbes());
                     return true;
                   }
                   return false;
-                });*/
+                });
             /*PB.registerShouldRunOptionalPassCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -554,10 +2986,45 @@ static RegisterPass<LegacyTAUInstrument>
     X("legacy-tau-prof", "Legacy TAU Profiling", false, false);
 // Automatically enable the pass.
 // http://adriansampson.net/blog/clangpass.html
+// It is registered at every extension point matching a value of
+// -tau-extension-point, and only added at the chosen one.
+template <ExtensionPoint EP>
 static void registerLegacyTAUInstrumentPass(const PassManagerBuilder &,
                                             legacy::PassManagerBase &PM) {
-  PM.add(new LegacyTAUInstrument());
+  if (TauExtensionPoint == EP)
+    PM.add(new LegacyTAUInstrument());
+}
+static RegisterStandardPasses RegisterMyPass(
+    PassManagerBuilder::EP_EarlyAsPossible,
+    registerLegacyTAUInstrumentPass<ExtensionPoint::PipelineStart>);
+// The passes of EP_VectorizerStart are added to the module pass manager:
+// after inlining, the whole module pass runs there.
+char LegacyTAUInstrumentModule::ID = 0;
+
+static RegisterPass<LegacyTAUInstrumentModule>
+    XM("legacy-tau-prof-module", "Legacy TAU Profiling (module)", false,
+       false);
+static void registerLegacyTAUInstrumentModulePass(const PassManagerBuilder &,
+                                                  legacy::PassManagerBase &PM) {
+  if (TauExtensionPoint == ExtensionPoint::AfterInlining)
+    PM.add(new LegacyTAUInstrumentModule());
+}
+static RegisterStandardPasses
+    RegisterAfterInlining(PassManagerBuilder::EP_VectorizerStart,
+                          registerLegacyTAUInstrumentModulePass);
+static RegisterStandardPasses RegisterOptimizerLast(
+    PassManagerBuilder::EP_OptimizerLast,
+    registerLegacyTAUInstrumentPass<ExtensionPoint::OptimizerLast>);
+
+char LegacyTAULoopProbes::ID = 0;
+
+static RegisterPass<LegacyTAULoopProbes>
+    Y("legacy-tau-loop-probes", "Legacy TAU Loop Probes", false, false);
+static void registerLegacyTAULoopProbesPass(const PassManagerBuilder &,
+                                            legacy::PassManagerBase &PM) {
+  if (TauLoopProbes != LoopProbes::Keep)
+    PM.add(new LegacyTAULoopProbes());
 }
 static RegisterStandardPasses
-    RegisterMyPass(PassManagerBuilder::EP_EarlyAsPossible,
-                   registerLegacyTAUInstrumentPass);
+    RegisterLoopProbes(PassManagerBuilder::EP_VectorizerStart,
+                       registerLegacyTAULoopProbesPass);
@@ -1,11 +1,25 @@
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/Allocator.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "TAUGlobMatcher.h"
+#include "TAUNameTable.h"
+
 using namespace llvm;
 
 namespace {
@@ -32,56 +46,470 @@ static cl::opt<std::string> TauStopFunc(
         "Specify the profiling function to call after functions of interest"),
     cl::value_desc("Function name"), cl::init("Tau_stop"));
 
+/* Where the pass is added to the standard pipelines */
+enum class ExtensionPoint { PipelineStart, AfterInlining, OptimizerLast, None };
+
+static cl::opt<ExtensionPoint> TauExtensionPoint(
+    "tau-extension-point",
+    cl::desc("Choose where the instrumentation runs in the optimization "
+             "pipeline"),
+    cl::init(ExtensionPoint::PipelineStart),
+    cl::values(
+        clEnumValN(ExtensionPoint::PipelineStart, "pipeline-start",
+                   "Before any optimization (default)"),
+        clEnumValN(ExtensionPoint::AfterInlining, "after-inlining",
+                   "After inlining, before the loop vectorizer: only the "
+                   "functions that were not inlined everywhere are "
+                   "instrumented"),
+        clEnumValN(ExtensionPoint::OptimizerLast, "optimizer-last",
+                   "At the end of the optimization pipeline"),
+        clEnumValN(ExtensionPoint::None, "none",
+                   "Not added: run it as tau-prof with -passes")));
+
+/* How the probes call the runtime */
+enum class ProbeBackendKind {
+  TauNames,
+  TauHandles,
+  TauIds,
+  Rtlib,
+  InlineCounters
+};
+
+static cl::opt<ProbeBackendKind> TauProbeBackend(
+    "tau-probe-backend",
+    cl::desc("Choose how the probes call the runtime"),
+    cl::init(ProbeBackendKind::TauNames),
+    cl::values(
+        clEnumValN(ProbeBackendKind::TauNames, "tau-names",
+                   "Pass the name of the function to Tau_start and Tau_stop "
+                   "(default)"),
+        clEnumValN(ProbeBackendKind::TauHandles, "tau-handles",
+                   "Pass a per-function timer handle to Tau_start_handle and "
+                   "Tau_stop_handle (filled as -tau-probe-handles says, from "
+                   "a constructor by default)"),
+        clEnumValN(ProbeBackendKind::TauIds, "tau-ids",
+                   "Pass a stable 64-bit id of the function to Tau_start_id "
+                   "and Tau_stop_id, described in the tau_functions section "
+                   "(given to the runtime by a constructor with the module "
+                   "pass)"),
+        clEnumValN(ProbeBackendKind::Rtlib, "rtlib",
+                   "Pass the name, or the handle with -tau-probe-handles, to "
+                   "the callbacks of sandbox/rtlib.c"),
+        clEnumValN(ProbeBackendKind::InlineCounters, "inline-counters",
+                   "Count the calls and cycles of each function inline, in "
+                   "thread-local counters the runtime is given (only with "
+                   "the module pass)")));
+
+/* How the probes refer to the instrumented function */
+enum class ProbeHandles { None, Lazy, Ctor };
+
+static cl::opt<ProbeHandles> TauProbeHandles(
+    "tau-probe-handles",
+    cl::desc("Pass a per-function timer handle to the probes instead of the "
+             "name of the function"),
+    cl::init(ProbeHandles::None),
+    cl::values(
+        clEnumValN(ProbeHandles::None, "none",
+                   "Pass the name of the function (default)"),
+        clEnumValN(ProbeHandles::Lazy, "lazy",
+                   "Fill each handle on the first call of its function"),
+        clEnumValN(ProbeHandles::Ctor, "ctor",
+                   "Fill all the handles of a module from a constructor")));
+
+static cl::opt<std::string> TauHandleGetFunc(
+    "tau-handle-get-func",
+    cl::desc("Specify the profiling function returning the handle of a name"),
+    cl::value_desc("Function name"), cl::init("Tau_get_handle"));
+
+static cl::opt<std::string> TauHandleRegisterFunc(
+    "tau-handle-register-func",
+    cl::desc("Specify the profiling function filling a table of handles"),
+    cl::value_desc("Function name"), cl::init("Tau_register_handles"));
+
+static cl::opt<std::string> TauHandleStartFunc(
+    "tau-handle-start-func",
+    cl::desc("Specify the profiling function to call with a handle before "
+             "functions of interest"),
+    cl::value_desc("Function name"), cl::init("Tau_start_handle"));
+
+static cl::opt<std::string> TauHandleStopFunc(
+    "tau-handle-stop-func",
+    cl::desc("Specify the profiling function to call with a handle after "
+             "functions of interest"),
+    cl::value_desc("Function name"), cl::init("Tau_stop_handle"));
+
+static cl::opt<std::string> TauIdStartFunc(
+    "tau-id-start-func",
+    cl::desc("Specify the profiling function to call with an id before "
+             "functions of interest"),
+    cl::value_desc("Function name"), cl::init("Tau_start_id"));
+
+static cl::opt<std::string> TauIdStopFunc(
+    "tau-id-stop-func",
+    cl::desc("Specify the profiling function to call with an id after "
+             "functions of interest"),
+    cl::value_desc("Function name"), cl::init("Tau_stop_id"));
+
+static cl::opt<std::string> TauIdRegisterFunc(
+    "tau-id-register-func",
+    cl::desc("Specify the profiling function given the tau_functions section "
+             "of a program or library"),
+    cl::value_desc("Function name"), cl::init("Tau_register_ids"));
+
+/* What the optimizer may assume about the probes */
+enum class ProbeAttrs { None, NoUnwind, InaccessibleMem };
+
+static cl::opt<ProbeAttrs> TauProbeAttrs(
+    "tau-probe-attrs",
+    cl::desc("Declare the profiling functions with attributes describing "
+             "what the runtime does, so that the code around the probes "
+             "can still be optimized"),
+    cl::init(ProbeAttrs::None),
+    cl::values(
+        clEnumValN(ProbeAttrs::None, "none",
+                   "Any runtime: no assumption (default)"),
+        clEnumValN(ProbeAttrs::NoUnwind, "nounwind",
+                   "The profiling functions never throw"),
+        clEnumValN(ProbeAttrs::InaccessibleMem, "inaccessiblemem",
+                   "Runtimes such as TAU's: the profiling functions never "
+                   "throw, always return, never call back into the program "
+                   "and only access their own memory and read the name "
+                   "they are passed")));
+
+/* What to do with the probes found in loops */
+enum class LoopProbes { Keep, Drop, Hoist };
+
+static cl::opt<LoopProbes> TauLoopProbes(
+    "tau-loop-probes",
+    cl::desc("Remove or hoist the probes of inlined functions found in "
+             "loops, before the loop vectorizer, and report each decision as "
+             "an optimization remark (nothing is done with keep)"),
+    cl::init(LoopProbes::Keep),
+    cl::values(clEnumValN(LoopProbes::Keep, "keep",
+                          "Leave them in the loops (default)"),
+               clEnumValN(LoopProbes::Drop, "drop", "Remove them"),
+               clEnumValN(LoopProbes::Hoist, "hoist",
+                          "Replace them with a single timer around the "
+                          "outermost loop and count the calls")));
+
+static cl::opt<std::string> TauLoopCallsFunc(
+    "tau-loop-calls-func",
+    cl::desc("Specify the profiling function given the number of calls of a "
+             "function whose probes were hoisted out of a loop (by default, "
+             "the one of the probe backend)"),
+    cl::value_desc("Function name"), cl::init("Tau_loop_calls"));
+
+static cl::opt<std::string> TauEnableFlag(
+    "tau-enable-flag",
+    cl::desc("Only call the profiling functions while this global char is "
+             "non-zero (defined as a weak 0 if the program does not)"),
+    cl::value_desc("Variable name"), cl::init(""));
+
+static cl::opt<unsigned> TauSamplePeriod(
+    "tau-sample-period",
+    cl::desc("Only time one call in this many of each instrumented function, "
+             "counted down in a thread-local counter; the runtime scales the "
+             "results (0 or 1: time every call; tau-names and tau-handles "
+             "backends only)"),
+    cl::value_desc("calls"), cl::init(0));
+
+static cl::opt<std::string> TauSampledStartFunc(
+    "tau-sampled-start-func",
+    cl::desc("Specify the profiling function to call, with the sampling "
+             "period, before the sampled calls of functions of interest"),
+    cl::value_desc("Function name"), cl::init("Tau_start_sampled"));
+
+static cl::opt<std::string> TauHandleSampledStartFunc(
+    "tau-handle-sampled-start-func",
+    cl::desc("Specify the profiling function to call with a handle and the "
+             "sampling period before the sampled calls of functions of "
+             "interest"),
+    cl::value_desc("Function name"), cl::init("Tau_start_handle_sampled"));
+
+static cl::opt<unsigned> TauMaxDepth(
+    "tau-max-depth",
+    cl::desc("Only call the probes of the outermost activations of each "
+             "instrumented function, up to this many nested in each other, "
+             "counted in a thread-local counter (0: all of them)"),
+    cl::value_desc("activations"), cl::init(0));
+
+static cl::opt<bool> TauThrottle(
+    "tau-throttle",
+    cl::desc("Give each instrumented function a flag, checked before its "
+             "probes are called, that the runtime sets once the function is "
+             "throttled (only with the module pass, an error otherwise)"));
+
+static cl::opt<std::string> TauThrottleRegisterFunc(
+    "tau-throttle-register-func",
+    cl::desc("Specify the profiling function given the throttle flags of a "
+             "module"),
+    cl::value_desc("Function name"), cl::init("Tau_register_throttle"));
+
+static cl::opt<std::string> TauInlineRegisterFunc(
+    "tau-inline-register-func",
+    cl::desc("Specify the profiling function given the inline counters of a "
+             "module in a thread"),
+    cl::value_desc("Function name"), cl::init("Tau_inline_register"));
+
 static cl::opt<std::string> TauRegex(
     "tau-regex",
-    cl::desc("Specify a regex to identify functions interest (case-sensitive)"),
+    cl::desc("Specify a regex to identify functions interest (case-sensitive); "
+             "the exclude list of the input file still applies"),
     cl::value_desc("Regular Expression"), cl::init(""));
 
 static cl::opt<std::string> TauIRegex(
     "tau-iregex",
-    cl::desc(
-        "Specify a regex to identify functions interest (case-insensitive)"),
+    cl::desc("Specify a regex to identify functions interest "
+             "(case-insensitive); the exclude list of the input file still "
+             "applies"),
     cl::value_desc("Regular Expression"), cl::init(""));
 
+static cl::opt<bool> TauMangledLookup(
+    "tau-mangled-lookup",
+    cl::desc("Convert the exact function names of the input file to mangled "
+             "names, so that functions are only demangled when needed"));
+
+static cl::opt<std::string> TauListCacheDir(
+    "tau-list-cache-dir",
+    cl::desc("Directory where the compiled form of the input file is cached, "
+             "so that other compilations map it instead of parsing it"),
+    cl::value_desc("directory"));
+
+static cl::opt<unsigned> TauMinCost(
+    "tau-min-cost",
+    cl::desc("Do not instrument the functions whose static cost is lower, "
+             "unless their exact name is in the include list (0: instrument "
+             "them all)"),
+    cl::value_desc("cost"), cl::init(0));
+
+static cl::opt<unsigned> TauCallCost(
+    "tau-call-cost",
+    cl::desc("Static cost of a call, in instructions, for -tau-min-cost"),
+    cl::value_desc("cost"), cl::init(25));
+
+static cl::opt<unsigned> TauLoopCost(
+    "tau-loop-cost",
+    cl::desc("Static cost of a loop, in instructions, for -tau-min-cost"),
+    cl::value_desc("cost"), cl::init(100));
+
 static cl::opt<bool>
     TauDryRun("tau-dry-run",
               cl::desc("Don't actually instrument the code, just print "
                        "what would be instrumented"));
 
+static cl::opt<bool>
+    TauVerbose("tau-verbose",
+               cl::desc("Print the input file as it is read and the "
+                        "decision taken for each function"));
+
+static cl::opt<bool> TauTimeReport(
+    "tau-time-report",
+    cl::desc("Print at exit the time spent in each step of the "
+             "instrumentation (reading the list, demangling, matching...)"));
+
+/* The rule that decided whether a function is instrumented */
+enum class Rule {
+  NotListed,       // matched by no include entry
+  NoName,          // cannot be demangled
+  FileFilter,      // the file it is defined in is not instrumented
+  ExactInclude,    // exact name in the include list
+  WildcardInclude, // wildcard entry of the include list
+  Regex,           // -tau-regex or -tau-iregex
+  ExactExclude,    // exact name in the exclude list
+  WildcardExclude, // wildcard entry of the exclude list
+  MinCost          // below -tau-min-cost
+};
+
+/* Whether a function is instrumented, and why */
+struct Decision {
+  bool instrument;
+  Rule rule;
+  std::string reason; // details of the rule, if any
+};
+
+/*!
+ * Demangled names of the functions of a module. Each symbol is demangled at
+ * most once, and the names are kept in a bump allocator that is released all
+ * at once when the module is done.
+ */
+class DemangleCache {
+public:
+  StringRef get(StringRef mangled);
+  void clear();
+
+private:
+  // Both the keys and the demangled names live in the map's allocator
+  StringMap<StringRef, BumpPtrAllocator> names;
+};
+
+/*!
+ * The names of the functions the module pass instruments in a module,
+ * packed in a single table of NUL-terminated strings: each name is stored
+ * once, and a name that ends another one points into it (tail merging).
+ * The probes refer to a name by its offset in the table rather than each
+ * getting a string global of its own.
+ */
+class ProbeNameTable {
+public:
+  void build(Module &module, ArrayRef<StringRef> names);
+  Constant *get(StringRef name) const;
+  void clear();
+
+private:
+  GlobalVariable *table = nullptr;
+  StringMap<uint64_t> offsets;
+};
+
+/*!
+ * A global given to the runtime by a module constructor, with the name of
+ * its function. After inlining, the optimizer may delete both before the
+ * module is finished: the handles then become null, and the entry is
+ * skipped.
+ */
+using RegisteredGlobal = std::pair<WeakTrackingVH, WeakTrackingVH>;
+
+/*!
+ * How the probes call the runtime. The instrumentation pass chooses the
+ * functions, guards their probes (enable flag, sampling, throttle flags,
+ * maximum depth) and asks the backend of -tau-probe-backend to emit them:
+ * once on entry, then at each return, under the same guards.
+ */
+class ProbeBackend {
+public:
+  virtual ~ProbeBackend() = default;
+
+  /// Whether the entry probe may split its block: it is then put after the
+  /// allocas of the entry block.
+  virtual bool splitsBlocks() const { return false; }
+
+  /// Whether the probes can only be emitted by the module pass.
+  virtual bool needsModulePass() const { return false; }
+
+  /// Whether the calls can be sampled: the entry probe is then given the
+  /// number of calls the call stands for.
+  virtual bool canSample() const { return false; }
+
+  /// Prepare a module the module pass chose \p functions functions of. Only
+  /// globals and declarations are added: after inlining, this may run from
+  /// the function pass, which must not see new functions.
+  virtual void prepareModule(Module &module, unsigned functions) {}
+
+  /// The module prepared will only be finished at the end of the pipeline,
+  /// after inlining: what nothing refers to must be kept from being deleted
+  /// in the meantime.
+  virtual void finishLater() {}
+
+  /// Emit the entry probe of \p func before \p insertPt, updated if the
+  /// block is split. \p weight is the sampling weight, if sampling;
+  /// \p guarded tells whether the returns are guarded as well.
+  virtual void enterFunction(Function &func, Constant *name,
+                             Instruction *&insertPt, Value *weight,
+                             bool guarded) = 0;
+
+  /// Emit the probe of one of the returns of the function.
+  virtual void exitFunction(Instruction *insertPt) = 0;
+
+  /// All the probes of the function were emitted.
+  virtual void finishFunction(Function &func) {}
+
+  /// Add what the module pass needs at the end: tables, constructors...
+  virtual void finishModule(Module &module) {}
+
+  /// Forget the current module.
+  virtual void leaveModule() = 0;
+};
+
+std::unique_ptr<ProbeBackend> createProbeBackend();
+
 struct TAUInstrument : public PassInfoMixin<TAUInstrument> {
 
-  StringSet<> funcsOfInterest;
-  StringSet<> funcsExcl;
-  // StringSet<> funcsOfInterestRegex;
-  // StringSet<> funcsExclRegex;
-  std::vector<std::regex> funcsOfInterestRegex;
-  std::vector<std::regex> funcsExclRegex;
+  /* Tags of the wildcard entries in the matchers */
+  enum PatternTag : unsigned { IncludeTag = 1 << 0, ExcludeTag = 1 << 1 };
+
+  /* Lists of the exact names, as bits of the masks in exactNames */
+  enum NameKind : unsigned {
+    FuncInclude = 1 << 0,
+    FuncExclude = 1 << 1,
+    // Mangled counterparts of the exact names, with -tau-mangled-lookup
+    FuncIncludeMangled = 1 << 2,
+    FuncExcludeMangled = 1 << 3,
+    FileInclude = 1 << 4,
+    FileExclude = 1 << 5
+  };
 
-  StringSet<> filesIncl;
-  StringSet<> filesExcl;
-  // StringSet<> filesInclRegex;
-  //  StringSet<> filesExclRegex;
-  std::vector<std::regex> filesInclRegex;
-  std::vector<std::regex> filesExclRegex;
+  TAUNameTable exactNames;
+  // Number of exact names that could not be mangled
+  unsigned funcsOfInterestUnmangled = 0;
+  unsigned funcsExclUnmangled = 0;
+  // Wildcard entries of both the include and exclude lists
+  TAUGlobMatcher funcsPatterns;
+  TAUGlobMatcher filesPatterns;
+
+  // Backing storage of exactNames when loaded from the list cache
+  std::unique_ptr<MemoryBuffer> listCache;
 
   // basic ==> POSIX regular expression
   std::regex rex{TauRegex, std::regex_constants::ECMAScript};
   std::regex irex{TauIRegex, std::regex_constants::ECMAScript |
                                  std::regex_constants::icase};
 
-  void loadFunctionsFromFile(std::ifstream &file);
+#if (LLVM_VERSION_MAJOR <= 8)
+  using ProbeCallee = Constant *;
+#else
+  using ProbeCallee = FunctionCallee;
+#endif
+
+  // Per-module state, reset by enterModule()
+  const Module *currentModule = nullptr;
+  DemangleCache demangled;
+  // Decision of the file filters for each DIFile (nullptr: the main source)
+  DenseMap<const DIFile *, bool> fileDecisions;
+  // With -tau-throttle: whether the throttle flags are registered by a
+  // module constructor (only from the module pass), and the flags to
+  // register with the names of their functions
+  bool registerThrottle = false;
+  SmallVector<RegisteredGlobal, 16> throttleFlags;
+  // The names of the functions the module pass chose
+  ProbeNameTable probeNames;
+  // After inlining: the names of the functions chosen when the module was
+  // prepared, since the optimizer may delete some of them before the module
+  // is finished
+  StringSet<> chosenFunctions;
+  // Emits the probes; its per-module state is reset by leaveModule()
+  std::unique_ptr<ProbeBackend> probes = createProbeBackend();
+
+  void loadInputFile();
+  std::string listCachePath(StringRef contents);
+  bool loadListCache(const std::string &path);
+  void saveListCache(const std::string &path);
+  void loadFunctionsFromFile(std::istream &file);
+  void enterModule(Module &module);
+  void leaveModule();
+  StringRef prettyName(Function &func);
+  bool mayInstrument() const;
+  bool fileFits(StringRef filename);
+  bool functionFileFits(Function &func);
+  Decision functionFits(Function &func);
   bool maybeSaveForProfiling(Function &call);
-  bool regexFits(const StringRef &name, std::vector<std::regex> &regexList,
-                 bool cli = false);
+  void reportDecision(Function &func, const Decision &decision);
+  bool cliRegexFits(StringRef name);
+  bool mangledLookupRejects(Function &func, Rule &rule);
+  void addMangledName(StringRef funcName, unsigned tag);
+  bool cannotSample(LLVMContext &context);
+  bool needsModulePass(Function &func);
+  bool prepareModule(Module &module, SmallVectorImpl<Function *> &chosen);
+  void finishModule(Module &module);
   bool addInstrumentation(Function &func);
-  void readUntilToken(std::ifstream &file, StringSet<> &vec,
-                      std::vector<std::regex> &vecReg, const char *token);
+  Value *loadThrottleFlag(Function &func, Constant *name,
+                          Instruction *insertPt);
+  void addThrottleConstructor(Module &module);
+  void readUntilToken(std::istream &file, unsigned kind,
+                      TAUGlobMatcher &patterns, unsigned tag,
+                      const char *token);
 
   TAUInstrument() {
     if (!TauInputFile.empty()) {
-      std::ifstream ifile{TauInputFile};
-      loadFunctionsFromFile(ifile);
-      errs() << "functions were loaded from file \n";
+      loadInputFile();
     }
   }
 
@@ -89,6 +517,95 @@ struct TAUInstrument : public PassInfoMixin<TAUInstrument> {
   PreservedAnalyses run(Function &func, FunctionAnalysisManager &AM);
 
   bool runOnFunction(Function &func);
+  bool runOnModule(Module &module);
+  bool prepareAfterInlining(Module &module);
+  bool runAfterInlining(Function &func);
+  void finishAfterInlining(Module &module);
+};
+
+/*!
+ * The instrumentation pass, run once per module: the file filters are
+ * resolved once per source file, modules that cannot contain anything to
+ * instrument are skipped, and the probe functions are declared once.
+ */
+struct TAUInstrumentModule : public PassInfoMixin<TAUInstrumentModule> {
+  PreservedAnalyses run(Module &module, ModuleAnalysisManager &AM);
+
+  TAUInstrument Impl;
+};
+
+/*!
+ * Prepares the module with -tau-extension-point=after-inlining, before the
+ * function passes of VectorizerStart: the functions are chosen, and the
+ * globals their probes need are added, as by the module pass.
+ * TAUInstrumentAfterInlining and TAUInstrumentFinish share the
+ * instrumentation.
+ */
+#if (LLVM_VERSION_MAJOR >= 15)
+struct TAUInstrumentPrepare : public PassInfoMixin<TAUInstrumentPrepare> {
+  explicit TAUInstrumentPrepare(std::shared_ptr<TAUInstrument> Impl)
+      : Impl(std::move(Impl)) {}
+  PreservedAnalyses run(Module &module, ModuleAnalysisManager &AM);
+
+  std::shared_ptr<TAUInstrument> Impl;
+};
+#endif
+
+/*!
+ * The instrumentation pass with -tau-extension-point=after-inlining, a
+ * function pass instrumenting the functions TAUInstrumentPrepare chose. The
+ * module is finished by TAUInstrumentFinish at the end of the pipeline.
+ */
+struct TAUInstrumentAfterInlining
+    : public PassInfoMixin<TAUInstrumentAfterInlining> {
+  explicit TAUInstrumentAfterInlining(std::shared_ptr<TAUInstrument> Impl)
+      : Impl(std::move(Impl)) {}
+  PreservedAnalyses run(Function &func, FunctionAnalysisManager &AM);
+
+  std::shared_ptr<TAUInstrument> Impl;
+};
+
+/*!
+ * Adds the tables and constructors of the module instrumented after
+ * inlining.
+ */
+struct TAUInstrumentFinish : public PassInfoMixin<TAUInstrumentFinish> {
+  explicit TAUInstrumentFinish(std::shared_ptr<TAUInstrument> Impl)
+      : Impl(std::move(Impl)) {}
+  PreservedAnalyses run(Module &module, ModuleAnalysisManager &AM);
+
+  std::shared_ptr<TAUInstrument> Impl;
+};
+
+/*!
+ * Looks for the probes that were inlined into loops, and drops them or
+ * hoists them out of the loops according to -tau-loop-probes. Each decision
+ * is reported as an optimization remark.
+ */
+struct TAULoopProbes : public PassInfoMixin<TAULoopProbes> {
+  PreservedAnalyses run(Function &func, FunctionAnalysisManager &AM);
+
+  bool runOnFunction(Function &func, LoopInfo &loops, DominatorTree &domTree,
+                     OptimizationRemarkEmitter &remarks);
+
+private:
+  // The probes of one instrumented function in a loop
+  struct ProbeGroup {
+    SmallVector<CallInst *, 2> starts;
+    SmallVector<CallInst *, 2> stops;
+  };
+  // The probes hoisted out of a loop, with the calls on each exit and
+  // their guard (nullptr if they are not guarded)
+  struct HoistedProbes {
+    CallInst *start = nullptr;
+    SmallVector<std::pair<CallInst *, CallInst *>, 2> stops;
+    Value *enabled = nullptr;
+  };
+
+  bool runOnLoop(Loop &loop, LoopInfo &loops, DominatorTree &domTree,
+                 OptimizationRemarkEmitter &remarks);
+  Value *hoistedArg(Loop &loop, ProbeGroup &group, LoopInfo &loops,
+                    DominatorTree &domTree);
 };
 
 /*!
@@ -104,4 +621,32 @@ struct LegacyTAUInstrument : public FunctionPass {
   TAUInstrument Impl;
 };
 
+/*!
+ * The instrumentation pass run once per module, for the legacy pass manager
+ * after inlining, where the passes are added to the module pass manager.
+ */
+struct LegacyTAUInstrumentModule : public ModulePass {
+
+  static char ID; // Pass identification, replacement for typeid
+
+  LegacyTAUInstrumentModule() : ModulePass(ID) {}
+  bool runOnModule(Module &module) override;
+
+  TAUInstrument Impl;
+};
+
+/*!
+ * The loop probes pass, for the legacy pass manager.
+ */
+struct LegacyTAULoopProbes : public FunctionPass {
+
+  static char ID; // Pass identification, replacement for typeid
+
+  LegacyTAULoopProbes() : FunctionPass(ID) {}
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnFunction(Function &func) override;
+
+  TAULoopProbes Impl;
+};
+
 } // namespace
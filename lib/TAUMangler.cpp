@@ -0,0 +1,500 @@
+//===- TAUMangler.cpp - Mangle exact function prototypes ------------------===//
+//
+// A small recursive-descent parser for the subset of demangled prototypes
+// described in TAUMangler.h, followed by an Itanium mangler that implements
+// the substitution rules for that subset.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
+
+#include "TAUMangler.h"
+
+using namespace llvm;
+
+namespace {
+
+struct TypeNode;
+
+struct TemplateArg {
+  std::unique_ptr<TypeNode> type; // either a type...
+  std::string literal;            // ... or an already mangled literal
+  std::string text;
+};
+
+struct NameComponent {
+  std::string id;
+  bool isTemplate = false;
+  std::vector<TemplateArg> args;
+};
+
+enum Qualifiers : unsigned { Const = 1 << 0, Volatile = 1 << 1 };
+
+/*
+ * A type is a base (built-in or class) followed by layers applied from the
+ * inside out: cv-qualifiers, pointers and references.
+ */
+struct TypeNode {
+  std::string builtin; // mangled code of a built-in base
+  std::string builtinText;
+  std::vector<NameComponent> name; // class base
+  struct Layer {
+    char kind; // 'K' (cv-qualifiers), 'P', 'R' or 'O'
+    unsigned cv;
+  };
+  std::vector<Layer> layers;
+};
+
+struct Prototype {
+  std::vector<NameComponent> name;
+  std::vector<std::unique_ptr<TypeNode>> params;
+  bool variadic = false;
+  unsigned cv = 0;
+  char refQualifier = 0;
+};
+
+class Parser {
+public:
+  explicit Parser(StringRef text) : text(text) { next(); }
+
+  bool parsePrototype(Prototype &proto);
+
+private:
+  StringRef text;
+  StringRef token;
+  bool failed = false;
+
+  void next();
+  bool accept(StringRef t) {
+    if (token != t)
+      return false;
+    next();
+    return true;
+  }
+  static bool isIdentifier(StringRef t) {
+    return !t.empty() && (isalpha(t[0]) || t[0] == '_');
+  }
+  static bool isNumber(StringRef t) { return !t.empty() && isdigit(t[0]); }
+
+  unsigned parseQualifiers();
+  bool parseName(std::vector<NameComponent> &name);
+  bool parseTemplateArgs(NameComponent &comp);
+  std::unique_ptr<TypeNode> parseType();
+};
+
+void Parser::next() {
+  text = text.ltrim(' ');
+  if (text.empty()) {
+    token = StringRef();
+    return;
+  }
+  size_t len = 1;
+  char c = text[0];
+  if (isalpha(c) || c == '_') {
+    while (len < text.size() && (isalnum(text[len]) || text[len] == '_'))
+      ++len;
+  } else if (isdigit(c)) {
+    while (len < text.size() && isalnum(text[len]))
+      ++len;
+  } else if (text.startswith("::") || text.startswith("&&")) {
+    len = 2;
+  } else if (text.startswith("...")) {
+    len = 3;
+  } else if (StringRef("<>(),*&-").find(c) == StringRef::npos) {
+    /* Anything else (operators, lambdas, abi tags...) is not supported */
+    failed = true;
+  }
+  token = text.take_front(len);
+  text = text.drop_front(len);
+}
+
+unsigned Parser::parseQualifiers() {
+  unsigned cv = 0;
+  for (;;) {
+    if (accept("const"))
+      cv |= Const;
+    else if (accept("volatile"))
+      cv |= Volatile;
+    else
+      return cv;
+  }
+}
+
+bool Parser::parseName(std::vector<NameComponent> &name) {
+  do {
+    if (!isIdentifier(token) || token == "operator" || token == "const" ||
+        token == "volatile")
+      return false;
+    /* The standard library uses abbreviations we do not implement */
+    if (name.empty() && token == "std")
+      return false;
+    name.emplace_back();
+    name.back().id = token.str();
+    next();
+    if (token == "<" && !parseTemplateArgs(name.back()))
+      return false;
+  } while (accept("::"));
+  return !failed;
+}
+
+bool Parser::parseTemplateArgs(NameComponent &comp) {
+  comp.isTemplate = true;
+  next(); // <
+  do {
+    TemplateArg arg;
+    bool negative = accept("-");
+    if (isNumber(token)) {
+      StringRef digits =
+          token.take_while([](char c) { return isdigit(c) != 0; });
+      char code = StringSwitch<char>(token.drop_front(digits.size()))
+                      .Case("", 'i')
+                      .Case("u", 'j')
+                      .Case("l", 'l')
+                      .Case("ul", 'm')
+                      .Case("ll", 'x')
+                      .Case("ull", 'y')
+                      .Default(0);
+      if (!code)
+        return false;
+      arg.literal = std::string("L") + code + (negative ? "n" : "") +
+                    digits.str() + "E";
+      arg.text = (negative ? "-" : "") + token.str();
+      next();
+    } else if (negative) {
+      return false;
+    } else if (token == "true" || token == "false") {
+      arg.literal = token == "true" ? "Lb1E" : "Lb0E";
+      arg.text = token.str();
+      next();
+    } else {
+      arg.type = parseType();
+      if (!arg.type)
+        return false;
+    }
+    comp.args.push_back(std::move(arg));
+  } while (accept(","));
+  return accept(">");
+}
+
+std::unique_ptr<TypeNode> Parser::parseType() {
+  static const char *const builtinWords[] = {
+      "void",    "bool",     "char",     "short",    "int",     "long",
+      "unsigned", "signed",  "float",    "double",   "wchar_t", "char8_t",
+      "char16_t", "char32_t", "__int128", "__float128"};
+
+  auto type = std::make_unique<TypeNode>();
+  std::string words;
+  while (std::find(std::begin(builtinWords), std::end(builtinWords), token) !=
+         std::end(builtinWords)) {
+    if (!words.empty())
+      words += ' ';
+    words += token.str();
+    next();
+  }
+
+  if (!words.empty()) {
+    type->builtin = StringSwitch<const char *>(words)
+                        .Case("void", "v")
+                        .Case("bool", "b")
+                        .Case("char", "c")
+                        .Case("signed char", "a")
+                        .Case("unsigned char", "h")
+                        .Case("short", "s")
+                        .Case("unsigned short", "t")
+                        .Case("int", "i")
+                        .Case("unsigned int", "j")
+                        .Case("long", "l")
+                        .Case("unsigned long", "m")
+                        .Case("long long", "x")
+                        .Case("unsigned long long", "y")
+                        .Case("__int128", "n")
+                        .Case("unsigned __int128", "o")
+                        .Case("float", "f")
+                        .Case("double", "d")
+                        .Case("long double", "e")
+                        .Case("__float128", "g")
+                        .Case("wchar_t", "w")
+                        .Case("char8_t", "Du")
+                        .Case("char16_t", "Ds")
+                        .Case("char32_t", "Di")
+                        .Default("");
+    if (type->builtin.empty())
+      return nullptr;
+    type->builtinText = words;
+  } else if (!parseName(type->name)) {
+    return nullptr;
+  }
+
+  if (unsigned cv = parseQualifiers())
+    type->layers.push_back({'K', cv});
+  for (;;) {
+    char kind = accept("*") ? 'P' : accept("&") ? 'R' : accept("&&") ? 'O' : 0;
+    if (!kind)
+      break;
+    type->layers.push_back({kind, 0});
+    if (unsigned cv = parseQualifiers())
+      type->layers.push_back({'K', cv});
+  }
+  if (failed)
+    return nullptr;
+  return type;
+}
+
+bool Parser::parsePrototype(Prototype &proto) {
+  if (!parseName(proto.name) || !accept("("))
+    return false;
+
+  /* The mangling of function templates refers to the template parameters,
+   * which cannot be recovered from the prototype. Constructors come in
+   * several flavors. */
+  const NameComponent &last = proto.name.back();
+  if (last.isTemplate)
+    return false;
+  if (proto.name.size() > 1 &&
+      proto.name[proto.name.size() - 2].id == last.id)
+    return false;
+
+  if (!accept(")")) {
+    do {
+      if (accept("...")) {
+        proto.variadic = true;
+        break;
+      }
+      auto param = parseType();
+      if (!param)
+        return false;
+      proto.params.push_back(std::move(param));
+    } while (accept(","));
+    if (!accept(")"))
+      return false;
+  }
+
+  proto.cv = parseQualifiers();
+  if (accept("&"))
+    proto.refQualifier = 'R';
+  else if (accept("&&"))
+    proto.refQualifier = 'O';
+
+  return !failed && token.empty();
+}
+
+class Mangler {
+public:
+  std::string mangle(const Prototype &proto);
+
+private:
+  std::string out;
+  StringMap<unsigned> substitutions;
+
+  void addSubstitution(const std::string &key) {
+    substitutions.try_emplace(key, substitutions.size());
+  }
+  bool trySubstitution(const std::string &key);
+
+  static std::string nameText(const std::vector<NameComponent> &name,
+                              size_t count, bool withArgs);
+  static std::string typeText(const TypeNode &type, size_t layers);
+
+  void mangleSource(const std::string &id) {
+    out += std::to_string(id.size()) + id;
+  }
+  void mangleTemplateArgs(const NameComponent &comp);
+  void manglePrefix(const std::vector<NameComponent> &name, size_t count);
+  void mangleClassName(const std::vector<NameComponent> &name);
+  void mangleType(const TypeNode &type, size_t layers);
+};
+
+std::string Mangler::nameText(const std::vector<NameComponent> &name,
+                              size_t count, bool withArgs) {
+  std::string text;
+  for (size_t i = 0; i < count; ++i) {
+    if (i)
+      text += "::";
+    text += name[i].id;
+    if (name[i].isTemplate && (withArgs || i + 1 < count)) {
+      text += '<';
+      for (size_t a = 0; a < name[i].args.size(); ++a) {
+        const TemplateArg &arg = name[i].args[a];
+        if (a)
+          text += ", ";
+        text += arg.type ? typeText(*arg.type, arg.type->layers.size())
+                         : arg.text;
+      }
+      text += '>';
+    }
+  }
+  return text;
+}
+
+std::string Mangler::typeText(const TypeNode &type, size_t layers) {
+  std::string text = type.builtin.empty()
+                         ? nameText(type.name, type.name.size(), true)
+                         : type.builtinText;
+  for (size_t i = 0; i < layers; ++i) {
+    const TypeNode::Layer &layer = type.layers[i];
+    switch (layer.kind) {
+    case 'K':
+      if (layer.cv & Const)
+        text += " const";
+      if (layer.cv & Volatile)
+        text += " volatile";
+      break;
+    case 'P':
+      text += '*';
+      break;
+    case 'R':
+      text += '&';
+      break;
+    case 'O':
+      text += "&&";
+      break;
+    }
+  }
+  return text;
+}
+
+/*!
+ * Emit a reference to an entity seen before, if any: S_, S0_, S1_, ...
+ */
+bool Mangler::trySubstitution(const std::string &key) {
+  auto it = substitutions.find(key);
+  if (it == substitutions.end())
+    return false;
+  out += 'S';
+  if (unsigned seq = it->second) {
+    static const char base36[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::string digits;
+    for (--seq; seq || digits.empty(); seq /= 36)
+      digits.insert(digits.begin(), base36[seq % 36]);
+    out += digits;
+  }
+  out += '_';
+  return true;
+}
+
+void Mangler::mangleTemplateArgs(const NameComponent &comp) {
+  out += 'I';
+  for (const TemplateArg &arg : comp.args) {
+    if (arg.type)
+      mangleType(*arg.type, arg.type->layers.size());
+    else
+      out += arg.literal;
+  }
+  out += 'E';
+}
+
+/*!
+ * Mangle the first `count` components of a name, reusing the longest prefix
+ * that has already been emitted. Every prefix is a substitution candidate,
+ * and so is the template name of each template-id.
+ */
+void Mangler::manglePrefix(const std::vector<NameComponent> &name,
+                           size_t count) {
+  size_t start = 0;
+  for (size_t k = count; k > 0; --k) {
+    if (trySubstitution(nameText(name, k, true))) {
+      start = k;
+      break;
+    }
+    if (name[k - 1].isTemplate && trySubstitution(nameText(name, k, false))) {
+      mangleTemplateArgs(name[k - 1]);
+      addSubstitution(nameText(name, k, true));
+      start = k;
+      break;
+    }
+  }
+
+  for (size_t j = start; j < count; ++j) {
+    mangleSource(name[j].id);
+    if (name[j].isTemplate) {
+      addSubstitution(nameText(name, j + 1, false));
+      mangleTemplateArgs(name[j]);
+    }
+    addSubstitution(nameText(name, j + 1, true));
+  }
+}
+
+void Mangler::mangleClassName(const std::vector<NameComponent> &name) {
+  if (trySubstitution(nameText(name, name.size(), true)))
+    return;
+  bool nested = name.size() > 1;
+  if (nested)
+    out += 'N';
+  manglePrefix(name, name.size());
+  if (nested)
+    out += 'E';
+}
+
+/*!
+ * Mangle a type with its first `layers` layers. Built-in types are the only
+ * ones that are never substituted.
+ */
+void Mangler::mangleType(const TypeNode &type, size_t layers) {
+  if (layers == 0) {
+    if (!type.builtin.empty())
+      out += type.builtin;
+    else
+      mangleClassName(type.name);
+    return;
+  }
+
+  std::string key = typeText(type, layers);
+  if (trySubstitution(key))
+    return;
+
+  const TypeNode::Layer &layer = type.layers[layers - 1];
+  if (layer.kind == 'K') {
+    if (layer.cv & Volatile)
+      out += 'V';
+    if (layer.cv & Const)
+      out += 'K';
+  } else {
+    out += layer.kind;
+  }
+  mangleType(type, layers - 1);
+  addSubstitution(key);
+}
+
+std::string Mangler::mangle(const Prototype &proto) {
+  out = "_Z";
+  if (proto.name.size() == 1) {
+    if (proto.cv || proto.refQualifier)
+      return "";
+    mangleSource(proto.name[0].id);
+  } else {
+    out += 'N';
+    if (proto.cv & Volatile)
+      out += 'V';
+    if (proto.cv & Const)
+      out += 'K';
+    if (proto.refQualifier)
+      out += proto.refQualifier;
+    manglePrefix(proto.name, proto.name.size() - 1);
+    mangleSource(proto.name.back().id);
+    out += 'E';
+  }
+
+  for (const auto &param : proto.params)
+    mangleType(*param, param->layers.size());
+  if (proto.variadic)
+    out += 'z';
+  else if (proto.params.empty())
+    out += 'v';
+  return out;
+}
+
+} // namespace
+
+std::string mangleFunctionPrototype(StringRef prototype) {
+  Prototype proto;
+  Parser parser(prototype);
+  if (!parser.parsePrototype(proto))
+    return "";
+  return Mangler().mangle(proto);
+}
@@ -0,0 +1,32 @@
+//===- TAUMangler.h - Mangle exact function prototypes ----------*- C++ -*-===//
+//
+// Turns the exact entries of the selective instrumentation file, written the
+// way the demangler prints them, back into Itanium mangled names so that
+// functions can be looked up without being demangled.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TAU_MANGLER_H
+#define TAU_MANGLER_H
+
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+/*!
+ * Mangle a demangled function prototype such as `ns::A::foo(int, A const*)
+ * const` following the Itanium C++ ABI.
+ *
+ * Only non-template functions and methods whose parameters are built-in
+ * types, class types (possibly templated, outside of `std`), pointers and
+ * references are supported. For anything else, including constructors,
+ * operators and function templates whose mangling cannot be recovered from
+ * the prototype, an empty string is returned.
+ *
+ * The result should be demangled again and compared with the prototype
+ * before being used: this rejects the spellings that the parser accepts but
+ * the demangler would never print, such as top-level qualifiers.
+ */
+std::string mangleFunctionPrototype(llvm::StringRef prototype);
+
+#endif // TAU_MANGLER_H
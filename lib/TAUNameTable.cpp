@@ -0,0 +1,156 @@
+//===- TAUNameTable.cpp - Exact names of the instrumentation lists --------===//
+//
+// This file implements the name table, on top of LLVM's on-disk chained hash
+// table for its mapped form.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/OnDiskHashTable.h"
+#include "llvm/Support/xxhash.h"
+
+#include "TAUBinaryIO.h"
+#include "TAUNameTable.h"
+
+using namespace llvm;
+
+namespace {
+
+/*
+ * Layout of the entries: u32 key length, u32 kinds, key bytes.
+ */
+class NameTableInfo {
+public:
+  using key_type = StringRef;
+  using key_type_ref = StringRef;
+  using internal_key_type = StringRef;
+  using external_key_type = StringRef;
+  using data_type = unsigned;
+  using data_type_ref = unsigned;
+  using hash_value_type = uint32_t;
+  using offset_type = uint32_t;
+
+  static hash_value_type ComputeHash(StringRef key) {
+    return static_cast<hash_value_type>(xxHash64(key));
+  }
+  static bool EqualKey(StringRef a, StringRef b) { return a == b; }
+  static StringRef GetInternalKey(StringRef key) { return key; }
+  static StringRef GetExternalKey(StringRef key) { return key; }
+
+  static std::pair<offset_type, offset_type>
+  EmitKeyDataLength(raw_ostream &out, StringRef key, unsigned) {
+    writeU32(out, key.size());
+    return std::make_pair(static_cast<offset_type>(key.size()), 4u);
+  }
+  static void EmitKey(raw_ostream &out, StringRef key, offset_type) {
+    out << key;
+  }
+  static void EmitData(raw_ostream &out, StringRef, unsigned kinds,
+                       offset_type) {
+    writeU32(out, kinds);
+  }
+
+  static std::pair<offset_type, offset_type>
+  ReadKeyDataLength(const unsigned char *&data) {
+    offset_type keyLen = support::endian::read32le(data);
+    data += 4;
+    return std::make_pair(keyLen, 4u);
+  }
+  static StringRef ReadKey(const unsigned char *data, offset_type len) {
+    return StringRef(reinterpret_cast<const char *>(data), len);
+  }
+  static unsigned ReadData(StringRef, const unsigned char *data,
+                           offset_type) {
+    return support::endian::read32le(data);
+  }
+};
+
+} // namespace
+
+class TAUNameTable::OnDiskTable
+    : public OnDiskChainedHashTable<NameTableInfo> {
+public:
+  using OnDiskChainedHashTable<NameTableInfo>::OnDiskChainedHashTable;
+};
+
+TAUNameTable::TAUNameTable() { std::fill(counts, counts + NumKinds, 0); }
+
+TAUNameTable::TAUNameTable(TAUNameTable &&) = default;
+TAUNameTable &TAUNameTable::operator=(TAUNameTable &&) = default;
+TAUNameTable::~TAUNameTable() = default;
+
+void TAUNameTable::insert(StringRef name, unsigned kinds) {
+  unsigned &current = names[name];
+  for (unsigned i = 0; i < NumKinds; ++i)
+    if ((kinds & (1u << i)) && !(current & (1u << i)))
+      ++counts[i];
+  current |= kinds;
+}
+
+unsigned TAUNameTable::lookup(StringRef name) const {
+  if (mapped) {
+    auto it = mapped->find(name);
+    return it == mapped->end() ? 0 : *it;
+  }
+  auto it = names.find(name);
+  return it == names.end() ? 0 : it->second;
+}
+
+unsigned TAUNameTable::count(unsigned kind) const {
+  for (unsigned i = 0; i < NumKinds; ++i)
+    if (kind == (1u << i))
+      return counts[i];
+  return 0;
+}
+
+/*
+ * Layout: NumKinds u32 counts, u32 offset of the buckets in the payload,
+ * padding to a multiple of 4 bytes, then the payload of the on-disk hash
+ * table. Offsets inside the payload are relative to its start.
+ */
+void TAUNameTable::write(raw_ostream &os) const {
+  for (unsigned i = 0; i < NumKinds; ++i)
+    writeU32(os, counts[i]);
+
+  OnDiskChainedHashTableGenerator<NameTableInfo> generator;
+  for (const auto &entry : names)
+    generator.insert(entry.getKey(), entry.getValue());
+
+  SmallString<4096> payload;
+  raw_svector_ostream payloadStream(payload);
+  writeU32(payloadStream, 0); // offset 0 means "empty bucket"
+  uint32_t buckets = generator.Emit(payloadStream);
+
+  writeU32(os, buckets);
+  while (os.tell() % 4)
+    os << '\0';
+  os << payload;
+}
+
+bool TAUNameTable::map(StringRef buffer, uint64_t offset) {
+  uint64_t payloadStart = alignTo(offset + 4 * (NumKinds + 1), 4);
+  if (payloadStart > buffer.size())
+    return false;
+
+  auto *base = reinterpret_cast<const unsigned char *>(buffer.data());
+  for (unsigned i = 0; i < NumKinds; ++i)
+    counts[i] = support::endian::read32le(base + offset + 4 * i);
+  uint32_t buckets = support::endian::read32le(base + offset + 4 * NumKinds);
+
+  const unsigned char *payload = base + payloadStart;
+  uint64_t payloadSize = buffer.size() - payloadStart;
+  if (buckets % 4 || buckets + 8 > payloadSize ||
+      reinterpret_cast<uintptr_t>(payload) % 4)
+    return false;
+
+  const unsigned char *bucketsPtr = payload + buckets;
+  auto numbers = OnDiskTable::readNumBucketsAndEntries(bucketsPtr);
+  if (buckets + 8 + 4 * uint64_t(numbers.first) > payloadSize)
+    return false;
+  mapped.reset(
+      new OnDiskTable(numbers.first, numbers.second, bucketsPtr, payload));
+  names.clear();
+  return true;
+}
@@ -0,0 +1,57 @@
+//===- TAUNameTable.h - Exact names of the instrumentation list -*- C++ -*-===//
+//
+// The exact function and file names of the selective instrumentation file,
+// each one with the set of lists it belongs to. The table is either built in
+// memory while parsing the input file, or used in place from the on-disk hash
+// table stored in the binary list cache.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TAU_NAMETABLE_H
+#define TAU_NAMETABLE_H
+
+#include <memory>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+class TAUNameTable {
+public:
+  static const unsigned NumKinds = 8;
+
+  TAUNameTable();
+  TAUNameTable(TAUNameTable &&);
+  TAUNameTable &operator=(TAUNameTable &&);
+  ~TAUNameTable();
+
+  /// Add \p name to the lists in the \p kinds mask.
+  void insert(llvm::StringRef name, unsigned kinds);
+
+  /// The mask of the lists \p name belongs to, 0 if none.
+  unsigned lookup(llvm::StringRef name) const;
+
+  /// Number of names in the given list (a single bit).
+  unsigned count(unsigned kind) const;
+
+  /*!
+   * Append the table to \p os, which must be a stream over the whole file
+   * so that the offsets recorded in the table are relative to its start.
+   */
+  void write(llvm::raw_ostream &os) const;
+
+  /*!
+   * Use the table written by write() at \p offset in \p buffer, in place.
+   * The buffer must outlive the table. Returns false if it is malformed.
+   */
+  bool map(llvm::StringRef buffer, uint64_t offset);
+
+private:
+  class OnDiskTable;
+
+  llvm::StringMap<unsigned> names;
+  std::unique_ptr<OnDiskTable> mapped;
+  unsigned counts[NumKinds];
+};
+
+#endif // TAU_NAMETABLE_H
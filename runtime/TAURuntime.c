@@ -0,0 +1,1036 @@
+/*===- TAURuntime.c - Built-in profiling runtime --------------------------===*\
+|*                                                                            *|
+|* Functions are identified by a number, given on first sight by a registry  *|
+|* shared by all the threads. Everything else is per thread: its stack of    *|
+|* running timers, the counters of each function, indexed by number, and a   *|
+|* cache from the name pointers (or ids) it was given to the numbers. The    *|
+|* probes only touch the memory of their thread; the registry lock is only   *|
+|* taken the first time a thread sees a name or id, and by the handles when  *|
+|* they are filled. The names of the ids are registered with their sections. *|
+|* A function is throttled by setting the throttle flags the plugin gave it,  *|
+|* which its probes check before being called. The counters the plugin     *|
+|* keeps inline are given per thread, and added to its profile at the end.  *|
+|* With TAU_TRACE=1, the entries and exits are also traced (see             *|
+|* TAURuntimeTrace.h).                                                        *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "TAURuntime.h"
+#include "TAURuntimeTrace.h"
+
+#define TAU_RT_LIKELY(x) __builtin_expect(!!(x), 1)
+#define TAU_RT_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define TAU_RT_COLD __attribute__((noinline, cold))
+
+/* Update of a field only written by its thread, which Tau_rt_dump() may read
+ * from another one: no read-modify-write is needed */
+#define TAU_RT_ADD(field, value)                                              \
+  __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) +    \
+                                 (value),                                     \
+                   __ATOMIC_RELAXED)
+
+/* The state of each thread starts on its own cache lines */
+#define TAU_RT_CACHE_LINE 64
+
+/* The timer of the whole thread, as in TAU */
+#define TAU_RT_APPLICATION 0
+#define TAU_RT_APPLICATION_NAME ".TAU application"
+
+#define TAU_RT_NO_ID UINT32_MAX
+
+/*
+ * Registry of the functions, shared by all the threads.
+ */
+
+struct tau_rt_function {
+  const char *name; /* own copy */
+  uint32_t id;
+  uint32_t nflags;
+  char **flags; /* throttle flags of the modules it is instrumented in */
+  int throttled;
+  struct tau_rt_function *next; /* in its bucket */
+};
+
+static pthread_mutex_t tau_rt_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tau_rt_function **tau_rt_buckets; /* by name hash */
+static uint32_t tau_rt_nbuckets;
+static struct tau_rt_function **tau_rt_functions; /* by id */
+static uint32_t tau_rt_nfunctions;
+
+/* The functions of the ids of -tau-probe-backend=tau-ids (open addressing,
+ * by id, 0 if empty), and the tau_functions sections they were read from */
+struct tau_rt_id {
+  uint64_t id;
+  struct tau_rt_function *function;
+};
+
+static struct tau_rt_id *tau_rt_ids;
+static uint32_t tau_rt_ids_mask;
+static uint32_t tau_rt_nids;
+static const struct tau_rt_function_info **tau_rt_sections;
+static uint32_t tau_rt_nsections;
+
+/* Throttle criteria, read at initialization: no call count reaches the
+ * default */
+static uint64_t tau_rt_throttle_calls = UINT64_MAX;
+static uint64_t tau_rt_throttle_percall; /* ns */
+
+/*
+ * State of a thread, only written by the thread itself. Tau_rt_dump() may
+ * read it from another thread while the thread still runs its probes, under
+ * the registry lock: the fields are written with relaxed atomics, the arrays
+ * replaced are freed under the lock, and a timer is only pushed on the stack
+ * once its frame is filled.
+ */
+
+struct tau_rt_counters {
+  uint64_t calls;
+  uint64_t subrs;     /* calls of instrumented functions from this one */
+  uint64_t exclusive; /* ns */
+  uint64_t inclusive; /* ns, counted once for recursive calls */
+  uint32_t active;    /* running calls */
+  uint32_t throttled; /* by this thread */
+};
+
+struct tau_rt_frame {
+  uint32_t id;
+  uint32_t weight; /* calls this one stands for, when sampled */
+  uint64_t start;
+  uint64_t children; /* ns spent in the timers started from this one */
+};
+
+/* The inline counters of a module in a thread */
+struct tau_rt_inline_table {
+  struct tau_rt_inline_counters *counters;
+  const char *const *names;
+  size_t count;
+  struct tau_rt_inline_table *next;
+};
+
+/* Open addressing, by key (0 if empty) */
+struct tau_rt_cached {
+  uint64_t key;
+  uint32_t id;
+};
+
+struct tau_rt_cache {
+  struct tau_rt_cached *slots;
+  uint32_t mask;
+  uint32_t count;
+};
+
+struct tau_rt_thread {
+  struct tau_rt_frame *stack;
+  uint32_t depth;
+  uint32_t stack_capacity;
+  struct tau_rt_counters *counters; /* by id */
+  uint32_t ncounters;
+  struct tau_rt_cache names; /* by pointer, as given to the probes */
+  struct tau_rt_cache ids;   /* by id of the tau_functions sections */
+  uint32_t index;
+  struct tau_rt_trace_buffer *trace; /* NULL unless traced */
+  struct tau_rt_inline_table *inline_tables;
+  struct tau_rt_thread *next;        /* in tau_rt_threads */
+} __attribute__((aligned(TAU_RT_CACHE_LINE)));
+
+static _Thread_local struct tau_rt_thread *tau_rt_self;
+static struct tau_rt_thread *_Atomic tau_rt_threads;
+static atomic_uint tau_rt_nthreads;
+/* Set when the profiles are written: the probes do nothing afterwards */
+static atomic_int tau_rt_done;
+static int tau_rt_tracing;
+
+static pthread_once_t tau_rt_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tau_rt_key;
+
+static inline uint64_t tau_rt_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * The counter llvm.readcyclecounter reads, for the inline counters, where
+ * its rate is known not to vary; 0 elsewhere.
+ */
+static inline uint64_t tau_rt_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/* Both clocks at initialization, to convert the cycles to nanoseconds */
+static uint64_t tau_rt_start_ns;
+static uint64_t tau_rt_start_cycles;
+
+/* FNV-1a */
+static uint64_t tau_rt_hash(const char *name) {
+  uint64_t hash = 14695981039346656037ull;
+  for (; *name; ++name)
+    hash = (hash ^ (unsigned char)*name) * 1099511628211ull;
+  return hash;
+}
+
+/*
+ * The function of the given name, registered if it is new. The registry
+ * lock must be held. Returns NULL if out of memory.
+ */
+static struct tau_rt_function *tau_rt_register_locked(const char *name) {
+  uint64_t hash = tau_rt_hash(name);
+  if (tau_rt_nbuckets) {
+    for (struct tau_rt_function *f =
+             tau_rt_buckets[hash & (tau_rt_nbuckets - 1)];
+         f; f = f->next)
+      if (!strcmp(f->name, name))
+        return f;
+  }
+
+  /* One bucket per function at most, and the ids are dense */
+  if (tau_rt_nfunctions == tau_rt_nbuckets) {
+    uint32_t nbuckets = tau_rt_nbuckets ? 2 * tau_rt_nbuckets : 256;
+    struct tau_rt_function **buckets = calloc(nbuckets, sizeof(*buckets));
+    struct tau_rt_function **functions =
+        realloc(tau_rt_functions, nbuckets * sizeof(*functions));
+    if (!buckets || !functions) {
+      free(buckets);
+      if (functions)
+        tau_rt_functions = functions;
+      return NULL;
+    }
+    for (uint32_t i = 0; i < tau_rt_nfunctions; ++i) {
+      struct tau_rt_function *f = functions[i];
+      uint32_t bucket = tau_rt_hash(f->name) & (nbuckets - 1);
+      f->next = buckets[bucket];
+      buckets[bucket] = f;
+    }
+    free(tau_rt_buckets);
+    tau_rt_buckets = buckets;
+    tau_rt_nbuckets = nbuckets;
+    tau_rt_functions = functions;
+  }
+
+  struct tau_rt_function *f = malloc(sizeof(*f));
+  char *copy = strdup(name);
+  if (!f || !copy) {
+    free(f);
+    free(copy);
+    return NULL;
+  }
+  f->name = copy;
+  f->id = tau_rt_nfunctions;
+  f->nflags = 0;
+  f->flags = NULL;
+  f->throttled = 0;
+  uint32_t bucket = hash & (tau_rt_nbuckets - 1);
+  f->next = tau_rt_buckets[bucket];
+  tau_rt_buckets[bucket] = f;
+  tau_rt_functions[tau_rt_nfunctions++] = f;
+  return f;
+}
+
+static struct tau_rt_function *tau_rt_register(const char *name) {
+  pthread_mutex_lock(&tau_rt_lock);
+  struct tau_rt_function *f = tau_rt_register_locked(name);
+  pthread_mutex_unlock(&tau_rt_lock);
+  return f;
+}
+
+/*
+ * Stop the timer on top of the stack of the thread. The time of a sampled
+ * call is scaled to the calls it stands for, so its parent's exclusive time
+ * is an estimate, kept from going below 0.
+ */
+static inline void tau_rt_pop_frame(struct tau_rt_frame *stack,
+                                    uint32_t depth,
+                                    struct tau_rt_counters *all,
+                                    uint64_t now) {
+  struct tau_rt_frame *frame = &stack[depth];
+  uint64_t elapsed = (now - frame->start) * frame->weight;
+  struct tau_rt_counters *counters = &all[frame->id];
+  if (TAU_RT_LIKELY(elapsed > frame->children))
+    TAU_RT_ADD(counters->exclusive, elapsed - frame->children);
+  uint32_t active = counters->active - 1;
+  __atomic_store_n(&counters->active, active, __ATOMIC_RELAXED);
+  if (active == 0)
+    TAU_RT_ADD(counters->inclusive, elapsed);
+  if (depth)
+    TAU_RT_ADD(stack[depth - 1].children, elapsed);
+}
+
+static inline void tau_rt_pop(struct tau_rt_thread *self, uint64_t now) {
+  uint32_t depth = self->depth - 1;
+  tau_rt_pop_frame(self->stack, depth, self->counters, now);
+  __atomic_store_n(&self->depth, depth, __ATOMIC_RELEASE);
+}
+
+/*
+ * The arrays of a thread grow by doubling. Each array is published before its
+ * size, and the previous one is freed once Tau_rt_dump() no longer reads it,
+ * which it only does under the registry lock.
+ */
+static void tau_rt_free_replaced(void *old, int locked) {
+  if (!locked)
+    pthread_mutex_lock(&tau_rt_lock);
+  free(old);
+  if (!locked)
+    pthread_mutex_unlock(&tau_rt_lock);
+}
+
+static TAU_RT_COLD int tau_rt_grow_counters(struct tau_rt_thread *self,
+                                            uint32_t id, int locked) {
+  uint32_t ncounters = self->ncounters;
+  while (ncounters <= id)
+    ncounters *= 2;
+  struct tau_rt_counters *counters = malloc(ncounters * sizeof(*counters));
+  if (!counters)
+    return 0;
+  memcpy(counters, self->counters, self->ncounters * sizeof(*counters));
+  memset(counters + self->ncounters, 0,
+         (ncounters - self->ncounters) * sizeof(*counters));
+  struct tau_rt_counters *old = self->counters;
+  __atomic_store_n(&self->counters, counters, __ATOMIC_RELEASE);
+  __atomic_store_n(&self->ncounters, ncounters, __ATOMIC_RELEASE);
+  tau_rt_free_replaced(old, locked);
+  return 1;
+}
+
+static TAU_RT_COLD int tau_rt_grow_stack(struct tau_rt_thread *self) {
+  uint32_t capacity = 2 * self->stack_capacity;
+  struct tau_rt_frame *stack = malloc(capacity * sizeof(*stack));
+  if (!stack)
+    return 0;
+  memcpy(stack, self->stack, self->stack_capacity * sizeof(*stack));
+  struct tau_rt_frame *old = self->stack;
+  __atomic_store_n(&self->stack, stack, __ATOMIC_RELEASE);
+  __atomic_store_n(&self->stack_capacity, capacity, __ATOMIC_RELEASE);
+  tau_rt_free_replaced(old, 0);
+  return 1;
+}
+
+static inline void tau_rt_start(struct tau_rt_thread *self, uint32_t id,
+                                uint32_t weight) {
+  if (TAU_RT_UNLIKELY(id >= self->ncounters) &&
+      !tau_rt_grow_counters(self, id, 0))
+    return;
+  if (TAU_RT_UNLIKELY(self->depth == self->stack_capacity) &&
+      !tau_rt_grow_stack(self))
+    return;
+
+  struct tau_rt_counters *counters = &self->counters[id];
+  TAU_RT_ADD(counters->calls, weight);
+  TAU_RT_ADD(counters->active, 1);
+  if (self->depth)
+    TAU_RT_ADD(self->counters[self->stack[self->depth - 1].id].subrs, weight);
+
+  /* The frame may still be read as it was before its last pop */
+  struct tau_rt_frame *frame = &self->stack[self->depth];
+  __atomic_store_n(&frame->id, id, __ATOMIC_RELAXED);
+  __atomic_store_n(&frame->weight, weight, __ATOMIC_RELAXED);
+  __atomic_store_n(&frame->children, 0, __ATOMIC_RELAXED);
+  uint64_t now = tau_rt_now();
+  __atomic_store_n(&frame->start, now, __ATOMIC_RELAXED);
+  __atomic_store_n(&self->depth, self->depth + 1, __ATOMIC_RELEASE);
+  if (self->trace)
+    tau_rt_trace_event(self->trace, TAU_TRACE_ENTER, id, now);
+}
+
+/*
+ * Set the throttle flags of a function: the calls that already started
+ * still call their stop probes.
+ */
+static TAU_RT_COLD void tau_rt_throttle(struct tau_rt_thread *self,
+                                        uint32_t id) {
+  self->counters[id].throttled = 1;
+  pthread_mutex_lock(&tau_rt_lock);
+  struct tau_rt_function *f = tau_rt_functions[id];
+  f->throttled = 1;
+  for (uint32_t i = 0; i < f->nflags; ++i)
+    __atomic_store_n(f->flags[i], 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&tau_rt_lock);
+}
+
+/*
+ * Stop the timer on top of the stack, for a stop probe, and throttle its
+ * function if it is called often enough and fast enough on this thread.
+ */
+static inline void tau_rt_exit(struct tau_rt_thread *self, uint64_t now) {
+  uint32_t id = self->stack[self->depth - 1].id;
+  if (self->trace)
+    tau_rt_trace_event(self->trace, TAU_TRACE_EXIT, id, now);
+  tau_rt_pop(self, now);
+
+  const struct tau_rt_counters *counters = &self->counters[id];
+  if (TAU_RT_UNLIKELY(counters->calls >= tau_rt_throttle_calls) &&
+      !counters->throttled && !counters->active &&
+      counters->inclusive < counters->calls * tau_rt_throttle_percall &&
+      id != TAU_RT_APPLICATION)
+    tau_rt_throttle(self, id);
+}
+
+static inline void tau_rt_stop(struct tau_rt_thread *self, uint32_t id) {
+  uint64_t now = tau_rt_now();
+  /* The timers are stopped in order, unless a longjmp or an exception
+   * skipped some stops: those are stopped along with this one */
+  uint32_t depth = self->depth;
+  while (depth > 1 && self->stack[depth - 1].id != id)
+    --depth;
+  if (depth <= 1)
+    return; /* not started on this thread */
+  while (self->depth >= depth)
+    tau_rt_exit(self, now);
+}
+
+/*
+ * A single start and stop were recorded for the calls made in a loop:
+ * account for the others.
+ */
+static void tau_rt_loop_calls(struct tau_rt_thread *self, uint32_t id,
+                              uint64_t calls) {
+  uint32_t depth = self->depth;
+  while (depth > 1 && self->stack[depth - 1].id != id)
+    --depth;
+  if (depth <= 1)
+    return;
+  if (self->trace)
+    tau_rt_trace_calls(self->trace, id, calls);
+  /* Wraps around if the loop made no call */
+  TAU_RT_ADD(self->counters[id].calls, calls - 1);
+  TAU_RT_ADD(self->counters[self->stack[depth - 2].id].subrs, calls - 1);
+}
+
+/*
+ * Add the inline counters of the thread to its counters, and reset them.
+ * Without a known rate, the cycles are kept as they are. The registry lock
+ * must be held.
+ */
+static void tau_rt_fold_inline(struct tau_rt_thread *self) {
+  if (!self->inline_tables)
+    return;
+  uint64_t cycles = tau_rt_cycles() - tau_rt_start_cycles;
+  double ns_per_cycle =
+      cycles ? (double)(tau_rt_now() - tau_rt_start_ns) / cycles : 1;
+
+  for (struct tau_rt_inline_table *table = self->inline_tables; table;
+       table = table->next) {
+    for (size_t i = 0; i < table->count; ++i) {
+      struct tau_rt_inline_counters *inline_counters = &table->counters[i];
+      if (!inline_counters->calls)
+        continue;
+      struct tau_rt_function *f = tau_rt_register_locked(table->names[i]);
+      if (!f ||
+          (f->id >= self->ncounters && !tau_rt_grow_counters(self, f->id, 1)))
+        continue;
+      struct tau_rt_counters *counters = &self->counters[f->id];
+      TAU_RT_ADD(counters->calls, inline_counters->calls);
+      TAU_RT_ADD(counters->inclusive,
+                 (uint64_t)(inline_counters->inclusive * ns_per_cycle));
+      TAU_RT_ADD(counters->exclusive,
+                 (uint64_t)(inline_counters->exclusive * ns_per_cycle));
+      memset(inline_counters, 0, sizeof(*inline_counters));
+    }
+  }
+}
+
+/*
+ * A copy of the counters of a thread, read while it may still be running,
+ * with its timers stopped at now and its inline counters added (without
+ * resetting them). The registry lock must be held, so that the ids stay
+ * below the returned count and the inline tables of the thread stay alive.
+ */
+static struct tau_rt_counters *tau_rt_snapshot(struct tau_rt_thread *self,
+                                               uint64_t now,
+                                               uint32_t *count) {
+  struct tau_rt_inline_table *tables =
+      __atomic_load_n(&self->inline_tables, __ATOMIC_ACQUIRE);
+  for (struct tau_rt_inline_table *table = tables; table; table = table->next)
+    for (size_t i = 0; i < table->count; ++i)
+      if (__atomic_load_n(&table->counters[i].calls, __ATOMIC_RELAXED))
+        tau_rt_register_locked(table->names[i]);
+
+  *count = tau_rt_nfunctions;
+  struct tau_rt_counters *copy = calloc(*count ? *count : 1, sizeof(*copy));
+  if (!copy)
+    return NULL;
+  uint32_t ncounters = __atomic_load_n(&self->ncounters, __ATOMIC_ACQUIRE);
+  const struct tau_rt_counters *counters =
+      __atomic_load_n(&self->counters, __ATOMIC_ACQUIRE);
+  if (ncounters > *count)
+    ncounters = *count;
+  for (uint32_t id = 0; id < ncounters; ++id) {
+    copy[id].calls = __atomic_load_n(&counters[id].calls, __ATOMIC_RELAXED);
+    copy[id].subrs = __atomic_load_n(&counters[id].subrs, __ATOMIC_RELAXED);
+    copy[id].exclusive =
+        __atomic_load_n(&counters[id].exclusive, __ATOMIC_RELAXED);
+    copy[id].inclusive =
+        __atomic_load_n(&counters[id].inclusive, __ATOMIC_RELAXED);
+    copy[id].active = __atomic_load_n(&counters[id].active, __ATOMIC_RELAXED);
+  }
+
+  /* The frames below depth were filled before depth was published */
+  uint32_t depth = __atomic_load_n(&self->depth, __ATOMIC_ACQUIRE);
+  uint32_t capacity = __atomic_load_n(&self->stack_capacity, __ATOMIC_ACQUIRE);
+  const struct tau_rt_frame *stack =
+      __atomic_load_n(&self->stack, __ATOMIC_ACQUIRE);
+  if (depth > capacity)
+    depth = capacity;
+  struct tau_rt_frame *frames = malloc((depth ? depth : 1) * sizeof(*frames));
+  if (frames) {
+    for (uint32_t i = 0; i < depth; ++i) {
+      frames[i].id = __atomic_load_n(&stack[i].id, __ATOMIC_RELAXED);
+      frames[i].weight = __atomic_load_n(&stack[i].weight, __ATOMIC_RELAXED);
+      frames[i].start = __atomic_load_n(&stack[i].start, __ATOMIC_RELAXED);
+      frames[i].children =
+          __atomic_load_n(&stack[i].children, __ATOMIC_RELAXED);
+      if (frames[i].id >= *count) {
+        depth = i;
+        break;
+      }
+    }
+    while (depth--)
+      tau_rt_pop_frame(frames, depth, copy, now);
+    free(frames);
+  }
+
+  if (!tables)
+    return copy;
+  uint64_t cycles = tau_rt_cycles() - tau_rt_start_cycles;
+  double ns_per_cycle =
+      cycles ? (double)(tau_rt_now() - tau_rt_start_ns) / cycles : 1;
+  for (struct tau_rt_inline_table *table = tables; table;
+       table = table->next) {
+    for (size_t i = 0; i < table->count; ++i) {
+      const struct tau_rt_inline_counters *inline_counters =
+          &table->counters[i];
+      uint64_t calls = __atomic_load_n(&inline_counters->calls,
+                                       __ATOMIC_RELAXED);
+      if (!calls)
+        continue;
+      struct tau_rt_function *f = tau_rt_register_locked(table->names[i]);
+      if (!f || f->id >= *count)
+        continue;
+      copy[f->id].calls += calls;
+      copy[f->id].inclusive += (uint64_t)(
+          __atomic_load_n(&inline_counters->inclusive, __ATOMIC_RELAXED) *
+          ns_per_cycle);
+      copy[f->id].exclusive += (uint64_t)(
+          __atomic_load_n(&inline_counters->exclusive, __ATOMIC_RELAXED) *
+          ns_per_cycle);
+    }
+  }
+  return copy;
+}
+
+/*
+ * Thread exit: stop its timers, including the timer of the thread, unless
+ * the profiles are being written, and collect its inline counters while
+ * they still exist: they are in its thread-local storage, which
+ * Tau_rt_dump() may be reading under the registry lock.
+ */
+static void tau_rt_thread_exit(void *arg) {
+  struct tau_rt_thread *self = arg;
+  if (!atomic_load_explicit(&tau_rt_done, memory_order_acquire)) {
+    uint64_t now = tau_rt_now();
+    while (self->depth)
+      tau_rt_exit(self, now);
+    tau_rt_trace_detach(self->trace);
+  }
+
+  pthread_mutex_lock(&tau_rt_lock);
+  tau_rt_fold_inline(self);
+  struct tau_rt_inline_table *table = self->inline_tables;
+  __atomic_store_n(&self->inline_tables, NULL, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&tau_rt_lock);
+  while (table) {
+    struct tau_rt_inline_table *next = table->next;
+    free(table);
+    table = next;
+  }
+}
+
+static void tau_rt_throttle_init(void) {
+  const char *enabled = getenv("TAU_THROTTLE");
+  if (enabled && !strcmp(enabled, "0"))
+    return;
+  const char *calls = getenv("TAU_THROTTLE_NUMCALLS");
+  const char *percall = getenv("TAU_THROTTLE_PERCALL");
+  tau_rt_throttle_calls = calls && *calls ? strtoull(calls, NULL, 10) : 100000;
+  tau_rt_throttle_percall =
+      (percall && *percall ? strtoull(percall, NULL, 10) : 10) * 1000;
+}
+
+static void tau_rt_init(void) {
+  tau_rt_start_ns = tau_rt_now();
+  tau_rt_start_cycles = tau_rt_cycles();
+  pthread_key_create(&tau_rt_key, tau_rt_thread_exit);
+  tau_rt_throttle_init();
+  tau_rt_register(TAU_RT_APPLICATION_NAME);
+  tau_rt_tracing = tau_rt_trace_init(tau_rt_now());
+  atexit(Tau_rt_dump);
+}
+
+static TAU_RT_COLD struct tau_rt_thread *tau_rt_thread_init(void) {
+  if (atomic_load_explicit(&tau_rt_done, memory_order_relaxed))
+    return NULL;
+  pthread_once(&tau_rt_once, tau_rt_init);
+
+  struct tau_rt_thread *self =
+      aligned_alloc(TAU_RT_CACHE_LINE,
+                    (sizeof(*self) + TAU_RT_CACHE_LINE - 1) &
+                        ~(size_t)(TAU_RT_CACHE_LINE - 1));
+  if (!self)
+    return NULL;
+  memset(self, 0, sizeof(*self));
+  self->stack_capacity = 64;
+  self->stack = malloc(self->stack_capacity * sizeof(*self->stack));
+  self->ncounters = 64;
+  self->counters = calloc(self->ncounters, sizeof(*self->counters));
+  self->names.mask = self->ids.mask = 63;
+  self->names.slots = calloc(self->names.mask + 1, sizeof(*self->names.slots));
+  self->ids.slots = calloc(self->ids.mask + 1, sizeof(*self->ids.slots));
+  if (!self->stack || !self->counters || !self->names.slots ||
+      !self->ids.slots) {
+    free(self->stack);
+    free(self->counters);
+    free(self->names.slots);
+    free(self->ids.slots);
+    free(self);
+    return NULL;
+  }
+
+  self->index = atomic_fetch_add(&tau_rt_nthreads, 1);
+  self->next = atomic_load(&tau_rt_threads);
+  while (!atomic_compare_exchange_weak(&tau_rt_threads, &self->next, self))
+    ;
+  if (tau_rt_tracing)
+    self->trace = tau_rt_trace_attach(self->index, tau_rt_now());
+  tau_rt_self = self;
+  pthread_setspecific(tau_rt_key, self);
+  tau_rt_start(self, TAU_RT_APPLICATION, 1);
+  return self;
+}
+
+static inline struct tau_rt_thread *tau_rt_thread(void) {
+  if (TAU_RT_UNLIKELY(
+          atomic_load_explicit(&tau_rt_done, memory_order_relaxed)))
+    return NULL;
+  struct tau_rt_thread *self = tau_rt_self;
+  if (TAU_RT_UNLIKELY(!self))
+    self = tau_rt_thread_init();
+  return self;
+}
+
+static inline uint32_t tau_rt_cache_slot(const struct tau_rt_cache *cache,
+                                         uint64_t key) {
+  uint64_t hash = (key >> 3) * 0x9e3779b97f4a7c15ull;
+  return (uint32_t)(hash >> 32) & cache->mask;
+}
+
+/* The number cached for the given key, TAU_RT_NO_ID if there is none */
+static inline uint32_t tau_rt_cache_find(const struct tau_rt_cache *cache,
+                                         uint64_t key) {
+  for (uint32_t slot = tau_rt_cache_slot(cache, key);;
+       slot = (slot + 1) & cache->mask) {
+    if (TAU_RT_LIKELY(cache->slots[slot].key == key))
+      return cache->slots[slot].id;
+    if (!cache->slots[slot].key)
+      return TAU_RT_NO_ID;
+  }
+}
+
+/* Cache the number of a new key, unless out of memory */
+static TAU_RT_COLD void tau_rt_cache_insert(struct tau_rt_cache *cache,
+                                            uint64_t key, uint32_t id) {
+  /* At most half full */
+  if (2 * (cache->count + 1) > cache->mask + 1) {
+    struct tau_rt_cache old = *cache;
+    struct tau_rt_cached *slots =
+        calloc(2 * (old.mask + 1), sizeof(*slots));
+    if (!slots)
+      return;
+    cache->slots = slots;
+    cache->mask = 2 * old.mask + 1;
+    for (uint32_t i = 0; i <= old.mask; ++i) {
+      if (!old.slots[i].key)
+        continue;
+      uint32_t slot = tau_rt_cache_slot(cache, old.slots[i].key);
+      while (slots[slot].key)
+        slot = (slot + 1) & cache->mask;
+      slots[slot] = old.slots[i];
+    }
+    free(old.slots);
+  }
+
+  uint32_t slot = tau_rt_cache_slot(cache, key);
+  while (cache->slots[slot].key)
+    slot = (slot + 1) & cache->mask;
+  cache->slots[slot].key = key;
+  cache->slots[slot].id = id;
+  ++cache->count;
+}
+
+static TAU_RT_COLD uint32_t tau_rt_name_miss(struct tau_rt_thread *self,
+                                             const char *name) {
+  struct tau_rt_function *f = tau_rt_register(name);
+  if (!f)
+    return TAU_RT_NO_ID;
+  tau_rt_cache_insert(&self->names, (uintptr_t)name, f->id);
+  return f->id;
+}
+
+/*
+ * The number of the function of the given name. The same function may be
+ * given with different pointers (e.g. from different modules): they all get
+ * the number registered for the name.
+ */
+static inline uint32_t tau_rt_name_id(struct tau_rt_thread *self,
+                                      const char *name) {
+  uint32_t id = tau_rt_cache_find(&self->names, (uintptr_t)name);
+  if (TAU_RT_LIKELY(id != TAU_RT_NO_ID))
+    return id;
+  return tau_rt_name_miss(self, name);
+}
+
+/*
+ * The slot of the given id in the table of the ids, empty if it is not
+ * there. The registry lock must be held, and the table allocated.
+ */
+static struct tau_rt_id *tau_rt_id_slot_locked(uint64_t id) {
+  uint32_t slot = (uint32_t)((id * 0x9e3779b97f4a7c15ull) >> 32);
+  for (;; ++slot) {
+    struct tau_rt_id *entry = &tau_rt_ids[slot & tau_rt_ids_mask];
+    if (entry->id == id || !entry->id)
+      return entry;
+  }
+}
+
+/*
+ * Give the function the given id, unless it has one. The registry lock must
+ * be held. Returns NULL if out of memory.
+ */
+static struct tau_rt_function *tau_rt_add_id_locked(uint64_t id,
+                                                    const char *name) {
+  /* At most half full */
+  if (2 * (tau_rt_nids + 1) > tau_rt_ids_mask + 1) {
+    struct tau_rt_id *old = tau_rt_ids;
+    uint32_t old_size = tau_rt_ids ? tau_rt_ids_mask + 1 : 0;
+    uint32_t size = old_size ? 2 * old_size : 256;
+    struct tau_rt_id *ids = calloc(size, sizeof(*ids));
+    if (!ids)
+      return NULL;
+    tau_rt_ids = ids;
+    tau_rt_ids_mask = size - 1;
+    for (uint32_t i = 0; i < old_size; ++i)
+      if (old[i].id)
+        *tau_rt_id_slot_locked(old[i].id) = old[i];
+    free(old);
+  }
+
+  struct tau_rt_id *entry = tau_rt_id_slot_locked(id);
+  if (!entry->id) {
+    entry->function = tau_rt_register_locked(name);
+    if (!entry->function)
+      return NULL;
+    entry->id = id;
+    ++tau_rt_nids;
+  }
+  return entry->function;
+}
+
+/*
+ * An id that no section described (its module was not given the module
+ * pass) is named after its value.
+ */
+static TAU_RT_COLD uint32_t
+tau_rt_hashed_id_miss(struct tau_rt_thread *self, uint64_t id) {
+  char name[32];
+  snprintf(name, sizeof(name), "[id 0x%016" PRIx64 "]", id);
+  pthread_mutex_lock(&tau_rt_lock);
+  struct tau_rt_function *f = tau_rt_add_id_locked(id, name);
+  pthread_mutex_unlock(&tau_rt_lock);
+  if (!f)
+    return TAU_RT_NO_ID;
+  tau_rt_cache_insert(&self->ids, id, f->id);
+  return f->id;
+}
+
+static inline uint32_t tau_rt_hashed_id(struct tau_rt_thread *self,
+                                        uint64_t id) {
+  uint32_t fid = tau_rt_cache_find(&self->ids, id);
+  if (TAU_RT_LIKELY(fid != TAU_RT_NO_ID))
+    return fid;
+  return tau_rt_hashed_id_miss(self, id);
+}
+
+/*
+ * The main thread is thread 0, and its timer starts when the program does.
+ */
+__attribute__((constructor)) static void tau_rt_main_thread(void) {
+  if (!tau_rt_self)
+    tau_rt_thread_init();
+}
+
+void Tau_start(const char *name) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !name))
+    return;
+  uint32_t id = tau_rt_name_id(self, name);
+  if (TAU_RT_LIKELY(id != TAU_RT_NO_ID))
+    tau_rt_start(self, id, 1);
+}
+
+void Tau_start_sampled(const char *name, uint32_t calls) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !name))
+    return;
+  uint32_t id = tau_rt_name_id(self, name);
+  if (TAU_RT_LIKELY(id != TAU_RT_NO_ID))
+    tau_rt_start(self, id, calls ? calls : 1);
+}
+
+void Tau_stop(const char *name) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !name))
+    return;
+  uint32_t id = tau_rt_name_id(self, name);
+  if (TAU_RT_LIKELY(id != TAU_RT_NO_ID))
+    tau_rt_stop(self, id);
+}
+
+void Tau_loop_calls(const char *name, uint64_t calls) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !name))
+    return;
+  uint32_t id = tau_rt_name_id(self, name);
+  if (TAU_RT_LIKELY(id != TAU_RT_NO_ID))
+    tau_rt_loop_calls(self, id, calls);
+}
+
+/*
+ * The ids are hashes, never 0. A program or library passes its section once
+ * per module: it is only read the first time.
+ */
+
+void Tau_register_ids(const struct tau_rt_function_info *begin,
+                      const struct tau_rt_function_info *end) {
+  pthread_once(&tau_rt_once, tau_rt_init);
+  pthread_mutex_lock(&tau_rt_lock);
+  for (uint32_t i = 0; i < tau_rt_nsections; ++i)
+    if (tau_rt_sections[i] == begin) {
+      pthread_mutex_unlock(&tau_rt_lock);
+      return;
+    }
+  const struct tau_rt_function_info **sections =
+      realloc(tau_rt_sections, (tau_rt_nsections + 1) * sizeof(*sections));
+  if (sections) {
+    tau_rt_sections = sections;
+    tau_rt_sections[tau_rt_nsections++] = begin;
+  }
+  for (const struct tau_rt_function_info *info = begin; info < end; ++info)
+    if (info->id)
+      tau_rt_add_id_locked(info->id, info->name);
+  pthread_mutex_unlock(&tau_rt_lock);
+}
+
+void Tau_start_id(uint64_t id) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !id))
+    return;
+  uint32_t fid = tau_rt_hashed_id(self, id);
+  if (TAU_RT_LIKELY(fid != TAU_RT_NO_ID))
+    tau_rt_start(self, fid, 1);
+}
+
+void Tau_stop_id(uint64_t id) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !id))
+    return;
+  uint32_t fid = tau_rt_hashed_id(self, id);
+  if (TAU_RT_LIKELY(fid != TAU_RT_NO_ID))
+    tau_rt_stop(self, fid);
+}
+
+void Tau_loop_calls_id(uint64_t id, uint64_t calls) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_UNLIKELY(!self || !id))
+    return;
+  uint32_t fid = tau_rt_hashed_id(self, id);
+  if (TAU_RT_LIKELY(fid != TAU_RT_NO_ID))
+    tau_rt_loop_calls(self, fid, calls);
+}
+
+/*
+ * The handles are the functions of the registry.
+ */
+
+void *Tau_get_handle(const char *name) {
+  if (!name)
+    return NULL;
+  pthread_once(&tau_rt_once, tau_rt_init);
+  return tau_rt_register(name);
+}
+
+void Tau_register_handles(struct tau_rt_handle_slot *slots, size_t count) {
+  pthread_once(&tau_rt_once, tau_rt_init);
+  pthread_mutex_lock(&tau_rt_lock);
+  for (size_t i = 0; i < count; ++i)
+    *slots[i].slot = tau_rt_register_locked(slots[i].name);
+  pthread_mutex_unlock(&tau_rt_lock);
+}
+
+/*
+ * The flags of the functions already throttled are set at once.
+ */
+void Tau_register_throttle(struct tau_rt_throttle_flag *flags, size_t count) {
+  pthread_once(&tau_rt_once, tau_rt_init);
+  pthread_mutex_lock(&tau_rt_lock);
+  for (size_t i = 0; i < count; ++i) {
+    struct tau_rt_function *f = tau_rt_register_locked(flags[i].name);
+    if (!f)
+      continue;
+    char **fflags = realloc(f->flags, (f->nflags + 1) * sizeof(*fflags));
+    if (!fflags)
+      continue;
+    f->flags = fflags;
+    f->flags[f->nflags++] = flags[i].flag;
+    if (f->throttled)
+      __atomic_store_n(flags[i].flag, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&tau_rt_lock);
+}
+
+void Tau_inline_register(struct tau_rt_inline_counters *counters,
+                         const char *const *names, size_t count) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (!self)
+    return;
+  struct tau_rt_inline_table *table = malloc(sizeof(*table));
+  if (!table)
+    return;
+  table->counters = counters;
+  table->names = names;
+  table->count = count;
+  table->next = self->inline_tables;
+  __atomic_store_n(&self->inline_tables, table, __ATOMIC_RELEASE);
+}
+
+void Tau_start_handle(void *handle) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_LIKELY(self && handle))
+    tau_rt_start(self, ((struct tau_rt_function *)handle)->id, 1);
+}
+
+void Tau_start_handle_sampled(void *handle, uint32_t calls) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_LIKELY(self && handle))
+    tau_rt_start(self, ((struct tau_rt_function *)handle)->id,
+                 calls ? calls : 1);
+}
+
+void Tau_stop_handle(void *handle) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_LIKELY(self && handle))
+    tau_rt_stop(self, ((struct tau_rt_function *)handle)->id);
+}
+
+void Tau_loop_calls_handle(void *handle, uint64_t calls) {
+  struct tau_rt_thread *self = tau_rt_thread();
+  if (TAU_RT_LIKELY(self && handle))
+    tau_rt_loop_calls(self, ((struct tau_rt_function *)handle)->id, calls);
+}
+
+/*
+ * Output, in the format of TAU: the functions called by the thread, with
+ * their times in microseconds.
+ */
+static void tau_rt_write_profile(const char *dir, uint32_t index,
+                                 const struct tau_rt_counters *all,
+                                 uint32_t ncounters) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/profile.0.0.%u", dir, index);
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    fprintf(stderr, "TAU runtime: cannot write %s\n", path);
+    return;
+  }
+
+  uint32_t count = 0;
+  for (uint32_t id = 0; id < ncounters; ++id)
+    count += all[id].calls != 0;
+
+  fprintf(file, "%u templated_functions_MULTI_TIME\n", count);
+  fprintf(file, "# Name Calls Subrs Excl Incl ProfileCalls #<metadata>"
+                "<attribute><name>Metric Name</name><value>TIME</value>"
+                "</attribute><attribute><name>Node</name><value>0</value>"
+                "</attribute><attribute><name>Thread</name><value>%u"
+                "</value></attribute></metadata>\n",
+          index);
+  for (uint32_t id = 0; id < ncounters; ++id) {
+    const struct tau_rt_counters *counters = &all[id];
+    if (!counters->calls)
+      continue;
+    /* The calls of the throttled functions stop being counted */
+    const struct tau_rt_function *f = tau_rt_functions[id];
+    fprintf(file, "\"%s\" %llu %llu %.3f %.3f 0 GROUP=\"%s\"\n", f->name,
+            (unsigned long long)counters->calls,
+            (unsigned long long)counters->subrs, counters->exclusive / 1e3,
+            counters->inclusive / 1e3,
+            id == TAU_RT_APPLICATION         ? "TAU_DEFAULT"
+            : f->throttled && f->nflags != 0 ? "TAU_USER|TAU_THROTTLED"
+                                             : "TAU_USER");
+  }
+  fprintf(file, "0 aggregates\n");
+  fclose(file);
+}
+
+/*
+ * Write the profiles, with the timers still running stopped now, then the
+ * end of the trace: its calls still running end at the same time. The
+ * threads that did not exit yet are only read: their probes running
+ * meanwhile may or may not be counted, and the later ones are ignored.
+ */
+void Tau_rt_dump(void) {
+  if (atomic_exchange(&tau_rt_done, 1))
+    return;
+  uint64_t now = tau_rt_now();
+  const char *dir = getenv("PROFILEDIR");
+  if (!dir || !*dir)
+    dir = ".";
+
+  pthread_mutex_lock(&tau_rt_lock);
+  for (struct tau_rt_thread *self = atomic_load(&tau_rt_threads); self;
+       self = self->next) {
+    uint32_t count;
+    struct tau_rt_counters *counters = tau_rt_snapshot(self, now, &count);
+    if (!counters)
+      continue;
+    tau_rt_write_profile(dir, self->index, counters, count);
+    free(counters);
+  }
+  if (tau_rt_tracing) {
+    const char **names = malloc(tau_rt_nfunctions * sizeof(*names));
+    if (names) {
+      for (uint32_t id = 0; id < tau_rt_nfunctions; ++id)
+        names[id] = tau_rt_functions[id]->name;
+      tau_rt_trace_finish(tau_rt_self ? tau_rt_self->trace : NULL, names,
+                          tau_rt_nfunctions, atomic_load(&tau_rt_nthreads),
+                          now);
+      free(names);
+    }
+  }
+  pthread_mutex_unlock(&tau_rt_lock);
+}
@@ -0,0 +1,116 @@
+/*===- TAURuntime.h - Built-in profiling runtime --------------------------===*\
+|*                                                                            *|
+|* The functions called by the probes the plugin inserts with its default    *|
+|* options, for programs linked with libTAU_Runtime instead of TAU. Every    *|
+|* thread accumulates the calls and times of the functions in its own        *|
+|* memory, without locks; the profiles are written at exit, one TAU profile  *|
+|* file per thread (profile.0.0.<thread>), in $PROFILEDIR or the current    *|
+|* directory.                                                                 *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef TAU_RUNTIME_H
+#define TAU_RUNTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TAU_RT_EXPORT __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Name-based probes (the default of the plugin) */
+TAU_RT_EXPORT void Tau_start(const char *name);
+TAU_RT_EXPORT void Tau_stop(const char *name);
+
+/* Handle-based probes, for -tau-probe-handles */
+struct tau_rt_handle_slot {
+  void **slot;
+  const char *name;
+};
+
+TAU_RT_EXPORT void *Tau_get_handle(const char *name);
+TAU_RT_EXPORT void Tau_register_handles(struct tau_rt_handle_slot *slots,
+                                        size_t count);
+TAU_RT_EXPORT void Tau_start_handle(void *handle);
+TAU_RT_EXPORT void Tau_stop_handle(void *handle);
+
+/*
+ * Id-based probes, for -tau-probe-backend=tau-ids. Each program or library
+ * describes its ids in its tau_functions section, the entries the linker
+ * puts between __start_tau_functions and __stop_tau_functions: the
+ * constructors of its modules give the section to the runtime before the
+ * probes are called.
+ */
+struct tau_rt_function_info {
+  uint64_t id;
+  const char *name;
+  const char *file; /* "" if unknown */
+  uint32_t line;    /* 0 if unknown */
+  uint32_t reserved;
+};
+
+TAU_RT_EXPORT void Tau_register_ids(const struct tau_rt_function_info *begin,
+                                    const struct tau_rt_function_info *end);
+TAU_RT_EXPORT void Tau_start_id(uint64_t id);
+TAU_RT_EXPORT void Tau_stop_id(uint64_t id);
+
+/*
+ * Number of calls made in a loop whose probes were hoisted out of it, for
+ * -tau-loop-probes=hoist. The plugin calls the one matching its probes.
+ */
+TAU_RT_EXPORT void Tau_loop_calls(const char *name, uint64_t calls);
+TAU_RT_EXPORT void Tau_loop_calls_handle(void *handle, uint64_t calls);
+TAU_RT_EXPORT void Tau_loop_calls_id(uint64_t id, uint64_t calls);
+
+/*
+ * Start probes of the calls sampled with -tau-sample-period: the call stands
+ * for the given number of calls (the period, or 1 for the first call), and
+ * its time is scaled as much. The stop probes are the usual ones.
+ */
+TAU_RT_EXPORT void Tau_start_sampled(const char *name, uint32_t calls);
+TAU_RT_EXPORT void Tau_start_handle_sampled(void *handle, uint32_t calls);
+
+/*
+ * Throttle flags of -tau-throttle, set once their function is throttled:
+ * TAU_THROTTLE_NUMCALLS calls (100000 by default) taking less than
+ * TAU_THROTTLE_PERCALL microseconds each on average (10 by default), on any
+ * thread. Its probes are not called anymore. TAU_THROTTLE=0 disables it.
+ */
+struct tau_rt_throttle_flag {
+  char *flag;
+  const char *name;
+};
+
+TAU_RT_EXPORT void Tau_register_throttle(struct tau_rt_throttle_flag *flags,
+                                         size_t count);
+
+/*
+ * Counters of -tau-probe-backend=inline-counters: each module gives the
+ * table of the current thread on the first call of one of its functions in
+ * the thread. The times are in cycles of the cycle counter of the machine;
+ * they are added to the profiles of the thread when it exits or when they
+ * are written, converted to nanoseconds on x86.
+ */
+struct tau_rt_inline_counters {
+  uint64_t calls;
+  uint64_t inclusive;
+  uint64_t exclusive;
+};
+
+TAU_RT_EXPORT void Tau_inline_register(struct tau_rt_inline_counters *counters,
+                                       const char *const *names, size_t count);
+
+/*
+ * Write the profiles now rather than at exit; later probes are ignored. The
+ * threads still running are read as they are, without being stopped.
+ */
+TAU_RT_EXPORT void Tau_rt_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TAU_RUNTIME_H */
@@ -0,0 +1,380 @@
+/*===- TAURuntimeTrace.c - Event traces of the built-in runtime -----------===*\
+|*                                                                            *|
+|* The writer thread goes through the buffers of the threads, appends their  *|
+|* filled chunks to the trace file and gives them back. It sleeps while      *|
+|* there is nothing to write, and is woken up by the threads whose ring is  *|
+|* half full. The file is opened with O_DIRECT when possible: the chunks go *|
+|* to the disk without being copied to the page cache.                      *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "TAURuntimeTrace.h"
+
+/* Multiple of TAU_TRACE_BLOCK */
+#define TAU_RT_TRACE_CHUNK_SIZE (256 * 1024)
+#define TAU_RT_TRACE_FILE "tautrace.bin"
+
+static int tau_rt_trace_fd = -1;
+static uint32_t tau_rt_trace_nchunks = 8;
+static uint64_t tau_rt_trace_start;
+static uint64_t tau_rt_trace_start_realtime;
+
+static struct tau_rt_trace_buffer *_Atomic tau_rt_trace_buffers;
+
+static pthread_t tau_rt_trace_writer;
+static pthread_mutex_t tau_rt_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tau_rt_trace_wake = PTHREAD_COND_INITIALIZER;
+static atomic_int tau_rt_trace_stop;
+/* Set at the end of the trace: the threads drop their events afterwards */
+static atomic_int tau_rt_trace_closed;
+static _Atomic uint64_t tau_rt_trace_lost;
+
+/* Only used by the writer, then by tau_rt_trace_finish */
+static uint64_t tau_rt_trace_offset;
+static int tau_rt_trace_failed;
+
+static struct tau_trace_chunk_header *
+tau_rt_trace_chunk(const struct tau_rt_trace_buffer *buffer,
+                   uint64_t sequence) {
+  return (struct tau_trace_chunk_header *)(buffer->chunks +
+                                           (sequence % buffer->nchunks) *
+                                               TAU_RT_TRACE_CHUNK_SIZE);
+}
+
+static struct tau_trace_event *
+tau_rt_trace_events(struct tau_trace_chunk_header *chunk) {
+  return (struct tau_trace_event *)(chunk + 1);
+}
+
+/* Start filling the chunk following the filled ones */
+static void tau_rt_trace_start_chunk(struct tau_rt_trace_buffer *buffer) {
+  uint64_t sequence = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  struct tau_trace_chunk_header *chunk = tau_rt_trace_chunk(buffer, sequence);
+  memset(chunk, 0, sizeof(*chunk));
+  memcpy(chunk->magic, TAU_TRACE_CHUNK_MAGIC, sizeof(chunk->magic));
+  chunk->thread = buffer->thread;
+  chunk->sequence = sequence;
+  chunk->start = buffer->last;
+  __atomic_store_n(&buffer->next, tau_rt_trace_events(chunk),
+                   __ATOMIC_RELAXED);
+  buffer->end = (struct tau_trace_event *)((char *)chunk +
+                                           TAU_RT_TRACE_CHUNK_SIZE);
+}
+
+/*
+ * Number of events in the chunk being filled, from the position of the
+ * thread only: 0 if it is not filling one. Any thread may ask.
+ */
+static uint32_t tau_rt_trace_pending(struct tau_rt_trace_buffer *buffer) {
+  uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+  struct tau_trace_chunk_header *chunk = tau_rt_trace_chunk(buffer, head);
+  struct tau_trace_event *first = tau_rt_trace_events(chunk);
+  struct tau_trace_event *next =
+      __atomic_load_n(&buffer->next, __ATOMIC_RELAXED);
+  if (next >= first &&
+      (char *)next <= (char *)chunk + TAU_RT_TRACE_CHUNK_SIZE)
+    return (uint32_t)(next - first);
+  return 0;
+}
+
+/*
+ * Number of events in the chunk being filled, recorded in its header: 0 if
+ * the thread is not filling one. Only the thread itself may ask.
+ */
+static uint32_t tau_rt_trace_filled(struct tau_rt_trace_buffer *buffer) {
+  uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  struct tau_trace_chunk_header *chunk = tau_rt_trace_chunk(buffer, head);
+  if (chunk->sequence != head)
+    return 0; /* the thread waited for it when the trace ended */
+  uint32_t events = tau_rt_trace_pending(buffer);
+  if (events)
+    chunk->events = events;
+  return chunk->events;
+}
+
+static void tau_rt_trace_wake_writer(void) {
+  pthread_mutex_lock(&tau_rt_trace_lock);
+  pthread_cond_signal(&tau_rt_trace_wake);
+  pthread_mutex_unlock(&tau_rt_trace_lock);
+}
+
+static void tau_rt_trace_write(const void *data, size_t size) {
+  const char *bytes = data;
+  size_t written = 0;
+  while (!tau_rt_trace_failed && written < size) {
+    ssize_t count = write(tau_rt_trace_fd, bytes + written, size - written);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0) {
+      fprintf(stderr, "TAU runtime: cannot write the trace: %s\n",
+              count < 0 ? strerror(errno) : "short write");
+      tau_rt_trace_failed = 1; /* the chunks are still given back */
+      break;
+    }
+    written += count;
+  }
+  tau_rt_trace_offset += size;
+}
+
+/*
+ * Write the filled chunks of every thread, and free the buffers of the
+ * threads that exited. Returns the number of chunks written.
+ */
+static uint64_t tau_rt_trace_drain(void) {
+  uint64_t written = 0;
+  for (struct tau_rt_trace_buffer *buffer = atomic_load(&tau_rt_trace_buffers);
+       buffer; buffer = buffer->next_buffer) {
+    if (!buffer->chunks)
+      continue;
+    int finished = atomic_load_explicit(&buffer->finished,
+                                        memory_order_acquire);
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    for (; tail < head; ++tail, ++written) {
+      tau_rt_trace_write(tau_rt_trace_chunk(buffer, tail),
+                         TAU_RT_TRACE_CHUNK_SIZE);
+      atomic_store_explicit(&buffer->tail, tail + 1, memory_order_release);
+    }
+    if (finished) {
+      free(buffer->chunks);
+      buffer->chunks = NULL;
+    }
+  }
+  return written;
+}
+
+static void *tau_rt_trace_writer_main(void *arg) {
+  (void)arg;
+  /* The signals are for the threads of the program */
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  for (;;) {
+    int stop = atomic_load(&tau_rt_trace_stop);
+    if (tau_rt_trace_drain())
+      continue;
+    if (stop)
+      return NULL;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 10 * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_nsec -= 1000000000;
+      ++deadline.tv_sec;
+    }
+    pthread_mutex_lock(&tau_rt_trace_lock);
+    if (!atomic_load(&tau_rt_trace_stop))
+      pthread_cond_timedwait(&tau_rt_trace_wake, &tau_rt_trace_lock,
+                             &deadline);
+    pthread_mutex_unlock(&tau_rt_trace_lock);
+  }
+}
+
+int tau_rt_trace_init(uint64_t now) {
+  const char *trace = getenv("TAU_TRACE");
+  if (!trace || !atoi(trace))
+    return 0;
+  const char *chunks = getenv("TAU_TRACE_CHUNKS");
+  if (chunks && atoi(chunks) >= 2)
+    tau_rt_trace_nchunks = atoi(chunks);
+
+  const char *dir = getenv("TRACEDIR");
+  if (!dir || !*dir)
+    dir = ".";
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/" TAU_RT_TRACE_FILE, dir);
+  tau_rt_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  if (tau_rt_trace_fd < 0 && errno == EINVAL) /* e.g. on tmpfs */
+    tau_rt_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (tau_rt_trace_fd < 0) {
+    fprintf(stderr, "TAU runtime: cannot write %s: %s\n", path,
+            strerror(errno));
+    return 0;
+  }
+
+  /* The header is written at the end */
+  void *block = aligned_alloc(TAU_TRACE_BLOCK, TAU_TRACE_BLOCK);
+  int started = block != NULL;
+  if (block) {
+    memset(block, 0, TAU_TRACE_BLOCK);
+    tau_rt_trace_write(block, TAU_TRACE_BLOCK);
+    free(block);
+  }
+
+  struct timespec realtime;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  tau_rt_trace_start_realtime =
+      (uint64_t)realtime.tv_sec * 1000000000u + (uint64_t)realtime.tv_nsec;
+  tau_rt_trace_start = now;
+
+  if (!started || pthread_create(&tau_rt_trace_writer, NULL,
+                                 tau_rt_trace_writer_main, NULL)) {
+    fprintf(stderr, "TAU runtime: cannot start the trace writer\n");
+    close(tau_rt_trace_fd);
+    tau_rt_trace_fd = -1;
+    return 0;
+  }
+  return 1;
+}
+
+struct tau_rt_trace_buffer *tau_rt_trace_attach(uint32_t thread,
+                                                uint64_t now) {
+  struct tau_rt_trace_buffer *buffer = calloc(1, sizeof(*buffer));
+  if (!buffer)
+    return NULL;
+  buffer->nchunks = tau_rt_trace_nchunks;
+  buffer->chunks = aligned_alloc(TAU_TRACE_BLOCK, (size_t)buffer->nchunks *
+                                                      TAU_RT_TRACE_CHUNK_SIZE);
+  if (!buffer->chunks) {
+    free(buffer);
+    return NULL;
+  }
+  buffer->thread = thread;
+  buffer->last = now;
+  tau_rt_trace_start_chunk(buffer);
+
+  buffer->next_buffer = atomic_load(&tau_rt_trace_buffers);
+  while (!atomic_compare_exchange_weak(&tau_rt_trace_buffers,
+                                       &buffer->next_buffer, buffer))
+    ;
+  return buffer;
+}
+
+/*
+ * After the end of the trace, the events are written over a couple of
+ * spare ones and counted as lost, as are those of the chunk the thread was
+ * filling, which tau_rt_trace_finish does not read.
+ */
+static void tau_rt_trace_drop(struct tau_rt_trace_buffer *buffer) {
+  static _Thread_local struct tau_trace_event spare[2];
+  if (buffer->next >= spare && buffer->next <= spare + 2)
+    atomic_fetch_add(&tau_rt_trace_lost, buffer->next - spare);
+  else
+    atomic_fetch_add(&tau_rt_trace_lost, tau_rt_trace_pending(buffer));
+  __atomic_store_n(&buffer->next, spare, __ATOMIC_RELAXED);
+  buffer->end = spare + 2;
+}
+
+void tau_rt_trace_next_chunk(struct tau_rt_trace_buffer *buffer) {
+  if (atomic_load_explicit(&tau_rt_trace_closed, memory_order_relaxed)) {
+    tau_rt_trace_drop(buffer);
+    return;
+  }
+
+  tau_rt_trace_filled(buffer);
+  uint64_t head =
+      atomic_load_explicit(&buffer->head, memory_order_relaxed) + 1;
+  atomic_store_explicit(&buffer->head, head, memory_order_release);
+
+  uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+  if (head - tail >= buffer->nchunks / 2)
+    tau_rt_trace_wake_writer();
+  /* The next chunk is free once written */
+  while (head - tail >= buffer->nchunks) {
+    if (atomic_load_explicit(&tau_rt_trace_closed, memory_order_relaxed)) {
+      tau_rt_trace_drop(buffer);
+      return;
+    }
+    sched_yield();
+    tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+  }
+  tau_rt_trace_start_chunk(buffer);
+}
+
+void tau_rt_trace_detach(struct tau_rt_trace_buffer *buffer) {
+  if (!buffer ||
+      atomic_load_explicit(&tau_rt_trace_closed, memory_order_relaxed))
+    return;
+  if (tau_rt_trace_filled(buffer))
+    atomic_store_explicit(
+        &buffer->head,
+        atomic_load_explicit(&buffer->head, memory_order_relaxed) + 1,
+        memory_order_release);
+  atomic_store_explicit(&buffer->finished, 1, memory_order_release);
+  tau_rt_trace_wake_writer();
+}
+
+void tau_rt_trace_finish(struct tau_rt_trace_buffer *self,
+                         const char *const *names, uint32_t count,
+                         uint32_t threads, uint64_t now) {
+  if (tau_rt_trace_fd < 0 || atomic_exchange(&tau_rt_trace_closed, 1))
+    return;
+  atomic_store(&tau_rt_trace_stop, 1);
+  tau_rt_trace_wake_writer();
+  pthread_join(tau_rt_trace_writer, NULL);
+
+  /* The chunks filled since the writer stopped, then the one this thread is
+   * filling. The other threads still running keep writing theirs */
+  tau_rt_trace_drain();
+  for (struct tau_rt_trace_buffer *buffer = atomic_load(&tau_rt_trace_buffers);
+       buffer; buffer = buffer->next_buffer) {
+    if (!buffer->chunks || atomic_load(&buffer->finished))
+      continue;
+    if (buffer != self)
+      atomic_fetch_add(&tau_rt_trace_lost, tau_rt_trace_pending(buffer));
+    else if (tau_rt_trace_filled(buffer))
+      tau_rt_trace_write(
+          tau_rt_trace_chunk(buffer, atomic_load(&buffer->head)),
+          TAU_RT_TRACE_CHUNK_SIZE);
+  }
+
+  size_t names_size = 0;
+  for (uint32_t id = 0; id < count; ++id)
+    names_size += strlen(names[id]) + 1;
+  size_t padded = (names_size + TAU_TRACE_BLOCK - 1) &
+                  ~(size_t)(TAU_TRACE_BLOCK - 1);
+  struct tau_trace_file_header *header =
+      aligned_alloc(TAU_TRACE_BLOCK, TAU_TRACE_BLOCK);
+  char *block = padded ? aligned_alloc(TAU_TRACE_BLOCK, padded) : NULL;
+  if (!header || (padded && !block)) {
+    fprintf(stderr, "TAU runtime: out of memory, the trace is incomplete\n");
+    free(header);
+    free(block);
+    close(tau_rt_trace_fd);
+    return;
+  }
+
+  memset(block, 0, padded);
+  char *name = block;
+  for (uint32_t id = 0; id < count; ++id) {
+    size_t length = strlen(names[id]) + 1;
+    memcpy(name, names[id], length);
+    name += length;
+  }
+  uint64_t names_offset = tau_rt_trace_offset;
+  tau_rt_trace_write(block, padded);
+
+  memset(header, 0, TAU_TRACE_BLOCK);
+  memcpy(header->magic, TAU_TRACE_MAGIC, sizeof(header->magic));
+  header->version = TAU_TRACE_VERSION;
+  header->chunk_size = TAU_RT_TRACE_CHUNK_SIZE;
+  header->start_realtime = tau_rt_trace_start_realtime;
+  header->start = tau_rt_trace_start;
+  header->end = now;
+  header->names_offset = names_offset;
+  header->names_size = names_size;
+  header->threads = threads;
+  header->functions = count;
+  header->lost_events = atomic_load(&tau_rt_trace_lost);
+  if (!tau_rt_trace_failed &&
+      pwrite(tau_rt_trace_fd, header, TAU_TRACE_BLOCK, 0) != TAU_TRACE_BLOCK)
+    fprintf(stderr, "TAU runtime: cannot write the trace: %s\n",
+            strerror(errno));
+  free(header);
+  free(block);
+  close(tau_rt_trace_fd);
+}
@@ -0,0 +1,101 @@
+/*===- TAURuntimeTrace.h - Event traces of the built-in runtime -----------===*\
+|*                                                                            *|
+|* With TAU_TRACE=1, every thread also records the entries and exits of the  *|
+|* functions in a ring of fixed-size chunks of its own (TAU_TRACE_CHUNKS of  *|
+|* them, 8 by default). A full chunk is handed to a writer thread, which     *|
+|* appends it to the trace file and gives it back; the thread waits for it  *|
+|* if the writer is late, so the memory of the traces is bounded however    *|
+|* long the run. The ring of a thread has a single producer (the thread)    *|
+|* and a single consumer (the writer): no lock is taken.                    *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef TAU_RUNTIME_TRACE_H
+#define TAU_RUNTIME_TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "TAUTrace.h"
+
+struct tau_rt_trace_buffer {
+  /* Written by the thread only; next with relaxed atomic stores, as the end
+   * of the trace counts the events of the chunk being filled */
+  struct tau_trace_event *next; /* in the chunk being filled */
+  struct tau_trace_event *end;
+  uint64_t last; /* time of the previous event */
+
+  char *chunks;
+  uint32_t nchunks;
+  uint32_t thread;
+  _Atomic uint64_t head; /* chunks filled */
+  _Atomic uint64_t tail; /* chunks written by the writer */
+  atomic_int finished;   /* the thread exited, its last chunk is filled */
+
+  struct tau_rt_trace_buffer *next_buffer; /* in the list of the writer */
+};
+
+/*
+ * Read TAU_TRACE and, if set, open the trace file and start the writer.
+ * Returns whether the threads must be traced.
+ */
+int tau_rt_trace_init(uint64_t now);
+
+/* The buffer of a new thread, NULL if out of memory */
+struct tau_rt_trace_buffer *tau_rt_trace_attach(uint32_t thread, uint64_t now);
+
+/* Hand over the last chunk of an exiting thread */
+void tau_rt_trace_detach(struct tau_rt_trace_buffer *buffer);
+
+/*
+ * Hand over the chunk being filled and start the next one, waiting for the
+ * writer if none is free.
+ */
+void tau_rt_trace_next_chunk(struct tau_rt_trace_buffer *buffer);
+
+/*
+ * Write what is left and the names of the functions, and close the file.
+ * The chunks being filled by the threads still running, other than the one
+ * of \p self, are not read: their events are counted as lost.
+ */
+void tau_rt_trace_finish(struct tau_rt_trace_buffer *self,
+                         const char *const *names, uint32_t count,
+                         uint32_t threads, uint64_t now);
+
+static inline void tau_rt_trace_put(struct tau_rt_trace_buffer *buffer,
+                                    enum tau_trace_kind kind, uint32_t id,
+                                    uint32_t value) {
+  buffer->next->word = (uint32_t)kind << TAU_TRACE_KIND_SHIFT | id;
+  buffer->next->value = value;
+  __atomic_store_n(&buffer->next, buffer->next + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Record an event at the given time: its delta with the previous one, and
+ * the high bits of the delta first if they are not 0. Both are put in the
+ * same chunk, whose start is the time of the previous event.
+ */
+static inline void tau_rt_trace_event(struct tau_rt_trace_buffer *buffer,
+                                      enum tau_trace_kind kind, uint32_t id,
+                                      uint64_t now) {
+  if (__builtin_expect(buffer->end - buffer->next < 2, 0))
+    tau_rt_trace_next_chunk(buffer);
+  uint64_t delta = now - buffer->last;
+  buffer->last = now;
+  if (__builtin_expect(delta >> 32 != 0, 0))
+    tau_rt_trace_put(buffer, TAU_TRACE_CLOCK, 0, (uint32_t)(delta >> 32));
+  tau_rt_trace_put(buffer, kind, id, (uint32_t)delta);
+}
+
+static inline void tau_rt_trace_calls(struct tau_rt_trace_buffer *buffer,
+                                      uint32_t id, uint64_t calls) {
+  do {
+    uint32_t value = calls > UINT32_MAX ? UINT32_MAX : (uint32_t)calls;
+    if (__builtin_expect(buffer->next == buffer->end, 0))
+      tau_rt_trace_next_chunk(buffer);
+    tau_rt_trace_put(buffer, TAU_TRACE_CALLS, id, value);
+    calls -= value;
+  } while (calls);
+}
+
+#endif /* TAU_RUNTIME_TRACE_H */
@@ -0,0 +1,74 @@
+/*===- TAUTrace.h - Format of the event traces ----------------------------===*\
+|*                                                                            *|
+|* The traces written by the built-in runtime with TAU_TRACE=1, in a single  *|
+|* file, in the byte order of the traced machine:                            *|
+|*                                                                            *|
+|*   - a block holding a tau_trace_file_header;                               *|
+|*   - chunks of tau_trace_event, chunk_size bytes each, starting with a      *|
+|*     tau_trace_chunk_header. The chunks of the threads are interleaved, in *|
+|*     the order they were filled; those of a thread are numbered;           *|
+|*   - the names of the functions, in the order of their ids, each ended by  *|
+|*     a NUL, padded to a block.                                              *|
+|*                                                                            *|
+|* The time of an event is the time of the previous event of its chunk plus *|
+|* its value, in nanoseconds; the first event is relative to the start of    *|
+|* the chunk, so that the chunks can be decoded independently.              *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef TAU_TRACE_H
+#define TAU_TRACE_H
+
+#include <stdint.h>
+
+#define TAU_TRACE_MAGIC "TAUTRACE"
+#define TAU_TRACE_CHUNK_MAGIC "TAUCHUNK"
+#define TAU_TRACE_VERSION 1
+
+/* Everything in the file is aligned to blocks, for O_DIRECT */
+#define TAU_TRACE_BLOCK 4096
+
+enum tau_trace_kind {
+  TAU_TRACE_ENTER = 0, /* value: time since the previous event */
+  TAU_TRACE_EXIT = 1,  /* value: time since the previous event */
+  /* Calls made in a loop whose probes were hoisted (-tau-loop-probes=hoist)
+   * since its ENTER; value: number of calls, possibly split over several
+   * events. Does not advance the time */
+  TAU_TRACE_CALLS = 2,
+  /* Adds value << 32 to the time of the next event; no function */
+  TAU_TRACE_CLOCK = 3,
+};
+
+#define TAU_TRACE_KIND_SHIFT 30
+#define TAU_TRACE_ID_MASK ((1u << TAU_TRACE_KIND_SHIFT) - 1)
+
+struct tau_trace_event {
+  uint32_t word; /* kind << TAU_TRACE_KIND_SHIFT | function id */
+  uint32_t value;
+};
+
+struct tau_trace_file_header {
+  char magic[8]; /* TAU_TRACE_MAGIC */
+  uint32_t version;
+  uint32_t chunk_size;
+  uint64_t start_realtime; /* ns since the epoch at the start of the trace */
+  uint64_t start;          /* clock of the events at the start of the trace */
+  uint64_t end;            /* and at its end: the calls still running end */
+  uint64_t names_offset;
+  uint64_t names_size; /* without the padding */
+  uint32_t threads;
+  uint32_t functions;
+  uint64_t lost_events; /* recorded after the end of the trace, or still in
+                          * the chunks of the threads running then */
+};
+
+struct tau_trace_chunk_header {
+  char magic[8]; /* TAU_TRACE_CHUNK_MAGIC */
+  uint32_t thread;
+  uint32_t events;
+  uint64_t sequence; /* of the chunk among those of its thread */
+  uint64_t start;    /* clock the first event is relative to */
+  uint64_t reserved[4];
+};
+
+#endif /* TAU_TRACE_H */
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 
 static const char * name = "some function";
@@ -10,3 +11,39 @@ void tau_prof_func_call(char * name) {
 void tau_prof_func_ret(char * name) {
   fprintf(stderr, "Returned from %s \n", name);
 }
+
+/* Calls made in a loop whose probes were hoisted out of it, for
+ * -tau-loop-probes=hoist */
+void tau_prof_loop_calls(char *name, uint64_t calls) {
+  fprintf(stderr, "%llu calls of %s in a loop \n", (unsigned long long)calls,
+          name);
+}
+
+/* Handle-based probes, for -tau-probe-handles. The handle of a function is
+ * simply its name here. */
+
+struct handle_slot {
+  void **slot;
+  const char *name;
+};
+
+void *tau_prof_get_handle(char *name) {
+  return name;
+}
+
+void tau_prof_register_handles(struct handle_slot *slots, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    *slots[i].slot = (void *)slots[i].name;
+}
+
+void tau_prof_handle_call(void *handle) {
+  fprintf(stderr, "Calling %s \n", handle ? (char *)handle : "(unregistered)");
+}
+
+void tau_prof_handle_ret(void *handle) {
+  fprintf(stderr, "Returned from %s \n", handle ? (char *)handle : "(unregistered)");
+}
+
+void tau_prof_handle_loop_calls(void *handle, uint64_t calls) {
+  tau_prof_loop_calls(handle ? (char *)handle : "(unregistered)", calls);
+}
@@ -0,0 +1,88 @@
+; The counters kept inline, in thread-local storage, and given to the
+; runtime by each thread the first time it runs a probe. The running calls
+; of each function are counted, so that the inclusive cycles of the
+; recursive calls are only added by the outermost one
+; RUN: %opt-tau -passes=tau-prof -tau-probe-backend=inline-counters \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: not %opt-tau -passes='function(tau-prof)' \
+; RUN:   -tau-probe-backend=inline-counters \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=FUNCTION
+
+; CHECK: @tau.inline_counters = private thread_local global [2 x { i64, i64, i64 }] zeroinitializer
+; CHECK: @tau.inline_registered = private thread_local global i8 0
+; CHECK: @work.tau_active = private thread_local global i32 0
+; CHECK: @tau.inline_names = private constant [2 x i8*] [i8* getelementptr {{.*}} @tau.names, i64 0, i64 5), i8* getelementptr {{.*}} @tau.names, i64 0, i64 0)]
+
+; CHECK-LABEL: define void @work(i32 %n)
+; CHECK: call void @tau.register_inline()
+; CHECK: [[ACTIVE0:%.*]] = load i32, i32* @work.tau_active
+; CHECK-NEXT: [[RUNNING:%.*]] = add i32 [[ACTIVE0]], 1
+; CHECK-NEXT: store i32 [[RUNNING]], i32* @work.tau_active
+; CHECK-NEXT: [[START:%.*]] = call i64 @llvm.readcyclecounter()
+; CHECK: base:
+; CHECK-NEXT: [[STOP:%.*]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: [[ELAPSED:%.*]] = sub i64 [[STOP]], [[START]]
+; CHECK-NEXT: [[ACTIVE:%.*]] = load i32, i32* @work.tau_active
+; CHECK-NEXT: [[LEFT:%.*]] = sub i32 [[ACTIVE]], 1
+; CHECK-NEXT: store i32 [[LEFT]], i32* @work.tau_active
+; CHECK: [[OUTERMOST:%.*]] = icmp eq i32 [[LEFT]], 0
+; CHECK-NEXT: [[DELTA:%.*]] = select i1 [[OUTERMOST]], i64 [[ELAPSED]], i64 0
+; CHECK: store i64 {{%.*}}, i64* getelementptr {{.*}} @tau.inline_counters, i32 0, i32 0, i32 0)
+; CHECK: [[INCL:%.*]] = add i64 {{%.*}}, [[DELTA]]
+; CHECK-NEXT: store i64 [[INCL]], i64* getelementptr {{.*}} @tau.inline_counters, i32 0, i32 0, i32 1)
+; CHECK: store i64 {{%.*}}, i64* getelementptr {{.*}} @tau.inline_counters, i32 0, i32 0, i32 2)
+; CHECK-NEXT: ret void
+; CHECK: rec:
+; CHECK: call void @work(
+; CHECK-NEXT: [[STOP:%.*]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: [[ELAPSED:%.*]] = sub i64 [[STOP]], [[START]]
+; CHECK-NEXT: [[ACTIVE:%.*]] = load i32, i32* @work.tau_active
+; CHECK-NEXT: [[LEFT:%.*]] = sub i32 [[ACTIVE]], 1
+; CHECK-NEXT: store i32 [[LEFT]], i32* @work.tau_active
+; CHECK: [[OUTERMOST:%.*]] = icmp eq i32 [[LEFT]], 0
+; CHECK-NEXT: [[DELTA:%.*]] = select i1 [[OUTERMOST]], i64 [[ELAPSED]], i64 0
+; CHECK: [[INCL:%.*]] = add i64 {{%.*}}, [[DELTA]]
+; CHECK-NEXT: store i64 [[INCL]], i64* getelementptr {{.*}} @tau.inline_counters, i32 0, i32 0, i32 1)
+; CHECK: ret void
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: call i64 @llvm.readcyclecounter()
+; CHECK: out:
+; CHECK-NEXT: call i64 @llvm.readcyclecounter()
+; CHECK: store i64 {{%.*}}, i64* getelementptr {{.*}} @tau.inline_counters, i32 0, i32 1, i32 0)
+
+; CHECK-LABEL: define internal void @tau.register_inline()
+; CHECK-NEXT: store i8 1, i8* @tau.inline_registered
+; CHECK-NEXT: call void @Tau_inline_register(i8* bitcast ({{.*}} @tau.inline_counters to i8*), i8* bitcast ({{.*}} @tau.inline_names to i8*), i64 2)
+
+; FUNCTION: error: -tau-probe-backend=inline-counters needs the module pass
+
+define void @work(i32 %n) {
+entry:
+  %c = icmp eq i32 %n, 0
+  br i1 %c, label %base, label %rec
+
+base:
+  ret void
+
+rec:
+  %m = sub i32 %n, 1
+  call void @work(i32 %m)
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work(i32 3)
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
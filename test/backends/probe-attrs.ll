@@ -0,0 +1,64 @@
+; The attribute profiles of -tau-probe-attrs, given to the declarations of
+; the probes: none by default, nounwind only, or what TAU's runtime
+; guarantees, which depends on the argument of the probes
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/work-main.txt \
+; RUN:   -S %s | FileCheck %s --check-prefix=NONE
+; RUN: %opt-tau -passes=tau-prof -tau-probe-attrs=nounwind \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=NOUNWIND
+; RUN: %opt-tau -passes=tau-prof -tau-probe-attrs=inaccessiblemem \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=NAMES
+; RUN: %opt-tau -passes=tau-prof -tau-probe-attrs=inaccessiblemem \
+; RUN:   -tau-probe-backend=tau-handles -tau-probe-handles=lazy \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=HANDLES
+; The probes inlined in main then no longer keep the global from being
+; forwarded
+; RUN: %opt-tau -passes='default<O2>' \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=NONE-O2
+; RUN: %opt-tau -passes='default<O2>' -tau-probe-attrs=inaccessiblemem \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=NAMES-O2
+
+; NONE: declare void @Tau_start(i8*){{$}}
+; NONE: declare void @Tau_stop(i8*){{$}}
+
+; NOUNWIND: declare void @Tau_start(i8*) [[ATTRS:#[0-9]+]]
+; NOUNWIND: declare void @Tau_stop(i8*) [[ATTRS]]
+; NOUNWIND: attributes [[ATTRS]] = { nounwind }
+
+; The name is only read, and not kept
+; NAMES: declare void @Tau_start(i8* nocapture readonly) [[ATTRS:#[0-9]+]]
+; NAMES: declare void @Tau_stop(i8* nocapture readonly) [[ATTRS]]
+; NAMES: attributes [[ATTRS]] = { inaccessiblemem_or_argmemonly nocallback nounwind willreturn }
+
+; A handle is opaque, but Tau_get_handle may keep the name it is given
+; HANDLES: declare void @Tau_start_handle(i8*) [[ATTRS:#[0-9]+]]
+; HANDLES: declare void @Tau_stop_handle(i8*) [[ATTRS]]
+; HANDLES: declare i8* @Tau_get_handle(i8* readonly) [[GET:#[0-9]+]]
+; HANDLES: attributes [[ATTRS]] = { inaccessiblememonly nocallback nounwind willreturn }
+; HANDLES: attributes [[GET]] = { inaccessiblemem_or_argmemonly nocallback nounwind willreturn }
+
+; NONE-O2-LABEL: define i32 @main()
+; NONE-O2: call void @Tau_stop(
+; NONE-O2-NEXT: load i1, i1* @counter
+; NONE-O2: ret i32 %value
+
+; NAMES-O2-LABEL: define i32 @main()
+; NAMES-O2-NOT: load {{.*}} @counter
+; NAMES-O2: ret i32 1
+
+@counter = internal global i32 0
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+  store i32 1, i32* @counter
+  call void @work()
+  %value = load i32, i32* @counter
+  ret i32 %value
+}
@@ -0,0 +1,43 @@
+; The probes of sandbox/rtlib.c
+; RUN: %opt-tau -passes=tau-prof -tau-probe-backend=rtlib \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: %opt-tau -passes='default<O2>' -tau-probe-backend=rtlib \
+; RUN:   -tau-loop-probes=hoist -tau-input-file=%S/../Inputs/work-main.txt \
+; RUN:   -S %s | FileCheck %s --check-prefix=HOIST
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: call void @tau_prof_func_call(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; CHECK-NEXT: call void @tau_prof_func_ret(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: call void @tau_prof_func_call(i8* getelementptr {{.*}} @tau.names, i64 0, i64 0))
+; CHECK: out:
+; CHECK-NEXT: call void @tau_prof_func_ret(i8* getelementptr {{.*}} @tau.names, i64 0, i64 0))
+
+; HOIST-LABEL: define i32 @main()
+; HOIST: call void @tau_prof_func_call(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; HOIST: loop:
+; HOIST-NOT: call void
+; HOIST: out:
+; HOIST-NEXT: call void @tau_prof_loop_calls(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5), i64 %{{.*}})
+; HOIST-NEXT: call void @tau_prof_func_ret(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
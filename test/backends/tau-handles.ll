@@ -0,0 +1,77 @@
+; The probes of TAU, given handles filled by a constructor
+; RUN: %opt-tau -passes=tau-prof -tau-probe-backend=tau-handles \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: %opt-tau -passes='default<O2>' -tau-probe-backend=tau-handles \
+; RUN:   -tau-loop-probes=hoist -tau-input-file=%S/../Inputs/work-main.txt \
+; RUN:   -S %s | FileCheck %s --check-prefix=HOIST
+; Handles filled lazily are filled before the loop
+; RUN: %opt-tau -passes='default<O2>' -tau-probe-backend=tau-handles \
+; RUN:   -tau-probe-handles=lazy -tau-loop-probes=hoist \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt \
+; RUN:   -pass-remarks=tau-profile -S %s 2>&1 | FileCheck %s --check-prefix=LAZY
+
+; CHECK: @work.tau_handle = private global i8* null
+; CHECK: @main.tau_handle = private global i8* null
+; CHECK: @tau.handles = private constant [2 x { i8**, i8* }] [{ i8**, i8* } { i8** @work.tau_handle, {{.*}} }, { i8**, i8* } { i8** @main.tau_handle, {{.*}} }]
+; CHECK: @llvm.global_ctors = {{.*}} @tau.register_handles
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: [[H:%.*]] = load i8*, i8** @work.tau_handle
+; CHECK-NEXT: call void @Tau_start_handle(i8* [[H]])
+; CHECK-NEXT: call void @Tau_stop_handle(i8* [[H]])
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: [[H:%.*]] = load i8*, i8** @main.tau_handle
+; CHECK-NEXT: call void @Tau_start_handle(i8* [[H]])
+; CHECK: out:
+; CHECK-NEXT: call void @Tau_stop_handle(i8* [[H]])
+
+; CHECK-LABEL: define internal void @tau.register_handles()
+; CHECK-NEXT: call void @Tau_register_handles(i8* bitcast ({{.*}} @tau.handles to i8*), i64 2)
+
+; HOIST-LABEL: define i32 @main()
+; HOIST: [[H:%.*]] = load i8*, i8** @work.tau_handle
+; HOIST-NEXT: call void @Tau_start_handle(i8* [[H]])
+; HOIST: loop:
+; HOIST-NOT: call void
+; HOIST: out:
+; HOIST-NEXT: call void @Tau_loop_calls_handle(i8* [[H]], i64 %{{.*}})
+; HOIST-NEXT: call void @Tau_stop_handle(i8* [[H]])
+
+; LAZY: remark: <unknown>:0:0: probes of work hoisted out of the loop, with a count of the calls
+; LAZY-LABEL: define i32 @main()
+; LAZY: [[H:%.*]] = load i8*, i8** @work.tau_handle
+; LAZY-NEXT: [[EMPTY:%.*]] = icmp eq i8* [[H]], null
+; LAZY-NEXT: br i1 [[EMPTY]], label %[[GET:.*]], label %[[FILLED:.*]], !prof
+; LAZY: [[GET]]:
+; LAZY-NEXT: [[NEW:%.*]] = tail call i8* @Tau_get_handle(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; LAZY-NEXT: store i8* [[NEW]], i8** @work.tau_handle
+; LAZY: [[FILLED]]:
+; LAZY-NEXT: [[WORK:%.*]] = phi i8* [ [[H]], %{{.*}} ], [ [[NEW]], %[[GET]] ]
+; LAZY-NEXT: call void @Tau_start_handle(i8* [[WORK]])
+; LAZY: loop:
+; LAZY-NOT: call void
+; LAZY-NOT: @work.tau_handle
+; LAZY: out:
+; LAZY-NEXT: call void @Tau_loop_calls_handle(i8* [[WORK]], i64 %{{.*}})
+; LAZY-NEXT: call void @Tau_stop_handle(i8* [[WORK]])
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
@@ -0,0 +1,35 @@
+; The ids of the functions that are not local to their module only depend
+; on their names, so that the objects of another build directory agree; the
+; local functions are told apart by the full path of their file
+; RUN: %opt-tau -passes=tau-prof -tau-probe-backend=tau-ids \
+; RUN:   -tau-input-file=%S/../Inputs/work-helper.txt -S %s > %t.a
+; RUN: sed 's|/build/a|/build/b|' %s | %opt-tau -passes=tau-prof \
+; RUN:   -tau-probe-backend=tau-ids \
+; RUN:   -tau-input-file=%S/../Inputs/work-helper.txt -S > %t.b
+; RUN: cat %t.a %t.b | FileCheck %s
+
+; CHECK: call void @Tau_start_id(i64 [[WORK:-?[0-9]+]])
+; CHECK: call void @Tau_start_id(i64 [[HELPER:-?[0-9]+]])
+; CHECK: call void @Tau_start_id(i64 [[WORK]])
+; CHECK-NOT: call void @Tau_start_id(i64 [[HELPER]])
+
+define void @work() !dbg !6 {
+  call void @helper(), !dbg !10
+  ret void, !dbg !10
+}
+
+define internal void @helper() !dbg !9 {
+  ret void
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, emissionKind: FullDebug)
+!1 = !DIFile(filename: "work.c", directory: "/build/a")
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = !{i32 7, !"Dwarf Version", i32 4}
+!5 = !DISubroutineType(types: !{})
+!6 = distinct !DISubprogram(name: "work", scope: !1, file: !1, line: 1, type: !5, spFlags: DISPFlagDefinition, unit: !0)
+!9 = distinct !DISubprogram(name: "helper", scope: !1, file: !1, line: 5, type: !5, spFlags: DISPFlagLocalToUnit | DISPFlagDefinition, unit: !0)
+!10 = !DILocation(line: 2, scope: !6)
@@ -0,0 +1,53 @@
+; The probes of TAU, given the ids of the functions, whose names are in a
+; section registered by a constructor
+; RUN: %opt-tau -passes=tau-prof -tau-probe-backend=tau-ids \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: %opt-tau -passes='default<O2>' -tau-probe-backend=tau-ids \
+; RUN:   -tau-loop-probes=hoist -tau-input-file=%S/../Inputs/work-main.txt \
+; RUN:   -S %s | FileCheck %s --check-prefix=HOIST
+
+; CHECK: @work.tau_function = private constant { i64, i8*, i8*, i32, i32 } { i64 [[WORK:-?[0-9]+]], {{.*}} section "tau_functions"
+; CHECK: @main.tau_function = private constant { i64, i8*, i8*, i32, i32 } { i64 [[MAIN:-?[0-9]+]], {{.*}} section "tau_functions"
+; CHECK: @llvm.compiler.used = {{.*}} @work.tau_function {{.*}} @main.tau_function
+; CHECK: @llvm.global_ctors = {{.*}} @tau.register_ids
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: call void @Tau_start_id(i64 [[WORK]])
+; CHECK-NEXT: call void @Tau_stop_id(i64 [[WORK]])
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: call void @Tau_start_id(i64 [[MAIN]])
+; CHECK: out:
+; CHECK-NEXT: call void @Tau_stop_id(i64 [[MAIN]])
+
+; CHECK-LABEL: define internal void @tau.register_ids()
+; CHECK-NEXT: call void @Tau_register_ids(i8* @__start_tau_functions, i8* @__stop_tau_functions)
+
+; HOIST: @work.tau_function = {{.*}} { i64 [[WORK:-?[0-9]+]],
+; HOIST-LABEL: define i32 @main()
+; HOIST: call void @Tau_start_id(i64 [[WORK]])
+; HOIST: loop:
+; HOIST-NOT: call void
+; HOIST: out:
+; HOIST-NEXT: call void @Tau_loop_calls_id(i64 [[WORK]], i64 %{{.*}})
+; HOIST-NEXT: call void @Tau_stop_id(i64 [[WORK]])
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
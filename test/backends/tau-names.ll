@@ -0,0 +1,50 @@
+; The probes of TAU, given the function names
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/work-main.txt \
+; RUN:   -S %s | FileCheck %s
+; RUN: %opt-tau -passes='default<O2>' -tau-loop-probes=hoist \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=HOIST
+
+; Each name is stored once
+; CHECK: @tau.names = private unnamed_addr constant [10 x i8] c"main\00work\00"
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; CHECK-NEXT: call void @Tau_stop(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 0))
+; CHECK: out:
+; CHECK-NEXT: call void @Tau_stop(i8* getelementptr {{.*}} @tau.names, i64 0, i64 0))
+; CHECK-NEXT: ret i32 0
+
+; The probes of work, inlined in the loop, are taken out of it
+; HOIST-LABEL: define i32 @main()
+; HOIST: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 0))
+; HOIST-NEXT: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; HOIST: loop:
+; HOIST-NOT: call void
+; HOIST: out:
+; HOIST-NEXT: call void @Tau_loop_calls(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5), i64 %{{.*}})
+; HOIST-NEXT: call void @Tau_stop(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; HOIST-NEXT: call void @Tau_stop(i8* getelementptr {{.*}} @tau.names, i64 0, i64 0))
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
@@ -0,0 +1,64 @@
+; With -tau-enable-flag, the probes are only called while the flag is set:
+; the flag is loaded once on entry, and the returns reuse it so that the
+; probes stay balanced. The module gets a weak definition of the flag,
+; unless it defines it already
+; RUN: %opt-tau -passes=tau-prof -tau-enable-flag=tau_enabled \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: sed 's/^; GLOBAL: //' %s \
+; RUN:   | %opt-tau -passes=tau-prof -tau-enable-flag=tau_enabled \
+; RUN:     -tau-input-file=%S/../Inputs/work-main.txt -S \
+; RUN:   | FileCheck %s --check-prefix=DEFINED
+; The hoisted probes are guarded by the flag as it was entering the loop
+; RUN: %opt-tau -passes='default<O2>' -tau-loop-probes=hoist \
+; RUN:   -tau-enable-flag=tau_enabled \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=HOIST
+
+; CHECK: @tau_enabled = weak global i8 0
+; DEFINED: @tau_enabled = global i8 1
+; DEFINED-NOT: @tau_enabled =
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: [[FLAG:%.*]] = load atomic i8, i8* @tau_enabled monotonic, align 1
+; CHECK-NEXT: [[ON:%.*]] = icmp ne i8 [[FLAG]], 0
+; CHECK-NEXT: br i1 [[ON]], label %[[START:.*]], label %[[SKIP:.*]], !prof [[COLD:![0-9]+]]
+; CHECK: [[START]]:
+; CHECK-NEXT: call void @Tau_start(
+; CHECK-NEXT: br label %[[SKIP]]
+; CHECK: [[SKIP]]:
+; CHECK-NEXT: br i1 [[ON]], label %[[STOP:.*]], label %[[RET:.*]], !prof [[COLD]]
+; CHECK: [[STOP]]:
+; CHECK-NEXT: call void @Tau_stop(
+; CHECK: [[RET]]:
+; CHECK-NEXT: ret void
+
+; CHECK: [[COLD]] = !{!"branch_weights", i32 1, i32 1048576}
+
+; HOIST-LABEL: define i32 @main()
+; HOIST: load atomic i8, i8* @tau_enabled monotonic
+; HOIST: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; HOIST-NOT: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; HOIST: call void @Tau_loop_calls(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5), i64 {{.*}})
+; HOIST-NEXT: call void @Tau_stop(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+
+; The flag of the program, for DEFINED
+; GLOBAL: @tau_enabled = global i8 1
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
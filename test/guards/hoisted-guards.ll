@@ -0,0 +1,119 @@
+; The probes hoisted out of a loop are guarded as they were in it: by the
+; throttle flag of the function, and by its depth, the loop counting as one
+; activation of the function
+; RUN: %opt-tau -passes='default<O2>' -tau-loop-probes=hoist \
+; RUN:   -tau-throttle -tau-max-depth=1 \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; The globals of the program are not taken for the state of the guards,
+; whatever their names
+; RUN: %opt-tau -passes=tau-loop-probes -tau-loop-probes=hoist -tau-throttle \
+; RUN:   -pass-remarks-missed=tau-profile -S %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=PROGRAM
+; Dropped, the probes go with their guards, and nothing is counted. With
+; keep, the default, the pass leaves them alone, without a remark
+; RUN: %opt-tau -passes='default<O2>' -tau-loop-probes=drop \
+; RUN:   -tau-throttle -tau-max-depth=1 -pass-remarks=tau-profile \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=DROP
+; RUN: %opt-tau -passes=tau-loop-probes -pass-remarks=tau-profile \
+; RUN:   -pass-remarks-missed=tau-profile -S %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=KEEP
+
+; CHECK: @work.tau_disabled = private global i8 0, !tau.guard [[THROTTLE:![0-9]+]]
+; CHECK: @work.tau_depth = private thread_local {{.*}}global i32 0, !tau.guard [[DEPTH:![0-9]+]]
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: [[OLD:%.*]] = load i32, i32* @work.tau_depth
+; CHECK-NEXT: [[INC:%.*]] = add i32 [[OLD]], 1
+; CHECK-NEXT: store i32 [[INC]], i32* @work.tau_depth
+; CHECK-NEXT: [[OUTER:%.*]] = icmp eq i32 [[OLD]], 0
+; CHECK-NEXT: [[FLAG:%.*]] = load atomic i8, i8* @work.tau_disabled monotonic
+; CHECK-NEXT: [[RUNNING:%.*]] = icmp eq i8 [[FLAG]], 0
+; CHECK-NEXT: [[ON:%.*]] = and i1 [[OUTER]], [[RUNNING]]
+; CHECK-NEXT: br i1 [[ON]], label %[[START:.*]], label %loop.preheader
+; CHECK: [[START]]:
+; CHECK-NEXT: call void @Tau_start(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+; CHECK: loop:
+; CHECK-NOT: call void
+; CHECK-NOT: @work.tau_
+; CHECK: out:
+; CHECK-NEXT: store i32 [[OLD]], i32* @work.tau_depth
+; CHECK-NEXT: br i1 [[ON]], label %[[STOP:.*]], label
+; CHECK: [[STOP]]:
+; CHECK-NEXT: call void @Tau_loop_calls(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5), i64 {{.*}})
+; CHECK-NEXT: call void @Tau_stop(i8* getelementptr {{.*}} @tau.names, i64 0, i64 5))
+
+; CHECK-DAG: [[THROTTLE]] = !{!"throttle"}
+; CHECK-DAG: [[DEPTH]] = !{!"depth"}
+
+; PROGRAM: remark: <unknown>:0:0: probes of task kept in the loop: their guard is not understood
+; PROGRAM-LABEL: define void @program()
+; PROGRAM: loop:
+; PROGRAM-NEXT: %i = phi
+; PROGRAM-NEXT: %off = load i8, i8* @task.tau_disabled
+; PROGRAM: call void @Tau_start(
+; PROGRAM: call void @Tau_stop(
+
+; DROP: remark: <unknown>:0:0: probes of work dropped from the loop
+; DROP-LABEL: define i32 @main()
+; DROP-NOT: @work.tau_
+; DROP-NOT: @Tau_loop_calls
+; DROP-NOT: @tau.names, i64 0, i64 5)
+; DROP: ret i32 0
+
+; KEEP-NOT: remark
+; KEEP-LABEL: define void @program()
+; KEEP: loop:
+; KEEP: call void @Tau_start(
+; KEEP: call void @Tau_stop(
+; KEEP: next:
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
+
+; Probes guarded by a global of the program named as a throttle flag
+@task.tau_disabled = global i8 0
+@task.name = private constant [5 x i8] c"task\00"
+
+declare void @Tau_start(i8*)
+declare void @Tau_stop(i8*)
+
+define void @program() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %next ]
+  %off = load i8, i8* @task.tau_disabled
+  %running = icmp eq i8 %off, 0
+  br i1 %running, label %probes, label %next
+
+probes:
+  call void @Tau_start(i8* getelementptr ([5 x i8], [5 x i8]* @task.name, i64 0, i64 0))
+  call void @Tau_stop(i8* getelementptr ([5 x i8], [5 x i8]* @task.name, i64 0, i64 0))
+  br label %next
+
+next:
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret void
+}
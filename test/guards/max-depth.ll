@@ -0,0 +1,68 @@
+; With -tau-max-depth, each function counts its running activations in a
+; thread-local counter, incremented on entry and set back on every return:
+; only the outermost activations call the probes. The decision is not made
+; unlikely, unless another guard, such as the enable flag, makes it so
+; RUN: %opt-tau -passes=tau-prof -tau-max-depth=2 \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: %opt-tau -passes=tau-prof -tau-max-depth=1 -tau-enable-flag=tau_enabled \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=FLAG
+
+; CHECK: @work.tau_depth = private thread_local global i32 0, !tau.guard [[DEPTH:![0-9]+]]
+
+; CHECK-LABEL: define i32 @work(i32 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT: [[OLD:%.*]] = load i32, i32* @work.tau_depth
+; CHECK-NEXT: [[NEW:%.*]] = add i32 [[OLD]], 1
+; CHECK-NEXT: store i32 [[NEW]], i32* @work.tau_depth
+; CHECK-NEXT: [[OUTER:%.*]] = icmp ult i32 [[OLD]], 2
+; CHECK-NEXT: br i1 [[OUTER]], label %[[START:[0-9]+]], label %{{[0-9]+}}{{$}}
+; CHECK: [[START]]:
+; CHECK-NEXT: call void @Tau_start(
+; CHECK: base:
+; CHECK-NEXT: store i32 [[OLD]], i32* @work.tau_depth
+; CHECK-NEXT: br i1 [[OUTER]], label %[[STOP1:[0-9]+]], label %{{[0-9]+}}{{$}}
+; CHECK: [[STOP1]]:
+; CHECK-NEXT: call void @Tau_stop(
+; CHECK: rec:
+; CHECK: call i32 @work(
+; CHECK: store i32 [[OLD]], i32* @work.tau_depth
+; CHECK-NEXT: br i1 [[OUTER]], label %[[STOP2:[0-9]+]], label %{{[0-9]+}}{{$}}
+; CHECK: [[STOP2]]:
+; CHECK-NEXT: call void @Tau_stop(
+
+; CHECK: [[DEPTH]] = !{!"depth"}
+
+; FLAG-LABEL: define i32 @work(i32 %n)
+; FLAG: [[FLAG:%.*]] = load atomic i8, i8* @tau_enabled monotonic
+; FLAG-NEXT: [[ON:%.*]] = icmp ne i8 [[FLAG]], 0
+; FLAG-NEXT: [[OLD:%.*]] = load i32, i32* @work.tau_depth
+; FLAG: [[OUTER:%.*]] = icmp ult i32 [[OLD]], 1
+; FLAG-NEXT: [[BOTH:%.*]] = and i1 [[ON]], [[OUTER]]
+; FLAG-NEXT: br i1 [[BOTH]], {{.*}}, !prof [[COLD:![0-9]+]]
+; FLAG: call void @Tau_start(
+; FLAG: store i32 [[OLD]], i32* @work.tau_depth
+; FLAG-NEXT: br i1 [[BOTH]], {{.*}}, !prof [[COLD]]
+; FLAG: call void @Tau_stop(
+
+; FLAG: [[COLD]] = !{!"branch_weights", i32 1, i32 1048576}
+
+define i32 @work(i32 %n) {
+entry:
+  %c = icmp eq i32 %n, 0
+  br i1 %c, label %base, label %rec
+
+base:
+  ret i32 0
+
+rec:
+  %m = sub i32 %n, 1
+  %r = call i32 @work(i32 %m)
+  %s = add i32 %r, 1
+  ret i32 %s
+}
+
+define i32 @main() {
+  %r = call i32 @work(i32 10)
+  ret i32 %r
+}
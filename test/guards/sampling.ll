@@ -0,0 +1,80 @@
+; With -tau-sample-period, each function counts its calls down in a
+; thread-local counter, and only starts its timer when it wraps around: the
+; sampled start is given the calls the sample stands for, 1 for the first
+; call, then the period. The backends whose calls cannot be sampled report
+; the option as an error, from the module pass as from the function pass
+; RUN: %opt-tau -passes=tau-prof -tau-sample-period=64 \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: %opt-tau -passes=tau-prof -tau-sample-period=64 \
+; RUN:   -tau-probe-backend=tau-handles -tau-probe-handles=ctor \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=HANDLES
+; RUN: not %opt-tau -passes=tau-prof -tau-sample-period=64 \
+; RUN:   -tau-probe-backend=tau-ids \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+; RUN: not %opt-tau -passes=tau-prof -tau-sample-period=64 \
+; RUN:   -tau-probe-backend=rtlib \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+; RUN: not %opt-tau -passes=tau-prof -tau-sample-period=64 \
+; RUN:   -tau-probe-backend=inline-counters \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+; RUN: not %opt-tau -passes='function(tau-prof)' -tau-sample-period=64 \
+; RUN:   -tau-probe-backend=tau-ids \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+
+; CHECK: @work.tau_countdown = private thread_local global i32 0, !tau.guard [[COUNTDOWN:![0-9]+]]
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: [[COUNT:%.*]] = load i32, i32* @work.tau_countdown
+; CHECK-NEXT: [[SAMPLED:%.*]] = icmp ult i32 [[COUNT]], 2
+; CHECK-NEXT: [[NEXT:%.*]] = add i32 [[COUNT]], -1
+; CHECK-NEXT: [[RESET:%.*]] = select i1 [[SAMPLED]], i32 64, i32 [[NEXT]]
+; CHECK-NEXT: store i32 [[RESET]], i32* @work.tau_countdown
+; CHECK-NEXT: br i1 [[SAMPLED]], label %[[START:.*]], label %[[SKIP:.*]], !prof [[COLD:![0-9]+]]
+; CHECK: [[START]]:
+; CHECK-NEXT: [[FIRST:%.*]] = icmp eq i32 [[COUNT]], 0
+; CHECK-NEXT: [[WEIGHT:%.*]] = select i1 [[FIRST]], i32 1, i32 64
+; CHECK-NEXT: call void @Tau_start_sampled(i8* {{.*}}, i32 [[WEIGHT]])
+; CHECK-NEXT: br label %[[SKIP]]
+; CHECK: [[SKIP]]:
+; CHECK-NEXT: br i1 [[SAMPLED]], label %[[STOP:.*]], label %[[RET:.*]], !prof [[COLD]]
+; CHECK: [[STOP]]:
+; CHECK-NEXT: call void @Tau_stop(
+; CHECK: [[RET]]:
+; CHECK-NEXT: ret void
+
+; CHECK: declare void @Tau_start_sampled(i8*, i32)
+; CHECK-NOT: declare void @Tau_start(
+
+; CHECK: [[COUNTDOWN]] = !{!"countdown"}
+; CHECK: [[COLD]] = !{!"branch_weights", i32 1, i32 1048576}
+
+; HANDLES-LABEL: define void @work()
+; HANDLES: [[WEIGHT:%.*]] = select i1 {{.*}}, i32 1, i32 64
+; HANDLES: call void @Tau_start_handle_sampled(i8* {{.*}}, i32 [[WEIGHT]])
+; HANDLES: call void @Tau_stop_handle(
+
+; ERROR: error: -tau-sample-period needs the sampled start probes of -tau-probe-backend=tau-names or tau-handles
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
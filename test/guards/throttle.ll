@@ -0,0 +1,45 @@
+; With -tau-throttle, the probes are skipped once the runtime sets the flag
+; of their function, registered per module: the function pass alone cannot
+; register them, and reports it
+; RUN: %opt-tau -passes=tau-prof -tau-throttle \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+; RUN: not %opt-tau -passes='function(tau-prof)' -tau-throttle \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=FUNCTION
+
+; CHECK: @work.tau_disabled = private global i8 0
+; CHECK: @tau.throttle = private constant [2 x { i8*, i8* }] [{ i8*, i8* } { i8* @work.tau_disabled, {{.*}} }, { i8*, i8* } { i8* @main.tau_disabled, {{.*}} }]
+; CHECK: @llvm.global_ctors = {{.*}} @tau.register_throttle
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: [[FLAG:%.*]] = load atomic i8, i8* @work.tau_disabled monotonic
+; CHECK-NEXT: [[ON:%.*]] = icmp eq i8 [[FLAG]], 0
+; CHECK-NEXT: br i1 [[ON]], label %[[START:.*]], label %[[SKIP:.*]]
+; CHECK: [[START]]:
+; CHECK-NEXT: call void @Tau_start(
+; CHECK: br i1 [[ON]]
+; CHECK: call void @Tau_stop(
+
+; CHECK-LABEL: define internal void @tau.register_throttle()
+; CHECK-NEXT: call void @Tau_register_throttle(i8* bitcast ({{.*}} @tau.throttle to i8*), i64 2)
+
+; FUNCTION: error: -tau-throttle needs the module pass
+
+define void @work() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
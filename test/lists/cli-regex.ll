@@ -0,0 +1,24 @@
+; -tau-regex and -tau-iregex only include functions: the exclude list of
+; the input file still applies to the functions they match
+; RUN: %opt-tau -passes=tau-prof -tau-regex='^apply' \
+; RUN:   -tau-input-file=%S/../Inputs/exclude-apply-skip.txt -S %s | FileCheck %s
+; RUN: %opt-tau -passes=tau-prof -tau-iregex='^APPLY' \
+; RUN:   -tau-input-file=%S/../Inputs/exclude-apply-skip.txt -S %s | FileCheck %s
+
+; CHECK-LABEL: define void @applyQ()
+; CHECK-NEXT: call void @Tau_start
+define void @applyQ() {
+  ret void
+}
+
+; CHECK-LABEL: define void @applySkip()
+; CHECK-NEXT: ret void
+define void @applySkip() {
+  ret void
+}
+
+; CHECK-LABEL: define void @other()
+; CHECK-NEXT: ret void
+define void @other() {
+  ret void
+}
@@ -0,0 +1,29 @@
+; Only the functions of the include list are timed
+; RUN: %opt-tau -enable-new-pm=0 -legacy-tau-prof \
+; RUN:   -tau-input-file=%S/../Inputs/work-main.txt -S %s | FileCheck %s
+
+; CHECK-LABEL: define void @work()
+; CHECK-NEXT: call void @Tau_start(
+; CHECK-NEXT: call void @Tau_stop(
+; CHECK-NEXT: ret void
+define void @work() {
+  ret void
+}
+
+; CHECK-LABEL: define void @helper()
+; CHECK-NEXT: ret void
+define void @helper() {
+  ret void
+}
+
+; CHECK-LABEL: define i32 @main()
+; CHECK-NEXT: call void @Tau_start(
+; CHECK-NEXT: call void @work()
+; CHECK-NEXT: call void @helper()
+; CHECK-NEXT: call void @Tau_stop(
+; CHECK-NEXT: ret i32 0
+define i32 @main() {
+  call void @work()
+  call void @helper()
+  ret i32 0
+}
@@ -0,0 +1,61 @@
+; The list compiled once into the cache, then mapped from it: its exact
+; names (in the on-disk name table), wildcards and files are the same
+; RUN: rm -rf %t && mkdir %t
+; RUN: %opt-tau-cxx -passes=tau-prof -tau-mangled-lookup -tau-verbose \
+; RUN:   -tau-list-cache-dir=%t -tau-input-file=%S/../Inputs/cached.txt \
+; RUN:   -S %s 2>%t.first | FileCheck %s
+; RUN: ls %t | count 1
+; RUN: %opt-tau-cxx -passes=tau-prof -tau-mangled-lookup -tau-verbose \
+; RUN:   -tau-list-cache-dir=%t -tau-input-file=%S/../Inputs/cached.txt \
+; RUN:   -S %s 2>%t.second | FileCheck %s
+; RUN: FileCheck %s --check-prefix=FIRST --input-file=%t.first
+; RUN: FileCheck %s --check-prefix=SECOND --input-file=%t.second
+
+; FIRST: functions were loaded from file
+; SECOND-NOT: loaded from file
+; SECOND: functions were loaded from {{.*}}tau-list-v{{.*}}.bin
+; SECOND: applySkip(): skip (exact-exclude, mangled name)
+
+source_filename = "cached.cpp"
+
+; ns::A::foo(int, ns::A const*)
+; CHECK-LABEL: define void @_ZN2ns1A3fooEiPKS0_()
+; CHECK-NEXT: call void @Tau_start
+define void @_ZN2ns1A3fooEiPKS0_() {
+  ret void
+}
+
+; baz()
+; CHECK-LABEL: define void @_Z3bazv()
+; CHECK-NEXT: call void @Tau_start
+define void @_Z3bazv() {
+  ret void
+}
+
+; baz(int)
+; CHECK-LABEL: define void @_Z3bazi()
+; CHECK-NEXT: ret void
+define void @_Z3bazi() {
+  ret void
+}
+
+; applyQ()
+; CHECK-LABEL: define void @_Z6applyQv()
+; CHECK-NEXT: call void @Tau_start
+define void @_Z6applyQv() {
+  ret void
+}
+
+; applySkip()
+; CHECK-LABEL: define void @_Z9applySkipv()
+; CHECK-NEXT: ret void
+define void @_Z9applySkipv() {
+  ret void
+}
+
+; other()
+; CHECK-LABEL: define void @_Z5otherv()
+; CHECK-NEXT: ret void
+define void @_Z5otherv() {
+  ret void
+}
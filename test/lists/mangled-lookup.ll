@@ -0,0 +1,42 @@
+; The exact C++ entries, found by their mangled names with
+; -tau-mangled-lookup, or by demangling the functions without it and for
+; the entries that cannot be mangled back (templates)
+; RUN: %opt-tau-cxx -passes=tau-prof -tau-mangled-lookup \
+; RUN:   -tau-input-file=%S/../Inputs/prototypes.txt -S %s | FileCheck %s
+; RUN: %opt-tau-cxx -passes=tau-prof \
+; RUN:   -tau-input-file=%S/../Inputs/prototypes.txt -S %s | FileCheck %s
+
+; ns::A::foo(int, ns::A const*)
+; CHECK-LABEL: define void @_ZN2ns1A3fooEiPKS0_()
+; CHECK-NEXT: call void @Tau_start
+define void @_ZN2ns1A3fooEiPKS0_() {
+  ret void
+}
+
+; ns::A::bar(ns::A const&) const
+; CHECK-LABEL: define void @_ZNK2ns1A3barERKS0_()
+; CHECK-NEXT: call void @Tau_start
+define void @_ZNK2ns1A3barERKS0_() {
+  ret void
+}
+
+; void householder<double>(int, double**)
+; CHECK-LABEL: define void @_Z11householderIdEviPPT_()
+; CHECK-NEXT: call void @Tau_start
+define void @_Z11householderIdEviPPT_() {
+  ret void
+}
+
+; baz()
+; CHECK-LABEL: define void @_Z3bazv()
+; CHECK-NEXT: call void @Tau_start
+define void @_Z3bazv() {
+  ret void
+}
+
+; baz(int)
+; CHECK-LABEL: define void @_Z3bazi()
+; CHECK-NEXT: ret void
+define void @_Z3bazi() {
+  ret void
+}
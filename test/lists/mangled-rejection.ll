@@ -0,0 +1,39 @@
+; With exact entries only, -tau-mangled-lookup rejects the functions whose
+; mangled names are not listed without demangling them, but never the
+; functions with local linkage, whose mangled names the entries do not give
+; RUN: %opt-tau-cxx -passes=tau-prof -tau-mangled-lookup -tau-verbose \
+; RUN:   -tau-input-file=%S/../Inputs/exact-prototypes.txt -S %s 2>%t.log \
+; RUN:   | FileCheck %s
+; RUN: FileCheck %s --check-prefix=DECISIONS --input-file=%t.log
+; RUN: %opt-tau-cxx -passes=tau-prof \
+; RUN:   -tau-input-file=%S/../Inputs/exact-prototypes.txt -S %s | FileCheck %s
+
+; DECISIONS-DAG: bar(int): instrument (exact-include)
+; DECISIONS-DAG: foo(int): instrument (exact-include)
+; DECISIONS-DAG: bar(): skip (not-listed, mangled name)
+
+; bar(int)
+; CHECK-LABEL: define void @_Z3bari()
+; CHECK-NEXT: call void @Tau_start
+define void @_Z3bari() {
+  ret void
+}
+
+; static foo(int)
+; CHECK-LABEL: define internal void @_ZL3fooi()
+; CHECK-NEXT: call void @Tau_start
+define internal void @_ZL3fooi() {
+  ret void
+}
+
+; bar(), not listed
+; CHECK-LABEL: define void @_Z3barv()
+; CHECK-NEXT: ret void
+define void @_Z3barv() {
+  ret void
+}
+
+define void @use() {
+  call void @_ZL3fooi()
+  ret void
+}
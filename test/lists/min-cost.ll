@@ -0,0 +1,73 @@
+; -tau-min-cost skips the functions selected by a wildcard whose static cost
+; is below the minimum: one per instruction, -tau-call-cost per call and
+; -tau-loop-cost per loop. Functions listed by their exact name are always
+; instrumented
+; RUN: %opt-tau -passes=tau-prof -tau-min-cost=30 \
+; RUN:   -tau-input-file=%S/../Inputs/min-cost.txt -pass-remarks=tau-profile \
+; RUN:   -pass-remarks-missed=tau-profile -S %s 2>&1 | FileCheck %s
+; RUN: %opt-tau -passes=tau-prof -tau-min-cost=60 \
+; RUN:   -tau-input-file=%S/../Inputs/min-cost.txt -pass-remarks=tau-profile \
+; RUN:   -pass-remarks-missed=tau-profile -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=CALLS
+; RUN: %opt-tau -passes=tau-prof -tau-min-cost=30 -tau-call-cost=0 \
+; RUN:   -tau-loop-cost=0 -tau-input-file=%S/../Inputs/min-cost.txt \
+; RUN:   -pass-remarks=tau-profile -pass-remarks-missed=tau-profile \
+; RUN:   -disable-output %s 2>&1 | FileCheck %s --check-prefix=BODY
+
+; CHECK: remark: <unknown>:0:0: tiny instrumented (exact-include)
+; CHECK-NEXT: remark: <unknown>:0:0: small not instrumented (min-cost: static cost 1 below 30)
+; CHECK-NEXT: remark: <unknown>:0:0: caller instrumented (wildcard-include)
+; CHECK-NEXT: remark: <unknown>:0:0: looper instrumented (wildcard-include)
+
+; CALLS: remark: <unknown>:0:0: tiny instrumented (exact-include)
+; CALLS-NEXT: remark: <unknown>:0:0: small not instrumented (min-cost: static cost 1 below 60)
+; CALLS-NEXT: remark: <unknown>:0:0: caller not instrumented (min-cost: static cost 53 below 60)
+; CALLS-NEXT: remark: <unknown>:0:0: looper instrumented (wildcard-include)
+
+; BODY: remark: <unknown>:0:0: tiny instrumented (exact-include)
+; BODY-NEXT: remark: <unknown>:0:0: small not instrumented (min-cost: static cost 1 below 30)
+; BODY-NEXT: remark: <unknown>:0:0: caller not instrumented (min-cost: static cost 3 below 30)
+; BODY-NEXT: remark: <unknown>:0:0: looper not instrumented (min-cost: static cost 6 below 30)
+
+; CHECK-LABEL: define void @tiny()
+; CHECK-NEXT: call void @Tau_start(
+; CHECK-NEXT: call void @Tau_stop(
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define void @small()
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define void @caller()
+; CHECK-NEXT: call void @Tau_start(
+
+; CHECK-LABEL: define void @looper(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @Tau_start(
+
+define void @tiny() {
+  ret void
+}
+
+define void @small() {
+  ret void
+}
+
+define void @caller() {
+  call void @tiny()
+  call void @small()
+  ret void
+}
+
+define void @looper(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %next = add i32 %i, 1
+  %c = icmp ult i32 %next, %n
+  br i1 %c, label %loop, label %out
+
+out:
+  ret void
+}
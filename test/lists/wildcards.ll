@@ -0,0 +1,78 @@
+; The # wildcards of the function lists, matched together, and the * and ?
+; globs of the file lists
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/wildcards.txt \
+; RUN:   -S %s | FileCheck %s
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/file-globs.txt \
+; RUN:   -S %s | FileCheck %s --check-prefix=EXCLUDED
+; RUN: sed 's/"foo1.c"/"foo12.c"/' %s \
+; RUN:   | %opt-tau -passes=tau-prof \
+; RUN:     -tau-input-file=%S/../Inputs/file-globs.txt -S \
+; RUN:   | FileCheck %s --check-prefix=INCLUDED
+; ? matches at most one character, and . only itself
+; RUN: sed 's/"foo1.c"/"foo.c"/' %s \
+; RUN:   | %opt-tau -passes=tau-prof \
+; RUN:     -tau-input-file=%S/../Inputs/file-globs.txt -S \
+; RUN:   | FileCheck %s --check-prefix=EXCLUDED
+; RUN: sed 's/"foo1.c"/"bar_c"/' %s \
+; RUN:   | %opt-tau -passes=tau-prof \
+; RUN:     -tau-input-file=%S/../Inputs/file-globs.txt -S \
+; RUN:   | FileCheck %s --check-prefix=EXCLUDED
+
+; EXCLUDED-NOT: call void @Tau_start
+; INCLUDED-COUNT-9: call void @Tau_start
+
+source_filename = "foo1.c"
+
+; CHECK-LABEL: define void @applyQ()
+; CHECK-NEXT: call void @Tau_start
+define void @applyQ() {
+  ret void
+}
+
+; CHECK-LABEL: define void @applyR()
+; CHECK-NEXT: call void @Tau_start
+define void @applyR() {
+  ret void
+}
+
+; CHECK-LABEL: define void @apply_skip_me()
+; CHECK-NEXT: ret void
+define void @apply_skip_me() {
+  ret void
+}
+
+; CHECK-LABEL: define void @mm_kernel()
+; CHECK-NEXT: call void @Tau_start
+define void @mm_kernel() {
+  ret void
+}
+
+; CHECK-LABEL: define void @mm_kernel2()
+; CHECK-NEXT: ret void
+define void @mm_kernel2() {
+  ret void
+}
+
+; CHECK-LABEL: define void @axxbyyc()
+; CHECK-NEXT: call void @Tau_start
+define void @axxbyyc() {
+  ret void
+}
+
+; CHECK-LABEL: define void @abc()
+; CHECK-NEXT: call void @Tau_start
+define void @abc() {
+  ret void
+}
+
+; CHECK-LABEL: define void @acb()
+; CHECK-NEXT: ret void
+define void @acb() {
+  ret void
+}
+
+; CHECK-LABEL: define void @other()
+; CHECK-NEXT: ret void
+define void @other() {
+  ret void
+}
@@ -0,0 +1,34 @@
+# Configuration of the tests, run from the build tree (see CMakeLists.txt)
+
+import os
+
+import lit.formats
+
+config.name = "TAU Profiling"
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = [".ll", ".test"]
+config.excludes = ["Inputs"]
+config.test_source_root = os.path.dirname(__file__)
+config.test_exec_root = config.tau_test_dir
+
+config.environment["PATH"] = os.pathsep.join(
+    [config.llvm_tools_dir, config.tau_bin_dir,
+     config.environment.get("PATH", "")])
+
+
+def plugin(name):
+    return os.path.join(config.tau_lib_dir, name + config.plugin_suffix)
+
+
+# opt with the plugin for C, or for C++ (which demangles the names)
+for substitution, name in (("%opt-tau-cxx", "TAU_Profiling_CXX"),
+                           ("%opt-tau", "TAU_Profiling")):
+    config.substitutions.append(
+        (substitution, "opt -load=%s -load-pass-plugin=%s"
+         % (plugin(name), plugin(name))))
+
+# Linking a program with the runtime: %cc <objects> %tau-runtime
+config.substitutions.append(("%cc", config.cc))
+config.substitutions.append(
+    ("%tau-runtime", "-pthread -L%s -lTAU_Runtime -Wl,-rpath,%s"
+     % (config.tau_lib_dir, config.tau_lib_dir)))
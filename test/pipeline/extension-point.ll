@@ -0,0 +1,78 @@
+; -tau-extension-point chooses where the standard pipelines instrument the
+; module. At the start of the pipeline, the probes of api are inlined into
+; the loop of main at O2. After inlining, only the functions still called
+; are instrumented: the loop is left without probes, and the module still
+; gets the tables and constructors of the module pass
+; RUN: %opt-tau -passes='default<O2>' -tau-extension-point=pipeline-start \
+; RUN:   -tau-input-file=%S/../Inputs/all.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=START
+; RUN: %opt-tau -passes='default<O2>' -tau-extension-point=after-inlining \
+; RUN:   -tau-input-file=%S/../Inputs/all.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=INLINED
+; RUN: %opt-tau -passes='default<O2>' -tau-extension-point=after-inlining \
+; RUN:   -tau-probe-backend=inline-counters -tau-throttle \
+; RUN:   -tau-input-file=%S/../Inputs/all.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=MODULE
+; RUN: %opt-tau -passes='default<O2>' -tau-extension-point=none \
+; RUN:   -tau-input-file=%S/../Inputs/all.txt -S %s \
+; RUN:   | FileCheck %s --check-prefix=NONE
+
+; START-LABEL: define i32 @main()
+; START: loop:
+; START: call void @Tau_start(
+; START: out:
+
+; work was inlined everywhere, and deleted, before being instrumented
+; INLINED: @tau.names = private unnamed_addr constant [9 x i8] c"main\00api\00"
+; INLINED-LABEL: define void @api(
+; INLINED-NEXT: call void @Tau_start(
+; INLINED-LABEL: define i32 @main()
+; INLINED-NEXT: entry:
+; INLINED-NEXT: call void @Tau_start(
+; INLINED: loop:
+; INLINED-NOT: call void
+; INLINED: out:
+; INLINED-NEXT: call void @Tau_stop(
+; INLINED-NEXT: ret i32 0
+
+; MODULE: @tau.inline_counters = private thread_local global [2 x { i64, i64, i64 }] zeroinitializer
+; MODULE: @tau.inline_names = private constant [2 x i8*]
+; MODULE: @tau.throttle = private constant [2 x { i8*, i8* }]
+; MODULE: @llvm.global_ctors = {{.*}} @tau.register_throttle
+; MODULE-LABEL: define i32 @main()
+; MODULE: loop:
+; MODULE-NOT: call void
+; MODULE: out:
+; MODULE-LABEL: define internal void @tau.register_inline()
+; MODULE-NEXT: store i8 1, i8* @tau.inline_registered
+; MODULE-NEXT: call void @Tau_inline_register({{.*}}, i64 2)
+; MODULE-LABEL: define internal void @tau.register_throttle()
+
+; NONE-NOT: call void @Tau_
+
+@sink = global i32 0
+
+define internal void @work(i32 %i) {
+  store volatile i32 %i, i32* @sink
+  ret void
+}
+
+define void @api(i32 %i) {
+  call void @work(i32 %i)
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @api(i32 %i)
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i32 0
+}
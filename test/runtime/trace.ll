@@ -0,0 +1,76 @@
+; The profiles and the trace of the built-in runtime, for two threads, read
+; back by tau-convert
+; RUN: rm -rf %t && mkdir %t
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/all.txt %s \
+; RUN:   | llc -filetype=obj -relocation-model=pic -o %t/trace.o
+; RUN: %cc %t/trace.o %tau-runtime -o %t/trace
+; RUN: cd %t && env TAU_TRACE=1 ./trace
+; RUN: tau-convert %t/tautrace.bin | FileCheck %s
+; RUN: tau-convert %t/profile.0.0.0 %t/profile.0.0.1 | FileCheck %s
+; RUN: tau-convert -format=callpath %t/tautrace.bin \
+; RUN:   | FileCheck %s --check-prefix=CALLPATH
+; The profiles written from the trace, with the call paths, read back
+; RUN: tau-convert -format=profile -callpaths -o %t/converted %t/tautrace.bin
+; RUN: tau-convert %t/converted | FileCheck %s
+; RUN: tau-convert -format=callpath %t/converted \
+; RUN:   | FileCheck %s --check-prefix=CALLPATH
+; RUN: FileCheck %s --check-prefix=PROFILE < %t/converted/profile.0.0.0
+; RUN: tau-convert -format=chrome %t/tautrace.bin | grep -c '"ph":"B"' \
+; RUN:   | FileCheck %s --check-prefix=EVENTS
+; RUN: tau-convert -format=chrome %t/tautrace.bin | grep -c '"ph":"E"' \
+; RUN:   | FileCheck %s --check-prefix=EVENTS
+
+; The calls and the calls they make
+; CHECK: sum of 2 threads:
+; CHECK-DAG: {{ 2 +2 +[0-9.]+ +}}.TAU application{{$}}
+; CHECK-DAG: {{ 1 +1 +[0-9.]+ +}}main{{$}}
+; CHECK-DAG: {{ 2 +2000 +[0-9.]+ +}}body{{$}}
+; CHECK-DAG: {{ 2000 +4000 +[0-9.]+ +}}work{{$}}
+; CHECK-DAG: {{ 4000 +0 +[0-9.]+ +}}inner{{$}}
+
+; CALLPATH-DAG: {{ 1000 +2000 +[0-9.]+ +}}.TAU application => body => work{{$}}
+; CALLPATH-DAG: {{ 1000 +2000 +[0-9.]+ +}}.TAU application => main => body => work{{$}}
+
+; PROFILE: 9 templated_functions_MULTI_TIME
+; PROFILE: ".TAU application" 1 1 {{.*}} GROUP="TAU_DEFAULT"
+; PROFILE: "work" 1000 2000 {{.*}} GROUP="TAU_USER"
+; PROFILE: ".TAU application => main => body => work" 1000 2000 {{.*}} GROUP="TAU_CALLPATH"
+
+; EVENTS: 6005
+
+declare i32 @pthread_create(i64*, i8*, i8* (i8*)*, i8*)
+declare i32 @pthread_join(i64, i8**)
+
+define void @inner() noinline {
+  ret void
+}
+
+define void @work() noinline {
+  call void @inner()
+  call void @inner()
+  ret void
+}
+
+define i8* @body(i8* %arg) noinline {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  call void @work()
+  %n = add i32 %i, 1
+  %c = icmp ult i32 %n, 1000
+  br i1 %c, label %loop, label %out
+
+out:
+  ret i8* null
+}
+
+define i32 @main() {
+  %thread = alloca i64
+  call i32 @pthread_create(i64* %thread, i8* null, i8* (i8*)* @body, i8* null)
+  %id = load i64, i64* %thread
+  call i32 @pthread_join(i64 %id, i8** null)
+  call i8* @body(i8* null)
+  ret i32 0
+}
@@ -0,0 +1,90 @@
+; The decisions are saved as remarks of tau-profile, merged by tau-decisions
+; over the units: here the same module compiled with two input files
+; RUN: rm -rf %t && mkdir %t
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/all.txt \
+; RUN:   -tau-min-cost=30 -pass-remarks-output=%t/a.opt.yaml -disable-output %s
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/work-helper.txt \
+; RUN:   -pass-remarks-output=%t/b.opt.yaml -disable-output %s
+; RUN: FileCheck %s --check-prefix=RECORD < %t/a.opt.yaml
+; RUN: tau-decisions %t | FileCheck %s
+; RUN: tau-decisions -list -all %t | FileCheck %s --check-prefix=LIST
+; RUN: tau-decisions -json %t/a.opt.yaml | FileCheck %s --check-prefix=JSON
+; -tau-dry-run prints the decisions taken for the functions listed, and
+; -tau-verbose for all of them
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/work-helper.txt \
+; RUN:   -tau-dry-run -disable-output %s 2>&1 | FileCheck %s --check-prefix=DRY
+; RUN: %opt-tau -passes=tau-prof -tau-input-file=%S/../Inputs/work-helper.txt \
+; RUN:   -tau-verbose -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefixes=DRY,VERBOSE
+
+; RECORD: --- !Missed
+; RECORD-NEXT: Pass: tau-profile
+; RECORD-NEXT: Name: NotInstrumented
+; RECORD-NEXT: Function: helper
+; RECORD-NEXT: Args:
+; RECORD-NEXT: - Name: helper
+; RECORD-NEXT: - String: ' not instrumented'
+; RECORD-NEXT: - String: ' ('
+; RECORD-NEXT: - Rule: min-cost
+; RECORD-NEXT: - String: ': '
+; RECORD-NEXT: - Reason: static cost 1 below 30
+; RECORD-NEXT: - String: ')'
+; RECORD-NEXT: - Mangled: helper
+; RECORD-NEXT: - File: {{.*}}tau-decisions.ll
+
+; The function selected in a single unit is not counted without -all
+; CHECK: 3 functions in 2 remark files
+; CHECK-NEXT: instrumented: 2
+; CHECK-NEXT: not instrumented: 0
+; CHECK-NEXT: in some units only: 1
+; CHECK-NEXT: records by rule:
+; CHECK-NEXT: exact-include: 2
+; CHECK-NEXT: min-cost: 1
+; CHECK-NEXT: wildcard-include: 2
+; CHECK-NEXT: functions instrumented in some units only:
+; CHECK-NEXT: helper ({{.*}}tau-decisions.ll): 1 of 2
+; CHECK-NOT: decisions:
+
+; LIST: in some units only: 2
+; LIST: not-listed: 1
+; LIST: decisions:
+; LIST-NEXT: instrument helper ({{.*}}) [exact-include x1] [min-cost: static cost 1 below 30 x1]
+; LIST-NEXT: instrument main ({{.*}}) [not-listed x1] [wildcard-include x1]
+; LIST-NEXT: instrument work ({{.*}}) [exact-include x1] [wildcard-include x1]
+
+; JSON: "mangled": "helper",
+; JSON-NEXT: "name": "helper",
+; JSON-NEXT: "file": "{{.*}}tau-decisions.ll",
+; JSON-NEXT: "instrumented": 0,
+; JSON-NEXT: "skipped": 1,
+; JSON-NEXT: "rules": {
+; JSON-NEXT: "min-cost: static cost 1 below 30": 1
+
+; DRY: tau-decisions.ll: work: instrument (exact-include)
+; DRY-NEXT: tau-decisions.ll: helper: instrument (exact-include)
+; VERBOSE-NEXT: tau-decisions.ll: main: skip (not-listed)
+; DRY-NOT: main
+
+define void @work(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %next = add i32 %i, 1
+  %c = icmp ult i32 %next, %n
+  br i1 %c, label %loop, label %out
+
+out:
+  ret void
+}
+
+define void @helper() {
+  ret void
+}
+
+define i32 @main() {
+  call void @work(i32 10)
+  call void @helper()
+  ret i32 0
+}
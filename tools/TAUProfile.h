@@ -0,0 +1,126 @@
+//===- TAUProfile.h - Reading the profiles of a run -------------*- C++ -*-===//
+//
+// The profile.* files written by TAU, or by any runtime writing the same
+// format, one per thread, as read by the tools.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TAU_PROFILE_H
+#define TAU_PROFILE_H
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+/* A timer of a profile, with its times in microseconds */
+struct ProfileTimer {
+  llvm::StringRef name;
+  llvm::StringRef group;
+  double calls;
+  double subrs;
+  double exclusive;
+  double inclusive;
+
+  /// Whether this is the timer of a function, rather than that of a call
+  /// path or that of the whole thread (`.TAU application`).
+  bool isFunction() const {
+    return !group.contains("TAU_CALLPATH") && !group.contains("TAU_DEFAULT") &&
+           !name.contains(" => ");
+  }
+};
+
+/*!
+ * Read the profile file at \p path, passing each timer to \p timer. Layout:
+ *
+ *   <n> templated_functions_MULTI_TIME
+ *   # Name Calls Subrs Excl Incl ProfileCalls #[<metadata>...]
+ *   "<name>" <calls> <subrs> <excl> <incl> <profcalls> GROUP="<group>"
+ *   ... (n lines), then the aggregates and the user events, not used here
+ *
+ * The names of the call paths are those of their functions, separated by
+ * " => ". The timers only refer to the file while \p timer runs. Returns
+ * the error, empty if none.
+ */
+inline std::string
+readProfile(llvm::StringRef path,
+            llvm::function_ref<void(const ProfileTimer &)> timer) {
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+    return "cannot read " + path.str() + ": " + buffer.getError().message();
+
+  llvm::StringRef rest = (*buffer)->getBuffer();
+  llvm::StringRef header;
+  std::tie(header, rest) = rest.split('\n');
+  unsigned count;
+  if (header.trim().split(' ').first.getAsInteger(10, count))
+    return path.str() + " is not a TAU profile";
+  rest = rest.split('\n').second; // column names
+
+  for (unsigned i = 0; i < count; ++i) {
+    llvm::StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+
+    // The name is quoted, but may itself contain quotes
+    size_t group = line.rfind(" GROUP=\"");
+    llvm::StringRef fields = line.take_front(group);
+    size_t close = fields.rfind('"');
+    llvm::SmallVector<llvm::StringRef, 5> values;
+    if (line.startswith("\"") && close != 0 && close != llvm::StringRef::npos)
+      fields.drop_front(close + 1).split(values, ' ', -1,
+                                         /*KeepEmpty=*/false);
+    double numbers[4];
+    bool valid = values.size() >= 4;
+    for (unsigned v = 0; valid && v < 4; ++v)
+      valid = !values[v].getAsDouble(numbers[v]);
+    if (!valid)
+      return path.str() + ": malformed line: " + line.str();
+
+    ProfileTimer entry;
+    entry.name = fields.slice(1, close);
+    if (group != llvm::StringRef::npos)
+      entry.group = line.drop_front(group + 8).split('"').first;
+    entry.calls = numbers[0];
+    entry.subrs = numbers[1];
+    entry.exclusive = numbers[2];
+    entry.inclusive = numbers[3];
+    timer(entry);
+  }
+  return "";
+}
+
+/*!
+ * Append the profile.* files of the directory \p input to \p files, in
+ * order, or those of its MULTI__TIME subdirectory when TAU measured several
+ * metrics. \p dir is set to the directory searched. Returns whether any was
+ * found.
+ */
+inline bool findProfiles(llvm::StringRef input,
+                         std::vector<std::string> &files,
+                         llvm::SmallVectorImpl<char> &dir) {
+  dir.assign(input.begin(), input.end());
+  llvm::SmallString<128> multi{input};
+  llvm::sys::path::append(multi, "MULTI__TIME");
+  if (llvm::sys::fs::is_directory(multi))
+    dir.assign(multi.begin(), multi.end());
+
+  std::error_code ec;
+  size_t first = files.size();
+  for (llvm::sys::fs::directory_iterator it(dir, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    if (llvm::sys::path::filename(it->path()).startswith("profile."))
+      files.push_back(it->path());
+  }
+  std::sort(files.begin() + first, files.end());
+  return !ec && first != files.size();
+}
+
+#endif // TAU_PROFILE_H
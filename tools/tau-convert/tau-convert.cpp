@@ -0,0 +1,969 @@
+//===- tau-convert.cpp - Convert the traces and profiles of a run ---------===//
+//
+// Reads the trace written by the built-in runtime with TAU_TRACE=1, or the
+// profile.* files of a run, and writes TAU profiles, a Chrome trace (the JSON
+// read by chrome://tracing and Perfetto), or flat or call path summaries.
+//
+// The inputs are mapped in memory and decoded by a pool of threads. The
+// chunks of a trace are decoded independently, in two passes: the first
+// finds the calls each chunk leaves running, from which the calls running at
+// the start of each chunk are known; the second accumulates the profiles of
+// consecutive chunks from there, or formats their events.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "TAUProfile.h"
+#include "TAUTrace.h"
+
+using namespace llvm;
+
+enum class OutputFormat { Profile, Chrome, Flat, Callpath };
+
+static cl::OptionCategory ConvertCategory("tau-convert options");
+
+static cl::list<std::string>
+    Inputs(cl::Positional, cl::OneOrMore,
+           cl::desc("<trace, profile files or directories>"),
+           cl::cat(ConvertCategory));
+
+static cl::opt<OutputFormat> Format(
+    "format", cl::desc("Output format"), cl::init(OutputFormat::Flat),
+    cl::values(clEnumValN(OutputFormat::Profile, "profile",
+                          "TAU profiles, one per thread, in the -o "
+                          "directory"),
+               clEnumValN(OutputFormat::Chrome, "chrome",
+                          "Chrome trace events (from a trace only)"),
+               clEnumValN(OutputFormat::Flat, "flat",
+                          "Calls and times of each function (default)"),
+               clEnumValN(OutputFormat::Callpath, "callpath",
+                          "Calls and times of each call path")),
+    cl::cat(ConvertCategory));
+
+static cl::opt<std::string> OutputFile(
+    "o",
+    cl::desc("Output file (default: standard output), or directory with "
+             "-format=profile (default: the current directory)"),
+    cl::value_desc("filename"), cl::cat(ConvertCategory));
+
+static cl::opt<bool>
+    ProfileCallpaths("callpaths",
+                     cl::desc("Also write the call paths in the TAU "
+                              "profiles, as TAU does with TAU_CALLPATH=1"),
+                     cl::cat(ConvertCategory));
+
+static cl::opt<bool> PerThread("per-thread",
+                               cl::desc("Print the summary of each thread "
+                                        "rather than their sum"),
+                               cl::cat(ConvertCategory));
+
+static cl::opt<unsigned>
+    Jobs("j", cl::desc("Number of threads (default: one per core)"),
+         cl::init(0), cl::cat(ConvertCategory));
+
+namespace {
+
+/* Calls and times of a function or a call path, in ns */
+struct Counters {
+  uint64_t calls = 0;
+  uint64_t subrs = 0;
+  uint64_t exclusive = 0;
+  uint64_t inclusive = 0;
+
+  void add(const Counters &other) {
+    calls += other.calls;
+    subrs += other.subrs;
+    exclusive += other.exclusive;
+    inclusive += other.inclusive;
+  }
+};
+
+/*
+ * The call paths of a thread: node 0 is the thread itself, the others a
+ * function called from the function of their parent. The parents come
+ * before their children.
+ */
+struct CallTree {
+  struct Node {
+    uint32_t parent;
+    uint32_t id;
+    Counters counters;
+  };
+  std::vector<Node> nodes{Node{0, 0, Counters()}};
+  DenseMap<std::pair<uint32_t, uint32_t>, uint32_t> children;
+
+  uint32_t child(uint32_t parent, uint32_t id) {
+    auto inserted = children.try_emplace({parent, id}, nodes.size());
+    if (inserted.second)
+      nodes.push_back(Node{parent, id, Counters()});
+    return inserted.first->second;
+  }
+
+  void merge(const CallTree &other) {
+    std::vector<uint32_t> mapped(other.nodes.size(), 0);
+    for (size_t i = 1; i < other.nodes.size(); ++i) {
+      const Node &node = other.nodes[i];
+      mapped[i] = child(mapped[node.parent], node.id);
+      nodes[mapped[i]].counters.add(node.counters);
+    }
+  }
+};
+
+/* What a thread did, or a part of it */
+struct Profile {
+  std::vector<Counters> functions; // by id
+  CallTree paths;
+
+  explicit Profile(size_t numFunctions = 0) : functions(numFunctions) {}
+
+  void merge(const Profile &other) {
+    if (functions.size() < other.functions.size())
+      functions.resize(other.functions.size());
+    for (size_t id = 0; id < other.functions.size(); ++id)
+      functions[id].add(other.functions[id]);
+    paths.merge(other.paths);
+  }
+};
+
+/* The profiles of a run, whatever the input */
+struct Run {
+  std::vector<std::string> names; // by function id
+  std::vector<std::string> labels;
+  std::vector<Profile> threads; // with their labels
+};
+
+struct Chunk {
+  const tau_trace_chunk_header *header;
+  const tau_trace_event *events;
+};
+
+/* A running call */
+struct Frame {
+  uint32_t id;
+  uint32_t node; // in the call tree of the decoder
+  uint64_t start;
+};
+
+/* What a chunk leaves to the following ones */
+struct ChunkEffect {
+  uint32_t exits = 0;         // of calls entered in the previous chunks
+  std::vector<Frame> entries; // calls entered and still running at its end
+};
+
+/* Consecutive chunks of a thread, decoded by a single task */
+struct ChunkRange {
+  size_t thread;
+  size_t first;
+  size_t last;
+};
+
+struct Trace {
+  std::string path;
+  sys::fs::mapped_file_region region;
+  const tau_trace_file_header *header = nullptr;
+  std::vector<std::string> names;
+  std::vector<std::vector<Chunk>> threads; // by thread, by sequence
+};
+
+/* A profile file, before its names are given ids */
+struct ProfileFile {
+  std::string path;
+  std::vector<std::pair<std::string, Counters>> entries;
+  std::string error;
+};
+
+/* The first error of the tasks of a pool */
+class TaskError {
+  std::atomic<bool> failed{false};
+  std::mutex lock;
+  std::string message;
+
+public:
+  void set(const Twine &error) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!failed.exchange(true))
+      message = error.str();
+  }
+  bool check() {
+    if (failed)
+      errs() << "tau-convert: " << message << "\n";
+    return !failed;
+  }
+  explicit operator bool() const { return failed; }
+};
+
+/*!
+ * Accumulates the profile of consecutive chunks of a thread, given the
+ * calls running before the first one.
+ */
+class ProfileDecoder {
+  Profile profile;
+  std::vector<uint32_t> active; // running calls, by function
+  std::vector<Frame> stack;
+  uint64_t last;   // time of the previous event
+  bool loopCalls = false; // the previous event was a CALLS event
+
+  /* The time since the previous event is spent in the running function */
+  void elapse(uint64_t time) {
+    if (!stack.empty()) {
+      uint64_t elapsed = time - last;
+      profile.functions[stack.back().id].exclusive += elapsed;
+      profile.paths.nodes[stack.back().node].counters.exclusive += elapsed;
+    }
+    last = time;
+  }
+
+  void enter(uint32_t id, uint64_t time) {
+    uint32_t parent = 0;
+    if (!stack.empty()) {
+      parent = stack.back().node;
+      ++profile.functions[stack.back().id].subrs;
+      ++profile.paths.nodes[parent].counters.subrs;
+    }
+    uint32_t node = profile.paths.child(parent, id);
+    ++profile.functions[id].calls;
+    ++profile.paths.nodes[node].counters.calls;
+    ++active[id];
+    stack.push_back(Frame{id, node, time});
+  }
+
+  /* The inclusive time of recursive calls is counted once, as in TAU */
+  void exit(uint64_t time) {
+    Frame frame = stack.back();
+    stack.pop_back();
+    uint64_t elapsed = time - frame.start;
+    profile.paths.nodes[frame.node].counters.inclusive += elapsed;
+    if (--active[frame.id] == 0)
+      profile.functions[frame.id].inclusive += elapsed;
+  }
+
+  /*
+   * A single call was recorded for the calls of a loop whose probes were
+   * hoisted out of it; the count may be split over several events.
+   */
+  void addLoopCalls(uint32_t id, uint64_t calls) {
+    if (stack.empty() || stack.back().id != id)
+      return;
+    const Frame &frame = stack.back();
+    profile.functions[id].calls += calls;
+    profile.paths.nodes[frame.node].counters.calls += calls;
+    if (stack.size() > 1) {
+      const Frame &parent = stack[stack.size() - 2];
+      profile.functions[parent.id].subrs += calls;
+      profile.paths.nodes[parent.node].counters.subrs += calls;
+    }
+  }
+
+public:
+  ProfileDecoder(size_t numFunctions, const std::vector<Frame> &running,
+                 uint64_t start)
+      : profile(numFunctions), active(numFunctions), stack(running),
+        last(start) {
+    uint32_t node = 0;
+    for (Frame &frame : stack) {
+      node = frame.node = profile.paths.child(node, frame.id);
+      ++active[frame.id];
+    }
+  }
+
+  bool event(unsigned kind, uint32_t id, uint32_t value, uint64_t time) {
+    bool continued = loopCalls;
+    loopCalls = false;
+    switch (kind) {
+    case TAU_TRACE_ENTER:
+      elapse(time);
+      enter(id, time);
+      return true;
+    case TAU_TRACE_EXIT:
+      elapse(time);
+      if (stack.empty() || stack.back().id != id)
+        return false;
+      exit(time);
+      return true;
+    default:
+      // Wraps around if the loop made no call, as in the runtime
+      addLoopCalls(id, continued ? value : value - uint64_t(1));
+      loopCalls = true;
+      return true;
+    }
+  }
+
+  /* End the calls still running at the end of the trace */
+  void finish(uint64_t time) {
+    elapse(time);
+    while (!stack.empty())
+      exit(time);
+  }
+
+  const Profile &result() const { return profile; }
+};
+
+} // namespace
+
+/*!
+ * Call f(kind, id, value, time) for each event of a chunk, the CLOCK events
+ * being added to the time of the next one. Stops and returns false if an
+ * event is not valid, or if f returns false.
+ */
+template <typename Callback>
+static bool forEachEvent(const Chunk &chunk, size_t numFunctions,
+                         Callback f) {
+  uint64_t time = chunk.header->start;
+  for (uint32_t i = 0; i < chunk.header->events; ++i) {
+    const tau_trace_event &event = chunk.events[i];
+    unsigned kind = event.word >> TAU_TRACE_KIND_SHIFT;
+    uint32_t id = event.word & TAU_TRACE_ID_MASK;
+    if (kind == TAU_TRACE_CLOCK) {
+      time += uint64_t(event.value) << 32;
+      continue;
+    }
+    if (id >= numFunctions)
+      return false;
+    if (kind != TAU_TRACE_CALLS)
+      time += event.value;
+    if (!f(kind, id, event.value, time))
+      return false;
+  }
+  return true;
+}
+
+static std::string chunkName(const Trace &trace, const Chunk &chunk) {
+  return trace.path + ": chunk " + std::to_string(chunk.header->sequence) +
+         " of thread " + std::to_string(chunk.header->thread) +
+         " is corrupt";
+}
+
+/*!
+ * Map a trace and index its chunks.
+ */
+static bool readTrace(StringRef path, Trace &trace) {
+  trace.path = path.str();
+  /* The size is the one of the file mapped, not of the path */
+  uint64_t size = 0;
+  sys::fs::file_status status;
+  Expected<sys::fs::file_t> file = sys::fs::openNativeFileForRead(path);
+  std::error_code ec = file ? sys::fs::status(*file, status)
+                            : errorToErrorCode(file.takeError());
+  if (!ec)
+    size = status.getSize();
+  if (!ec && size < TAU_TRACE_BLOCK)
+    ec = std::make_error_code(std::errc::invalid_argument);
+  if (!ec)
+    trace.region = sys::fs::mapped_file_region(
+        *file, sys::fs::mapped_file_region::readonly, size, 0, ec);
+  if (file)
+    sys::fs::closeFile(*file);
+  if (ec) {
+    errs() << "tau-convert: cannot read " << path << ": " << ec.message()
+           << "\n";
+    return false;
+  }
+
+  const char *data = trace.region.const_data();
+  const auto *header = reinterpret_cast<const tau_trace_file_header *>(data);
+  trace.header = header;
+  if (memcmp(header->magic, TAU_TRACE_MAGIC, sizeof(header->magic)) ||
+      header->version != TAU_TRACE_VERSION) {
+    errs() << "tau-convert: " << path << " is not a trace of this version\n";
+    return false;
+  }
+  if (!header->names_offset) {
+    errs() << "tau-convert: " << path
+           << " is incomplete: the program did not exit normally\n";
+    return false;
+  }
+  if (header->chunk_size < sizeof(tau_trace_chunk_header) ||
+      header->chunk_size % TAU_TRACE_BLOCK ||
+      header->names_offset < TAU_TRACE_BLOCK ||
+      header->names_offset > size ||
+      header->names_size > size - header->names_offset) {
+    errs() << "tau-convert: " << path << " is corrupt\n";
+    return false;
+  }
+
+  StringRef names(data + header->names_offset, header->names_size);
+  while (!names.empty()) {
+    StringRef name;
+    std::tie(name, names) = names.split('\0');
+    trace.names.push_back(name.str());
+  }
+  if (trace.names.size() != header->functions) {
+    errs() << "tau-convert: " << path << ": the names are corrupt\n";
+    return false;
+  }
+
+  size_t capacity = (header->chunk_size - sizeof(tau_trace_chunk_header)) /
+                    sizeof(tau_trace_event);
+  for (uint64_t offset = TAU_TRACE_BLOCK;
+       offset + header->chunk_size <= header->names_offset;
+       offset += header->chunk_size) {
+    Chunk chunk;
+    chunk.header =
+        reinterpret_cast<const tau_trace_chunk_header *>(data + offset);
+    chunk.events = reinterpret_cast<const tau_trace_event *>(chunk.header + 1);
+    if (memcmp(chunk.header->magic, TAU_TRACE_CHUNK_MAGIC,
+               sizeof(chunk.header->magic)) ||
+        chunk.header->events > capacity) {
+      errs() << "tau-convert: " << path << ": corrupt chunk at offset "
+             << offset << "\n";
+      return false;
+    }
+    if (chunk.header->thread >= trace.threads.size())
+      trace.threads.resize(chunk.header->thread + 1);
+    trace.threads[chunk.header->thread].push_back(chunk);
+  }
+
+  for (std::vector<Chunk> &chunks : trace.threads) {
+    std::sort(chunks.begin(), chunks.end(),
+              [](const Chunk &a, const Chunk &b) {
+                return a.header->sequence < b.header->sequence;
+              });
+    for (size_t i = 0; i < chunks.size(); ++i)
+      if (chunks[i].header->sequence != i) {
+        errs() << "tau-convert: " << path << ": chunk " << i << " of thread "
+               << chunks[i].header->thread << " is missing\n";
+        return false;
+      }
+  }
+  if (header->lost_events)
+    errs() << "tau-convert: warning: " << header->lost_events
+           << " events were lost at the end of the trace\n";
+  return true;
+}
+
+/*!
+ * Split the chunks into ranges, enough of them to keep the pool busy even
+ * when a single thread was traced.
+ */
+static std::vector<ChunkRange> chunkRanges(const Trace &trace,
+                                           unsigned numWorkers) {
+  size_t numChunks = 0;
+  for (const std::vector<Chunk> &chunks : trace.threads)
+    numChunks += chunks.size();
+  size_t perRange = std::max<size_t>(1, numChunks / (8 * numWorkers));
+
+  std::vector<ChunkRange> ranges;
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread)
+    for (size_t first = 0; first < trace.threads[thread].size();
+         first += perRange)
+      ranges.push_back(ChunkRange{
+          thread, first,
+          std::min(first + perRange, trace.threads[thread].size())});
+  return ranges;
+}
+
+/*!
+ * The calls running at the start of each range of chunks, and at the end
+ * of each thread (ranges.size() + thread).
+ */
+static bool runningCalls(const Trace &trace,
+                         const std::vector<ChunkRange> &ranges,
+                         ThreadPool &pool,
+                         std::vector<std::vector<Frame>> &running) {
+  // First pass: what each chunk leaves running, in parallel
+  std::vector<std::vector<ChunkEffect>> effects(trace.threads.size());
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread)
+    effects[thread].resize(trace.threads[thread].size());
+  TaskError error;
+  for (const ChunkRange &range : ranges)
+    pool.async([&trace, &effects, &error, range] {
+      for (size_t i = range.first; i < range.last && !error; ++i) {
+        const Chunk &chunk = trace.threads[range.thread][i];
+        ChunkEffect &effect = effects[range.thread][i];
+        bool valid = forEachEvent(
+            chunk, trace.names.size(),
+            [&effect](unsigned kind, uint32_t id, uint32_t, uint64_t time) {
+              if (kind == TAU_TRACE_ENTER) {
+                effect.entries.push_back(Frame{id, 0, time});
+              } else if (kind == TAU_TRACE_EXIT) {
+                if (effect.entries.empty())
+                  ++effect.exits;
+                else if (effect.entries.back().id != id)
+                  return false;
+                else
+                  effect.entries.pop_back();
+              }
+              return true;
+            });
+        if (!valid)
+          error.set(chunkName(trace, chunk));
+      }
+    });
+  pool.wait();
+  if (!error.check())
+    return false;
+
+  // Then the calls running before each chunk, in order
+  running.assign(ranges.size() + trace.threads.size(), {});
+  size_t next = 0;
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread) {
+    std::vector<Frame> stack;
+    for (size_t i = 0; i < effects[thread].size(); ++i) {
+      if (next < ranges.size() && ranges[next].thread == thread &&
+          ranges[next].first == i)
+        running[next++] = stack;
+      const ChunkEffect &effect = effects[thread][i];
+      if (effect.exits > stack.size()) {
+        errs() << "tau-convert: "
+               << chunkName(trace, trace.threads[thread][i]) << "\n";
+        return false;
+      }
+      stack.resize(stack.size() - effect.exits);
+      stack.insert(stack.end(), effect.entries.begin(), effect.entries.end());
+    }
+    running[ranges.size() + thread] = std::move(stack);
+  }
+  return true;
+}
+
+/*!
+ * The profiles of the threads of a trace: each range of chunks is decoded
+ * by a task, whose profile is added to the profile of its thread.
+ */
+static bool profileTrace(const Trace &trace, ThreadPool &pool,
+                         unsigned numWorkers, Run &run) {
+  std::vector<ChunkRange> ranges = chunkRanges(trace, numWorkers);
+  std::vector<std::vector<Frame>> running;
+  if (!runningCalls(trace, ranges, pool, running))
+    return false;
+
+  run.names = trace.names;
+  run.threads.assign(trace.threads.size(), Profile(trace.names.size()));
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread)
+    run.labels.push_back("thread " + std::to_string(thread));
+  std::vector<std::mutex> locks(trace.threads.size());
+  TaskError error;
+  for (size_t r = 0; r < ranges.size(); ++r)
+    pool.async([&, r] {
+      const ChunkRange &range = ranges[r];
+      const std::vector<Chunk> &chunks = trace.threads[range.thread];
+      ProfileDecoder decoder(trace.names.size(), running[r],
+                             chunks[range.first].header->start);
+      auto event = [&decoder](unsigned kind, uint32_t id, uint32_t value,
+                              uint64_t time) {
+        return decoder.event(kind, id, value, time);
+      };
+      for (size_t i = range.first; i < range.last && !error; ++i)
+        if (!forEachEvent(chunks[i], trace.names.size(), event))
+          error.set(chunkName(trace, chunks[i]));
+      if (range.last == chunks.size())
+        decoder.finish(trace.header->end);
+      std::lock_guard<std::mutex> guard(locks[range.thread]);
+      run.threads[range.thread].merge(decoder.result());
+    });
+  pool.wait();
+  return error.check();
+}
+
+/* Microseconds, with the nanoseconds */
+static void writeMicroseconds(raw_ostream &out, uint64_t ns) {
+  out << ns / 1000 << '.';
+  unsigned fraction = ns % 1000;
+  out << char('0' + fraction / 100) << char('0' + fraction / 10 % 10)
+      << char('0' + fraction % 10);
+}
+
+static void writeChromeEvent(raw_ostream &out, StringRef name, char phase,
+                             uint64_t time, size_t thread) {
+  out << ",\n{\"name\":" << name << ",\"ph\":\"" << phase << "\",\"ts\":";
+  writeMicroseconds(out, time);
+  out << ",\"pid\":0,\"tid\":" << thread << "}";
+}
+
+/*!
+ * Write a trace as Chrome trace events: a begin and an end event per call.
+ * The chunks are formatted by the pool, a few per worker at a time, and
+ * written in order: the output is streamed rather than built in memory.
+ */
+static bool writeChrome(const Trace &trace, ThreadPool &pool,
+                        unsigned numWorkers, raw_ostream &out) {
+  std::vector<ChunkRange> ranges = chunkRanges(trace, numWorkers);
+  std::vector<std::vector<Frame>> running;
+  if (!runningCalls(trace, ranges, pool, running))
+    return false;
+
+  std::vector<std::string> names;
+  for (const std::string &name : trace.names) {
+    std::string quoted;
+    raw_string_ostream stream(quoted);
+    json::OStream(stream).value(json::fixUTF8(name));
+    names.push_back(stream.str());
+  }
+  uint64_t start = trace.header->start;
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+      << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+      << "\"args\":{\"name\":\"" << sys::path::filename(trace.path)
+      << "\"}}";
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread)
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+        << thread << ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+
+  std::vector<std::pair<size_t, const Chunk *>> chunks;
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread)
+    for (const Chunk &chunk : trace.threads[thread])
+      chunks.emplace_back(thread, &chunk);
+
+  TaskError error;
+  size_t window = 4 * numWorkers;
+  std::vector<std::string> outputs(window);
+  for (size_t first = 0; first < chunks.size(); first += window) {
+    size_t count = std::min(window, chunks.size() - first);
+    for (size_t i = 0; i < count; ++i)
+      pool.async([&, i] {
+        size_t thread = chunks[first + i].first;
+        const Chunk &chunk = *chunks[first + i].second;
+        std::string &text = outputs[i];
+        text.clear();
+        raw_string_ostream stream(text);
+        bool valid = forEachEvent(
+            chunk, names.size(),
+            [&](unsigned kind, uint32_t id, uint32_t, uint64_t time) {
+              if (kind != TAU_TRACE_CALLS)
+                writeChromeEvent(stream, names[id],
+                                 kind == TAU_TRACE_ENTER ? 'B' : 'E',
+                                 time - start, thread);
+              return true;
+            });
+        stream.flush();
+        if (!valid)
+          error.set(chunkName(trace, chunk));
+      });
+    pool.wait();
+    if (!error.check())
+      return false;
+    for (size_t i = 0; i < count; ++i)
+      out << outputs[i];
+  }
+
+  // The calls still running end with the trace
+  for (size_t thread = 0; thread < trace.threads.size(); ++thread) {
+    const std::vector<Frame> &stack = running[ranges.size() + thread];
+    for (auto frame = stack.rbegin(); frame != stack.rend(); ++frame)
+      writeChromeEvent(out, names[frame->id], 'E',
+                       trace.header->end - start, thread);
+  }
+  out << "\n]}\n";
+  return true;
+}
+
+/*!
+ * Read a profile file, with the times in nanoseconds.
+ */
+static void readProfile(ProfileFile &profile) {
+  profile.error =
+      readProfile(profile.path, [&](const ProfileTimer &timer) {
+        Counters counters;
+        counters.calls = static_cast<uint64_t>(timer.calls);
+        counters.subrs = static_cast<uint64_t>(timer.subrs);
+        counters.exclusive =
+            static_cast<uint64_t>(std::llround(timer.exclusive * 1e3));
+        counters.inclusive =
+            static_cast<uint64_t>(std::llround(timer.inclusive * 1e3));
+        profile.entries.emplace_back(timer.name.str(), counters);
+      });
+}
+
+/*!
+ * The profiles of the files read by the pool, their functions and call
+ * paths being given ids.
+ */
+static bool profileFiles(const std::vector<std::string> &paths,
+                         ThreadPool &pool, Run &run) {
+  std::vector<ProfileFile> files(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    files[i].path = paths[i];
+    pool.async([&files, i] { readProfile(files[i]); });
+  }
+  pool.wait();
+
+  StringMap<uint32_t> ids;
+  auto id = [&](StringRef name) {
+    auto inserted = ids.try_emplace(name, run.names.size());
+    if (inserted.second)
+      run.names.push_back(name.str());
+    return inserted.first->second;
+  };
+  for (const ProfileFile &file : files) {
+    if (!file.error.empty()) {
+      errs() << "tau-convert: " << file.error << "\n";
+      return false;
+    }
+    Profile profile;
+    for (const auto &entry : file.entries) {
+      SmallVector<StringRef, 8> path;
+      StringRef(entry.first).split(path, " => ");
+      if (path.size() == 1) {
+        uint32_t function = id(path[0]);
+        if (profile.functions.size() <= function)
+          profile.functions.resize(function + 1);
+        profile.functions[function].add(entry.second);
+        continue;
+      }
+      uint32_t node = 0;
+      for (StringRef name : path)
+        node = profile.paths.child(node, id(name));
+      profile.paths.nodes[node].counters.add(entry.second);
+    }
+    run.labels.push_back(sys::path::filename(file.path).str());
+    run.threads.push_back(std::move(profile));
+  }
+  for (Profile &profile : run.threads)
+    profile.functions.resize(run.names.size());
+  return true;
+}
+
+/* The names of the nodes of a call tree: the path from the root */
+static std::vector<std::string>
+pathNames(const CallTree &tree, const std::vector<std::string> &names) {
+  std::vector<std::string> paths(tree.nodes.size());
+  for (size_t i = 1; i < tree.nodes.size(); ++i) {
+    const CallTree::Node &node = tree.nodes[i];
+    paths[i] = node.parent ? paths[node.parent] + " => " + names[node.id]
+                           : names[node.id];
+  }
+  return paths;
+}
+
+/*!
+ * Write the profiles in the format of TAU, one file per thread.
+ */
+static bool writeTAUProfiles(const Run &run, StringRef dir) {
+  if (std::error_code ec = sys::fs::create_directories(dir)) {
+    errs() << "tau-convert: cannot create " << dir << ": " << ec.message()
+           << "\n";
+    return false;
+  }
+
+  for (size_t thread = 0; thread < run.threads.size(); ++thread) {
+    const Profile &profile = run.threads[thread];
+    // name, counters, group
+    std::vector<std::tuple<std::string, const Counters *, StringRef>> timers;
+    for (size_t id = 0; id < profile.functions.size(); ++id)
+      if (profile.functions[id].calls)
+        timers.emplace_back(run.names[id], &profile.functions[id],
+                            run.names[id] == ".TAU application"
+                                ? "TAU_DEFAULT"
+                                : "TAU_USER");
+    std::vector<std::string> paths;
+    if (ProfileCallpaths) {
+      paths = pathNames(profile.paths, run.names);
+      for (size_t i = 1; i < paths.size(); ++i)
+        if (profile.paths.nodes[i].counters.calls &&
+            profile.paths.nodes[i].parent)
+          timers.emplace_back(paths[i], &profile.paths.nodes[i].counters,
+                              "TAU_CALLPATH");
+    }
+
+    SmallString<128> path{dir};
+    sys::path::append(path, "profile.0.0." + std::to_string(thread));
+    std::error_code ec;
+    raw_fd_ostream out(path, ec, sys::fs::OF_Text);
+    if (ec) {
+      errs() << "tau-convert: cannot write " << path << ": " << ec.message()
+             << "\n";
+      return false;
+    }
+    out << timers.size() << " templated_functions_MULTI_TIME\n"
+        << "# Name Calls Subrs Excl Incl ProfileCalls #<metadata>"
+           "<attribute><name>Metric Name</name><value>TIME</value>"
+           "</attribute><attribute><name>Node</name><value>0</value>"
+           "</attribute><attribute><name>Thread</name><value>"
+        << thread << "</value></attribute></metadata>\n";
+    for (const auto &timer : timers) {
+      const Counters &counters = *std::get<1>(timer);
+      out << '"' << std::get<0>(timer) << "\" " << counters.calls << ' '
+          << counters.subrs << ' '
+          << format("%.3f %.3f", counters.exclusive / 1e3,
+                    counters.inclusive / 1e3)
+          << " 0 GROUP=\"" << std::get<2>(timer) << "\"\n";
+    }
+    out << "0 aggregates\n";
+  }
+  return true;
+}
+
+/*!
+ * Print the calls and times of the functions, or of the call paths, by
+ * decreasing inclusive time, as pprof does.
+ */
+static void printSummary(raw_ostream &out, StringRef title,
+                         const Profile &profile,
+                         const std::vector<std::string> &names) {
+  std::vector<std::pair<std::string, const Counters *>> rows;
+  if (Format == OutputFormat::Flat) {
+    for (size_t id = 0; id < profile.functions.size(); ++id)
+      if (profile.functions[id].calls)
+        rows.emplace_back(names[id], &profile.functions[id]);
+  } else {
+    std::vector<std::string> paths = pathNames(profile.paths, names);
+    for (size_t i = 1; i < paths.size(); ++i)
+      if (profile.paths.nodes[i].counters.calls)
+        rows.emplace_back(std::move(paths[i]),
+                          &profile.paths.nodes[i].counters);
+  }
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const std::pair<std::string, const Counters *> &a,
+                      const std::pair<std::string, const Counters *> &b) {
+                     return a.second->inclusive > b.second->inclusive;
+                   });
+  uint64_t total = rows.empty() ? 0 : rows.front().second->inclusive;
+
+  out << title << ":\n"
+      << " %Time    Excl msec    Incl msec       Calls       Subrs"
+         "    usec/call  Name\n";
+  for (const auto &row : rows) {
+    const Counters &counters = *row.second;
+    out << format("%6.1f %12.3f %12.3f %11llu %11llu %12.3f  ",
+                  total ? 100.0 * counters.inclusive / total : 0.0,
+                  counters.exclusive / 1e6, counters.inclusive / 1e6,
+                  (unsigned long long)counters.calls,
+                  (unsigned long long)counters.subrs,
+                  counters.inclusive / 1e3 / counters.calls)
+        << row.first << "\n";
+  }
+}
+
+/*!
+ * The inputs: a trace, or profile files. The directories are searched for
+ * a trace (tautrace.bin), then for profile.* files, in their MULTI__TIME
+ * subdirectory when TAU measured several metrics.
+ */
+static bool findInputs(std::string &tracePath,
+                       std::vector<std::string> &profiles) {
+  for (const std::string &input : Inputs) {
+    if (!sys::fs::is_directory(input)) {
+      char magic[sizeof(TAU_TRACE_MAGIC) - 1] = {};
+      if (auto file = MemoryBuffer::getFileSlice(input, sizeof(magic), 0))
+        memcpy(magic, (*file)->getBufferStart(),
+               std::min((*file)->getBufferSize(), sizeof(magic)));
+      if (!memcmp(magic, TAU_TRACE_MAGIC, sizeof(magic)))
+        tracePath = input;
+      else
+        profiles.push_back(input);
+      continue;
+    }
+
+    SmallString<128> trace{input};
+    sys::path::append(trace, "tautrace.bin");
+    if (sys::fs::exists(trace)) {
+      tracePath = trace.str().str();
+      continue;
+    }
+
+    SmallString<128> dir;
+    if (!findProfiles(input, profiles, dir))
+      errs() << "tau-convert: no trace or profile found in " << dir << "\n";
+  }
+
+  if (!tracePath.empty() && (Inputs.size() > 1 || !profiles.empty())) {
+    errs() << "tau-convert: a trace is converted alone\n";
+    return false;
+  }
+  if (tracePath.empty() && profiles.empty())
+    return false;
+  if (tracePath.empty() && Format == OutputFormat::Chrome) {
+    errs() << "tau-convert: profiles have no timeline: -format=chrome "
+              "needs a trace\n";
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::HideUnrelatedOptions(ConvertCategory);
+  cl::ParseCommandLineOptions(
+      argc, argv,
+      "Convert the trace or the profiles of a run to TAU profiles, Chrome "
+      "trace events, or flat or call path summaries\n");
+
+  std::string tracePath;
+  std::vector<std::string> profilePaths;
+  if (!findInputs(tracePath, profilePaths))
+    return 1;
+
+  ThreadPoolStrategy strategy = hardware_concurrency(Jobs);
+  unsigned numWorkers = strategy.compute_thread_count();
+  ThreadPool pool(strategy);
+
+  Trace trace;
+  if (!tracePath.empty() && !readTrace(tracePath, trace))
+    return 1;
+
+  if (Format == OutputFormat::Profile) {
+    Run run;
+    if (tracePath.empty() ? !profileFiles(profilePaths, pool, run)
+                          : !profileTrace(trace, pool, numWorkers, run))
+      return 1;
+    return writeTAUProfiles(run, OutputFile.empty() ? StringRef(".")
+                                                    : StringRef(OutputFile))
+               ? 0
+               : 1;
+  }
+
+  std::error_code ec;
+  ToolOutputFile out(OutputFile.empty() ? StringRef("-")
+                                         : StringRef(OutputFile),
+                     ec,
+                     sys::fs::OF_Text);
+  if (ec) {
+    errs() << "tau-convert: " << OutputFile << ": " << ec.message() << "\n";
+    return 1;
+  }
+
+  if (Format == OutputFormat::Chrome) {
+    if (!writeChrome(trace, pool, numWorkers, out.os()))
+      return 1;
+    out.keep();
+    return 0;
+  }
+
+  Run run;
+  if (tracePath.empty() ? !profileFiles(profilePaths, pool, run)
+                        : !profileTrace(trace, pool, numWorkers, run))
+    return 1;
+  if (PerThread) {
+    for (size_t thread = 0; thread < run.threads.size(); ++thread) {
+      if (thread)
+        out.os() << "\n";
+      printSummary(out.os(), run.labels[thread], run.threads[thread],
+                   run.names);
+    }
+  } else {
+    Profile total(run.names.size());
+    for (const Profile &profile : run.threads)
+      total.merge(profile);
+    printSummary(out.os(),
+                 "sum of " + std::to_string(run.threads.size()) + " threads",
+                 total, run.names);
+  }
+  out.keep();
+  return 0;
+}
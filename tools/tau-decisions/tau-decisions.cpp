@@ -0,0 +1,259 @@
+//===- tau-decisions.cpp - Merge the instrumentation decisions ------------===//
+//
+// Reads the optimization remarks saved while compiling a program with the
+// plugin (-fsave-optimization-record, or -pass-remarks-output with opt) and
+// merges the decision records of all the translation units: a function
+// defined in a header has one record per unit that compiled it.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Remarks/Remark.h"
+#include "llvm/Remarks/RemarkFormat.h"
+#include "llvm/Remarks/RemarkParser.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static cl::OptionCategory DecisionsCategory("tau-decisions options");
+
+static cl::list<std::string>
+    Inputs(cl::Positional, cl::OneOrMore,
+           cl::desc("<remark files or directories to search>"),
+           cl::cat(DecisionsCategory));
+
+static cl::opt<bool> ListFunctions("list",
+                                   cl::desc("Print the decisions taken for "
+                                            "each function"),
+                                   cl::cat(DecisionsCategory));
+
+static cl::opt<bool> JSONOutput("json",
+                                cl::desc("Print the merged records of all "
+                                         "the functions as JSON"),
+                                cl::cat(DecisionsCategory));
+
+static cl::opt<bool> AllFunctions(
+    "all", cl::desc("Include the functions matched by no include entry"),
+    cl::cat(DecisionsCategory));
+
+namespace {
+
+/* The records of one function, merged over the translation units */
+struct FunctionRecord {
+  std::string name;
+  std::string file;
+  unsigned instrumented = 0;
+  unsigned skipped = 0;
+  // "rule" or "rule: reason" -> number of records
+  std::map<std::string, unsigned> rules;
+};
+
+} // namespace
+
+/*!
+ * The remark files to read: the files given, and the *.opt.yaml files found
+ * under the directories given. Bitstream remarks are not read: their string
+ * table is written to the object files rather than to the remark files.
+ */
+static std::vector<std::string> remarkFiles() {
+  std::vector<std::string> files;
+  for (const std::string &input : Inputs) {
+    if (!sys::fs::is_directory(input)) {
+      files.push_back(input);
+      continue;
+    }
+    std::error_code ec;
+    for (sys::fs::recursive_directory_iterator it(input, ec), end;
+         it != end && !ec; it.increment(ec)) {
+      StringRef path = it->path();
+      if (path.endswith(".opt.yaml"))
+        files.push_back(path.str());
+    }
+  }
+  return files;
+}
+
+/*!
+ * Add the decision records of a remark file, the remarks of the tau-profile
+ * pass named Instrumented, NotInstrumented or NotSelected, to the records.
+ */
+static bool readRemarks(StringRef path,
+                        StringMap<FunctionRecord> &records) {
+  auto buffer = MemoryBuffer::getFile(path);
+  if (!buffer) {
+    errs() << "tau-decisions: cannot read " << path << ": "
+           << buffer.getError().message() << "\n";
+    return false;
+  }
+  StringRef contents = (*buffer)->getBuffer();
+
+  Expected<remarks::Format> format = remarks::magicToFormat(contents);
+  Expected<std::unique_ptr<remarks::RemarkParser>> parser =
+      format ? remarks::createRemarkParser(*format, contents)
+             : format.takeError();
+  if (!parser) {
+    errs() << "tau-decisions: " << path << ": "
+           << toString(parser.takeError()) << "\n";
+    return false;
+  }
+
+  while (true) {
+    Expected<std::unique_ptr<remarks::Remark>> remark = (*parser)->next();
+    if (!remark) {
+      Error error = remark.takeError();
+      if (error.isA<remarks::EndOfFileError>()) {
+        consumeError(std::move(error));
+        return true;
+      }
+      errs() << "tau-decisions: " << path << ": " << toString(std::move(error))
+             << "\n";
+      return false;
+    }
+
+    const remarks::Remark &decision = **remark;
+    if (decision.PassName != "tau-profile")
+      continue;
+    bool instrumented = decision.RemarkName == "Instrumented";
+    bool notSelected = decision.RemarkName == "NotSelected";
+    if (!instrumented && !notSelected &&
+        decision.RemarkName != "NotInstrumented")
+      continue;
+    if (notSelected && !AllFunctions)
+      continue;
+
+    StringRef name, file, rule, reason;
+    for (const remarks::Argument &arg : decision.Args) {
+      if (arg.Key == "Name")
+        name = arg.Val;
+      else if (arg.Key == "File")
+        file = arg.Val;
+      else if (arg.Key == "Rule")
+        rule = arg.Val;
+      else if (arg.Key == "Reason")
+        reason = arg.Val;
+    }
+
+    FunctionRecord &record = records[decision.FunctionName];
+    if (record.name.empty()) {
+      record.name = name.str();
+      record.file = file.str();
+    }
+    ++(instrumented ? record.instrumented : record.skipped);
+    std::string ruleAndReason = rule.str();
+    if (!reason.empty())
+      ruleAndReason += ": " + reason.str();
+    ++record.rules[ruleAndReason];
+  }
+}
+
+static void printJSON(const std::vector<const StringMapEntry<FunctionRecord> *>
+                          &functions) {
+  json::OStream json(outs(), 2);
+  json.array([&] {
+    for (const auto *entry : functions) {
+      const FunctionRecord &record = entry->getValue();
+      json.object([&] {
+        json.attribute("mangled", entry->getKey());
+        json.attribute("name", record.name);
+        json.attribute("file", record.file);
+        json.attribute("instrumented", record.instrumented);
+        json.attribute("skipped", record.skipped);
+        json.attributeObject("rules", [&] {
+          for (const auto &rule : record.rules)
+            json.attribute(rule.first, rule.second);
+        });
+      });
+    }
+  });
+  outs() << "\n";
+}
+
+static void printSummary(const std::vector<const StringMapEntry<FunctionRecord>
+                                               *> &functions,
+                         size_t numFiles) {
+  unsigned instrumented = 0, skipped = 0, both = 0;
+  std::map<std::string, unsigned> rules;
+  for (const auto *entry : functions) {
+    const FunctionRecord &record = entry->getValue();
+    instrumented += record.instrumented && !record.skipped;
+    skipped += record.skipped && !record.instrumented;
+    both += record.instrumented && record.skipped;
+    for (const auto &rule : record.rules)
+      rules[StringRef(rule.first).split(':').first.str()] += rule.second;
+  }
+
+  outs() << functions.size() << " functions in " << numFiles
+         << " remark files\n";
+  outs() << "  instrumented:        " << instrumented << "\n";
+  outs() << "  not instrumented:    " << skipped << "\n";
+  outs() << "  in some units only:  " << both << "\n";
+  outs() << "records by rule:\n";
+  for (const auto &rule : rules)
+    outs() << "  " << rule.first << ": " << rule.second << "\n";
+
+  if (both) {
+    outs() << "functions instrumented in some units only:\n";
+    for (const auto *entry : functions) {
+      const FunctionRecord &record = entry->getValue();
+      if (record.instrumented && record.skipped)
+        outs() << "  " << record.name << " (" << record.file << "): "
+               << record.instrumented << " of "
+               << record.instrumented + record.skipped << "\n";
+    }
+  }
+
+  if (ListFunctions) {
+    outs() << "decisions:\n";
+    for (const auto *entry : functions) {
+      const FunctionRecord &record = entry->getValue();
+      outs() << "  " << (record.instrumented ? "instrument" : "skip") << " "
+             << record.name << " (" << record.file << ")";
+      for (const auto &rule : record.rules)
+        outs() << " [" << rule.first << " x" << rule.second << "]";
+      outs() << "\n";
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::HideUnrelatedOptions(DecisionsCategory);
+  cl::ParseCommandLineOptions(
+      argc, argv,
+      "Merge the instrumentation decisions of the TAU plugin saved as "
+      "optimization remarks\n");
+
+  StringMap<FunctionRecord> records;
+  std::vector<std::string> files = remarkFiles();
+  for (const std::string &file : files)
+    if (!readRemarks(file, records))
+      return 1;
+
+  // Sorted by file, then name
+  std::vector<const StringMapEntry<FunctionRecord> *> functions;
+  for (const auto &entry : records)
+    functions.push_back(&entry);
+  std::sort(functions.begin(), functions.end(),
+            [](const StringMapEntry<FunctionRecord> *a,
+               const StringMapEntry<FunctionRecord> *b) {
+              return std::tie(a->getValue().file, a->getValue().name) <
+                     std::tie(b->getValue().file, b->getValue().name);
+            });
+
+  if (JSONOutput)
+    printJSON(functions);
+  else
+    printSummary(functions, files.size());
+  return 0;
+}
@@ -0,0 +1,172 @@
+//===- tau-gen-exclude.cpp - Exclude list from TAU profiles ---------------===//
+//
+// Reads the profile.* files written by TAU (or by any runtime writing the
+// same format) after a run of a broadly instrumented program, and writes a
+// selective instrumentation file excluding the functions that are called
+// often and spend too little time per call for their probes to be worth it.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "TAUProfile.h"
+
+using namespace llvm;
+
+static cl::OptionCategory GenExcludeCategory("tau-gen-exclude options");
+
+static cl::list<std::string> Inputs(cl::Positional, cl::OneOrMore,
+                                    cl::desc("<profile files or directories>"),
+                                    cl::cat(GenExcludeCategory));
+
+static cl::opt<std::string>
+    OutputFile("o", cl::desc("Output file (default: standard output)"),
+               cl::value_desc("filename"), cl::init("-"),
+               cl::cat(GenExcludeCategory));
+
+static cl::opt<std::string>
+    BaseList("base",
+             cl::desc("Selective instrumentation file to copy before the "
+                      "generated exclude list"),
+             cl::value_desc("filename"), cl::cat(GenExcludeCategory));
+
+static cl::opt<double> MinTimePerCall(
+    "min-time-per-call",
+    cl::desc("Exclude the functions spending less inclusive time per call, "
+             "in microseconds"),
+    cl::value_desc("usec"), cl::init(10), cl::cat(GenExcludeCategory));
+
+static cl::opt<uint64_t>
+    MinCalls("min-calls",
+             cl::desc("Only exclude the functions called at least this "
+                      "many times in total"),
+             cl::init(2), cl::cat(GenExcludeCategory));
+
+namespace {
+
+/* A function, summed over all the profiles (threads) */
+struct FunctionTotals {
+  uint64_t calls = 0;
+  double inclusive = 0; // usec
+};
+
+} // namespace
+
+/*!
+ * The name of a timer, without the source location TAU appends to the
+ * timers of its own instrumentation (` [{file} {line,col}]`).
+ */
+static StringRef timerName(StringRef name) {
+  size_t location = name.rfind(" [{");
+  if (location != StringRef::npos && name.endswith("]"))
+    name = name.take_front(location);
+  return name;
+}
+
+/*!
+ * Add the functions of a profile file to the totals, leaving out the call
+ * paths and the timer of the whole thread.
+ */
+static bool addProfile(StringRef path, StringMap<FunctionTotals> &totals) {
+  std::string error =
+      readProfile(path, [&](const ProfileTimer &timer) {
+        if (!timer.isFunction())
+          return;
+        FunctionTotals &function = totals[timerName(timer.name)];
+        function.calls += static_cast<uint64_t>(timer.calls);
+        function.inclusive += timer.inclusive;
+      });
+  if (error.empty())
+    return true;
+  errs() << "tau-gen-exclude: " << error << "\n";
+  return false;
+}
+
+/*!
+ * The profile files to read: the files given, and the profile.* files of the
+ * directories given.
+ */
+static std::vector<std::string> profileFiles() {
+  std::vector<std::string> files;
+  for (const std::string &input : Inputs) {
+    SmallString<128> dir;
+    if (!sys::fs::is_directory(input))
+      files.push_back(input);
+    else if (!findProfiles(input, files, dir))
+      errs() << "tau-gen-exclude: no profile found in " << dir << "\n";
+  }
+  return files;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::HideUnrelatedOptions(GenExcludeCategory);
+  cl::ParseCommandLineOptions(
+      argc, argv,
+      "Generate a TAU selective instrumentation file excluding the "
+      "functions that are cheap per call\n");
+
+  StringMap<FunctionTotals> totals;
+  std::vector<std::string> files = profileFiles();
+  for (const std::string &file : files)
+    if (!addProfile(file, totals))
+      return 1;
+
+  std::vector<StringRef> excluded;
+  for (const auto &entry : totals) {
+    const FunctionTotals &function = entry.getValue();
+    if (function.calls < MinCalls ||
+        function.inclusive / function.calls >= MinTimePerCall)
+      continue;
+    // '#' is the wildcard of the function lists
+    if (entry.getKey().contains('#')) {
+      errs() << "tau-gen-exclude: cannot exclude " << entry.getKey() << "\n";
+      continue;
+    }
+    excluded.push_back(entry.getKey());
+  }
+  std::sort(excluded.begin(), excluded.end());
+
+  std::error_code ec;
+  ToolOutputFile out(OutputFile, ec, sys::fs::OF_Text);
+  if (ec) {
+    errs() << "tau-gen-exclude: " << OutputFile << ": " << ec.message()
+           << "\n";
+    return 1;
+  }
+
+  if (!BaseList.empty()) {
+    auto base = MemoryBuffer::getFile(BaseList);
+    if (!base) {
+      errs() << "tau-gen-exclude: cannot read " << BaseList << ": "
+             << base.getError().message() << "\n";
+      return 1;
+    }
+    StringRef contents = (*base)->getBuffer();
+    out.os() << contents;
+    if (!contents.empty() && !contents.endswith("\n"))
+      out.os() << "\n";
+  }
+
+  out.os() << "BEGIN_EXCLUDE_LIST\n";
+  for (StringRef name : excluded)
+    out.os() << name << "\n";
+  out.os() << "END_EXCLUDE_LIST\n";
+  out.keep();
+
+  errs() << "tau-gen-exclude: excluded " << excluded.size() << " of "
+         << totals.size() << " functions from " << files.size()
+         << " profiles\n";
+  return 0;
+}